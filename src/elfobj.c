@@ -0,0 +1,306 @@
+/* elfobj.c
+   write binary data as an ARM ELF relocatable object
+
+This file is part of gba-tools.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to
+  Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+  Boston, MA  02111-1307, USA.
+GNU licenses can be viewed online at http://www.gnu.org/copyleft/
+
+*/
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "elfobj.h"
+
+/* ELF32 constants used below */
+#define ET_REL          1
+#define EM_ARM          40
+#define EV_CURRENT      1
+#define EF_ARM_EABI_VER5 0x05000000
+
+#define SHT_PROGBITS    1
+#define SHT_SYMTAB      2
+#define SHT_STRTAB      3
+#define SHF_WRITE       0x1
+#define SHF_ALLOC       0x2
+
+#define STB_LOCAL       0
+#define STB_GLOBAL      1
+#define STT_NOTYPE      0
+#define STT_OBJECT      1
+#define STT_SECTION     3
+
+#define EHDR_SIZE       52
+#define SHDR_SIZE       40
+#define SYM_SIZE        16
+
+/* section indices */
+enum
+{
+  SEC_NULL, SEC_DATA, SEC_SYMTAB, SEC_STRTAB, SEC_SHSTRTAB, N_SECTIONS
+};
+
+/* symbol indices; locals must come before globals */
+enum
+{
+  SYM_NULL, SYM_SECTION, SYM_MAPPING, SYM_START, SYM_END, SYM_SIZE_WORD,
+  N_SYMBOLS
+};
+
+
+/* fputi16() ***************************
+   write a 16-bit integer in intel format to a file
+*/
+static void fputi16(unsigned int in, FILE *f)
+{
+  fputc(in, f);
+  fputc(in >> 8, f);
+}
+
+
+/* fputi32() ***************************
+   write a 32-bit integer in intel format to a file
+*/
+static void fputi32(unsigned long in, FILE *f)
+{
+  fputc(in, f);
+  fputc(in >> 8, f);
+  fputc(in >> 16, f);
+  fputc(in >> 24, f);
+}
+
+
+/* fpad() ******************************
+   write zeroes until the file offset reaches pos
+*/
+static void fpad(unsigned long *off, unsigned long pos, FILE *f)
+{
+  while(*off < pos)
+  {
+    fputc(0, f);
+    ++*off;
+  }
+}
+
+
+/* write_shdr() ************************
+   write one section header
+*/
+static void write_shdr(FILE *f, unsigned long name, unsigned long type,
+                       unsigned long flags, unsigned long offset,
+                       unsigned long size, unsigned long link,
+                       unsigned long info, unsigned long align,
+                       unsigned long entsize)
+{
+  fputi32(name, f);
+  fputi32(type, f);
+  fputi32(flags, f);
+  fputi32(0, f);          /* sh_addr */
+  fputi32(offset, f);
+  fputi32(size, f);
+  fputi32(link, f);
+  fputi32(info, f);
+  fputi32(align, f);
+  fputi32(entsize, f);
+}
+
+
+/* write_sym() *************************
+   write one symbol table entry
+*/
+static void write_sym(FILE *f, unsigned long name, unsigned long value,
+                      unsigned long size, unsigned int bind,
+                      unsigned int type, unsigned int shndx)
+{
+  fputi32(name, f);
+  fputi32(value, f);
+  fputi32(size, f);
+  fputc((bind << 4) | type, f);
+  fputc(0, f);            /* st_other */
+  fputi16(shndx, f);
+}
+
+
+/* elfobj_valid_align() ****************
+   Returns nonzero if align is a usable section alignment.
+*/
+int elfobj_valid_align(unsigned long align)
+{
+  return align >= 1 && align <= 0x10000 && !(align & (align - 1));
+}
+
+
+/* elfobj_symbol_from_path() ***********
+   Derives a C identifier from a file name the way bin2s does,
+   after dropping the directory and the final extension: so
+   "gfx/level1.lz.o" becomes "level1_lz".
+   Returns 0 for success or nonzero if the name does not fit.
+*/
+int elfobj_symbol_from_path(char *dst, size_t dst_size, const char *path)
+{
+  const char *base = path, *p, *ext;
+  size_t len = 0;
+
+  for(p = path; *p; p++)
+    if(*p == '/' || *p == '\\')
+      base = p + 1;
+
+  ext = strrchr(base, '.');
+  if(!ext || ext == base)
+    ext = base + strlen(base);
+
+  if(isdigit((unsigned char)*base))
+  {
+    if(len + 1 >= dst_size)
+      return -1;
+    dst[len++] = '_';
+  }
+
+  for(p = base; p < ext; p++)
+  {
+    if(len + 1 >= dst_size)
+      return -1;
+    dst[len++] = isalnum((unsigned char)*p) ? *p : '_';
+  }
+
+  if(len == 0 || len >= dst_size)
+    return -1;
+
+  dst[len] = 0;
+  return 0;
+}
+
+
+/* elfobj_write() **********************
+   Writes len bytes of data to fp as an ARM ELF relocatable object
+   with the data alone in the named section.  Returns 0 for success
+   or nonzero for failure.
+*/
+int elfobj_write(FILE *fp, const void *data, unsigned long len,
+                 const char *section, unsigned long align,
+                 const char *symbol)
+{
+  size_t sym_len = strlen(symbol), sec_len = strlen(section);
+  unsigned long size_off, data_size, data_off, symtab_off, strtab_off,
+                strtab_size, shstrtab_off, shstrtab_size, shdr_off;
+  unsigned long off;
+  unsigned long str_start, str_end, str_size, str_map;
+  unsigned long sh_data, sh_symtab, sh_strtab, sh_shstrtab;
+  unsigned long flags = SHF_ALLOC;
+
+  if(!elfobj_valid_align(align) || sym_len == 0 || sec_len == 0)
+    return -1;
+
+  /* the _size word needs at least word alignment */
+  if(align < 4)
+    align = 4;
+
+  /* read-only unless the section is known to be writable */
+  if(strncmp(section, ".rodata", 7) && strncmp(section, ".text", 5))
+    flags |= SHF_WRITE;
+
+  /* section contents: data, then the _size word */
+  size_off  = (len + 3) & ~3UL;
+  data_size = size_off + 4;
+
+  /* .strtab: "\0" NAME "\0" NAME_end "\0" NAME_size "\0" "$d" "\0" */
+  str_start   = 1;
+  str_end     = str_start + sym_len + 1;
+  str_size    = str_end + sym_len + 5;
+  str_map     = str_size + sym_len + 6;
+  strtab_size = str_map + 3;
+
+  /* .shstrtab: "\0" section "\0.symtab\0.strtab\0.shstrtab\0" */
+  sh_data       = 1;
+  sh_symtab     = sh_data + sec_len + 1;
+  sh_strtab     = sh_symtab + 8;
+  sh_shstrtab   = sh_strtab + 8;
+  shstrtab_size = sh_shstrtab + 10;
+
+  /* file layout */
+  data_off     = (EHDR_SIZE + align - 1) & ~(align - 1);
+  symtab_off   = (data_off + data_size + 3) & ~3UL;
+  strtab_off   = symtab_off + N_SYMBOLS * SYM_SIZE;
+  shstrtab_off = strtab_off + strtab_size;
+  shdr_off     = (shstrtab_off + shstrtab_size + 3) & ~3UL;
+
+  /* ELF header */
+  fwrite("\177ELF", 4, 1, fp);
+  fputc(1, fp);           /* ELFCLASS32 */
+  fputc(1, fp);           /* ELFDATA2LSB */
+  fputc(EV_CURRENT, fp);
+  for(off = 7; off < 16; off++)
+    fputc(0, fp);
+  fputi16(ET_REL, fp);
+  fputi16(EM_ARM, fp);
+  fputi32(EV_CURRENT, fp);
+  fputi32(0, fp);         /* e_entry */
+  fputi32(0, fp);         /* e_phoff */
+  fputi32(shdr_off, fp);
+  fputi32(EF_ARM_EABI_VER5, fp);
+  fputi16(EHDR_SIZE, fp);
+  fputi16(0, fp);         /* e_phentsize */
+  fputi16(0, fp);         /* e_phnum */
+  fputi16(SHDR_SIZE, fp);
+  fputi16(N_SECTIONS, fp);
+  fputi16(SEC_SHSTRTAB, fp);
+  off = EHDR_SIZE;
+
+  /* section data */
+  fpad(&off, data_off, fp);
+  if(len && fwrite(data, len, 1, fp) != 1)
+    return -1;
+  off += len;
+  fpad(&off, data_off + size_off, fp);
+  fputi32(len, fp);
+  off += 4;
+
+  /* .symtab */
+  fpad(&off, symtab_off, fp);
+  write_sym(fp, 0, 0, 0, STB_LOCAL, STT_NOTYPE, 0);
+  write_sym(fp, 0, 0, 0, STB_LOCAL, STT_SECTION, SEC_DATA);
+  write_sym(fp, str_map, 0, 0, STB_LOCAL, STT_NOTYPE, SEC_DATA);
+  write_sym(fp, str_start, 0, len, STB_GLOBAL, STT_OBJECT, SEC_DATA);
+  write_sym(fp, str_end, len, 0, STB_GLOBAL, STT_NOTYPE, SEC_DATA);
+  write_sym(fp, str_size, size_off, 4, STB_GLOBAL, STT_OBJECT, SEC_DATA);
+  off += N_SYMBOLS * SYM_SIZE;
+
+  /* .strtab */
+  fputc(0, fp);
+  fprintf(fp, "%s%c%s_end%c%s_size%c$d%c", symbol, 0, symbol, 0, symbol, 0, 0);
+  off += strtab_size;
+
+  /* .shstrtab */
+  fputc(0, fp);
+  fprintf(fp, "%s%c.symtab%c.strtab%c.shstrtab%c", section, 0, 0, 0, 0);
+  off += shstrtab_size;
+
+  /* section headers */
+  fpad(&off, shdr_off, fp);
+  write_shdr(fp, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+  write_shdr(fp, sh_data, SHT_PROGBITS, flags, data_off, data_size,
+             0, 0, align, 0);
+  write_shdr(fp, sh_symtab, SHT_SYMTAB, 0, symtab_off, N_SYMBOLS * SYM_SIZE,
+             SEC_STRTAB, SYM_START, 4, SYM_SIZE);
+  write_shdr(fp, sh_strtab, SHT_STRTAB, 0, strtab_off, strtab_size,
+             0, 0, 1, 0);
+  write_shdr(fp, sh_shstrtab, SHT_STRTAB, 0, shstrtab_off, shstrtab_size,
+             0, 0, 1, 0);
+
+  return ferror(fp) ? -1 : 0;
+}
@@ -0,0 +1,52 @@
+/* elfobj.h
+   write binary data as an ARM ELF relocatable object
+
+This file is part of gba-tools.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to
+  Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+  Boston, MA  02111-1307, USA.
+GNU licenses can be viewed online at http://www.gnu.org/copyleft/
+
+*/
+
+#ifndef INCLUDE_ELFOBJ_H
+#define INCLUDE_ELFOBJ_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Symbols are laid out the way bin2s lays them out:
+     NAME       start of the data (object of the data's length)
+     NAME_end   one past the last byte of the data
+     NAME_size  a 32-bit word holding the length of the data
+   so existing bin2s-generated declarations keep working. */
+
+#define ELFOBJ_DEFAULT_SECTION ".rodata"
+#define ELFOBJ_DEFAULT_ALIGN   4
+
+int elfobj_write(FILE *fp, const void *data, unsigned long len,
+                 const char *section, unsigned long align,
+                 const char *symbol);
+int elfobj_symbol_from_path(char *dst, size_t dst_size, const char *path);
+int elfobj_valid_align(unsigned long align);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
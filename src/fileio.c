@@ -0,0 +1,173 @@
+/* fileio.c
+   positioned reads, writes and copies on file descriptors
+
+This file is part of gba-tools.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to
+  Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+  Boston, MA  02111-1307, USA.
+GNU licenses can be viewed online at http://www.gnu.org/copyleft/
+
+*/
+
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#ifndef HAVE_PWRITE
+#include <pthread.h>
+#endif
+
+#include "fileio.h"
+
+#define COPY_BUF_SIZE 65536
+
+#ifndef HAVE_PWRITE
+/* without pread/pwrite, seek and transfer must not interleave */
+static pthread_mutex_t seek_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static ssize_t pread(int fd, void *buf, size_t len, off_t off)
+{
+  ssize_t rc = -1;
+
+  pthread_mutex_lock(&seek_lock);
+  if(lseek(fd, off, SEEK_SET) == off)
+    rc = read(fd, buf, len);
+  pthread_mutex_unlock(&seek_lock);
+  return rc;
+}
+
+static ssize_t pwrite(int fd, const void *buf, size_t len, off_t off)
+{
+  ssize_t rc = -1;
+
+  pthread_mutex_lock(&seek_lock);
+  if(lseek(fd, off, SEEK_SET) == off)
+    rc = write(fd, buf, len);
+  pthread_mutex_unlock(&seek_lock);
+  return rc;
+}
+#endif
+
+
+/* pread_full() ************************
+   read exactly len bytes at off
+*/
+int pread_full(int fd, void *buf, size_t len, off_t off)
+{
+  char *p = buf;
+
+  while(len > 0)
+  {
+    ssize_t rc = pread(fd, p, len, off);
+
+    if(rc < 0 && errno == EINTR)
+      continue;
+    if(rc < 0)
+      return -1;
+    if(rc == 0)
+    {
+      errno = EIO;
+      return -1;
+    }
+    p += rc;
+    off += rc;
+    len -= rc;
+  }
+  return 0;
+}
+
+
+/* pwrite_full() ***********************
+   write exactly len bytes at off
+*/
+int pwrite_full(int fd, const void *buf, size_t len, off_t off)
+{
+  const char *p = buf;
+
+  while(len > 0)
+  {
+    ssize_t rc = pwrite(fd, p, len, off);
+
+    if(rc < 0 && errno == EINTR)
+      continue;
+    if(rc <= 0)
+      return -1;
+    p += rc;
+    off += rc;
+    len -= rc;
+  }
+  return 0;
+}
+
+
+/* copy_range() ************************
+   Copies len bytes from in_fd at in_off to out_fd at out_off,
+   in the kernel where copy_file_range() is available.
+*/
+int copy_range(int out_fd, off_t out_off, int in_fd, off_t in_off,
+               size_t len)
+{
+  char *buf;
+
+#ifdef HAVE_COPY_FILE_RANGE
+  while(len > 0)
+  {
+    ssize_t rc = copy_file_range(in_fd, &in_off, out_fd, &out_off, len, 0);
+
+    if(rc < 0 && errno == EINTR)
+      continue;
+    if(rc < 0)
+    {
+      /* not supported between these files; copy it ourselves */
+      if(errno == EXDEV || errno == EINVAL || errno == ENOSYS
+         || errno == EOPNOTSUPP)
+        break;
+      return -1;
+    }
+    if(rc == 0)
+    {
+      errno = EIO;
+      return -1;
+    }
+    len -= rc;
+  }
+  if(len == 0)
+    return 0;
+#endif
+
+  buf = malloc(len < COPY_BUF_SIZE ? len : COPY_BUF_SIZE);
+  if(!buf)
+    return -1;
+
+  while(len > 0)
+  {
+    size_t n = len < COPY_BUF_SIZE ? len : COPY_BUF_SIZE;
+
+    if(pread_full(in_fd, buf, n, in_off) || pwrite_full(out_fd, buf, n, out_off))
+    {
+      int err = errno;
+
+      free(buf);
+      errno = err;
+      return -1;
+    }
+    in_off += n;
+    out_off += n;
+    len -= n;
+  }
+
+  free(buf);
+  return 0;
+}
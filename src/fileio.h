@@ -0,0 +1,49 @@
+/* fileio.h
+   positioned reads, writes and copies on file descriptors
+
+This file is part of gba-tools.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to
+  Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+  Boston, MA  02111-1307, USA.
+GNU licenses can be viewed online at http://www.gnu.org/copyleft/
+
+*/
+
+#ifndef INCLUDE_FILEIO_H
+#define INCLUDE_FILEIO_H
+
+#include <stddef.h>
+#include <fcntl.h>
+#include <sys/types.h>
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Each returns 0 for success or -1 with errno set.  A short read
+   (the file ended early) fails with errno set to EIO. */
+int pread_full(int fd, void *buf, size_t len, off_t off);
+int pwrite_full(int fd, const void *buf, size_t len, off_t off);
+int copy_range(int out_fd, off_t out_off, int in_fd, off_t in_off,
+               size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -33,6 +33,7 @@
 
 	History
 	-------
+	v1.06 - block padding, -s and -a pad sizes
 	v1.05 - added debug offset argument, (Diegoisawesome)
 	v1.04 - converted to plain C, (WinterMute)
 	v1.03 - header.fixed, header.device_type
@@ -41,18 +42,23 @@
 	v1.00 - logo, complement
 */
 
-#pragma pack(1)
-
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
-#define VER		"1.05"
+#include "fileio.h"
+
+#define VER		"1.06"
 #define ARGV	argv[arg]
 #define VALUE	(ARGV+2)
 #define NUMBER	strtoul(VALUE, NULL, 0)
 
+#pragma pack(1)
+
 typedef struct
 {
 	uint32_t	start_code;			// B instruction
@@ -128,6 +134,67 @@ char HeaderComplement()
 }
 
 
+//---------------------------------------------------------------------------------
+int ParseSize(const char *s, uint64_t *size)
+/*---------------------------------------------------------------------------------
+	Read a byte count, optionally in k or M; returns 0 if valid
+---------------------------------------------------------------------------------*/
+{
+	char *end;
+	uint64_t n = strtoull(s, &end, 0);
+	int shift = 0;
+
+	if (end == s) return -1;
+	if (*end == 'k' || *end == 'K') { shift = 10; end++; }
+	else if (*end == 'm' || *end == 'M') { shift = 20; end++; }
+	if (*end || n > (UINT64_MAX >> shift)) return -1;
+
+	*size = n << shift;
+	return 0;
+}
+
+
+//---------------------------------------------------------------------------------
+int PadFile(FILE *file, uint64_t size)
+/*---------------------------------------------------------------------------------
+	Extend file to size bytes with 0xFF, in large blocks. The file
+	is grown with ftruncate first, so a failed fill can be undone.
+---------------------------------------------------------------------------------*/
+{
+	struct stat st;
+	int fd = fileno(file), err;
+	off_t pos, end = (off_t)size;
+	size_t block;
+	unsigned char *fill;
+
+	if (fflush(file) || fstat(fd, &st)) return -1;
+	if ((uint64_t)st.st_size >= size) return 0;
+	if (end < 0 || (uint64_t)end != size) { errno = EFBIG; return -1; }
+
+	block = size - st.st_size < 0x100000 ? (size_t)(size - st.st_size) : 0x100000;
+	fill = malloc(block);
+	if (!fill) return -1;
+	memset(fill, 0xFF, block);
+
+	if (ftruncate(fd, end)) { free(fill); return -1; }
+
+	for (pos = st.st_size; pos < end; pos += block)
+	{
+		if (end - pos < (off_t)block) block = end - pos;
+		if (pwrite_full(fd, fill, block, pos))
+		{
+			err = errno;
+			free(fill);
+			if (!ftruncate(fd, st.st_size)) errno = err;
+			return -1;
+		}
+	}
+
+	free(fill);
+	return 0;
+}
+
+
 //---------------------------------------------------------------------------------
 int main(int argc, char *argv[])
 //---------------------------------------------------------------------------------
@@ -136,16 +203,20 @@ int main(int argc, char *argv[])
 	char *argfile = 0;
 	FILE *infile;
 
-	int size,bit;
+	struct stat st;
+	uint64_t size, pad_size = 0, pad_align = 0;
+	int pad_pow2 = 0;
 
 	// show syntax
 	if (argc <= 1)
 	{
 		printf("GBA ROM fixer v"VER" by Dark Fader / BlackThunder / WinterMute / Diegoisawesome \n");
-		printf("Syntax: gbafix <rom.gba> [-p] [-t[title]] [-c<game_code>] [-m<maker_code>] [-r<version>] [-d<debug>]\n");
+		printf("Syntax: gbafix <rom.gba> [-p] [-s<size>] [-a<n>] [-t[title]] [-c<game_code>] [-m<maker_code>] [-r<version>] [-d<debug>]\n");
 		printf("\n");
 		printf("parameters:\n");
 		printf("	-p              Pad to next exact power of 2. No minimum size!\n");
+		printf("	-s<size>        Pad to size bytes (k and M suffixes allowed)\n");
+		printf("	-a<n>           Pad to a multiple of n bytes\n");
 		printf("	-t[<title>]     Patch title. Stripped filename if none given.\n");
 		printf("	-c<game_code>   Patch game code (four characters)\n");
 		printf("	-m<maker_code>  Patch maker code (two characters)\n");
@@ -185,17 +256,21 @@ int main(int argc, char *argv[])
 		{
 			switch (ARGV[1])
 			{
-				case 'p':	// pad
+				case 'p':	// pad, once the header is written
 				{
-					fseek(infile, 0, SEEK_END);
-					size = ftell(infile);
-					for (bit=31; bit>=0; bit--) if (size & (1<<bit)) break;
-					if (size != (1<<bit))
-					{
-						int todo = (1<<(bit+1)) - size;
-						while (todo--) fputc(0xFF, infile);
-					}
-					fseek(infile, 0, SEEK_SET);
+					pad_pow2 = 1;
+					break;
+				}
+
+				case 's':	// pad to size
+				{
+					if (ParseSize(VALUE, &pad_size) || !pad_size) { printf("Invalid size %s\n", ARGV); fclose(infile); return -1; }
+					break;
+				}
+
+				case 'a':	// pad to multiple
+				{
+					if (ParseSize(VALUE, &pad_align) || !pad_align) { printf("Invalid size %s\n", ARGV); fclose(infile); return -1; }
 					break;
 				}
 
@@ -271,8 +346,47 @@ int main(int argc, char *argv[])
 	header.complement = HeaderComplement();
 	//header.checksum = checksum_without_header + HeaderChecksum();
 
+	// pad: to the fixed size, then the multiple, then the power of 2.
+	// the size is settled before anything is written, so a bad one
+	// leaves the ROM as it was
+	size = 0;
+	if (pad_size || pad_align || pad_pow2)
+	{
+		if (fstat(fileno(infile), &st)) { printf("Error reading ROM!\n"); fclose(infile); return -1; }
+		size = st.st_size;
+		if (size < sizeof(header)) size = sizeof(header);
+
+		if (pad_size && size > pad_size)
+		{
+			printf("ROM is already larger than %llu bytes!\n", (unsigned long long)pad_size);
+			fclose(infile);
+			return -1;
+		}
+		if (pad_size) size = pad_size;
+		if (pad_align && size % pad_align)
+		{
+			if (size > UINT64_MAX - pad_align) { printf("Pad size too large!\n"); fclose(infile); return -1; }
+			size += pad_align - size % pad_align;
+		}
+		if (pad_pow2 && (size & (size - 1)))
+		{
+			uint64_t p = 1;
+			while (p < size && p <= UINT64_MAX / 2) p <<= 1;
+			if (p < size) { printf("Pad size too large!\n"); fclose(infile); return -1; }
+			size = p;
+		}
+		if ((off_t)size < 0 || (uint64_t)(off_t)size != size) { printf("Pad size too large!\n"); fclose(infile); return -1; }
+	}
+
 	fseek(infile, 0, SEEK_SET);
 	fwrite(&header, sizeof(header), 1, infile);
+
+	if (size && PadFile(infile, size))
+	{
+		printf("Error padding ROM to %llu bytes: %s\n", (unsigned long long)size, strerror(errno));
+		fclose(infile);
+		return -1;
+	}
 	fclose(infile);
 
 	printf("ROM fixed!\n");
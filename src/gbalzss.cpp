@@ -20,569 +20,21 @@
 /** @file gbalzss.cpp
  *  @brief GBA LZSS Encoder/Decoder
  */
-#include <algorithm>
-#include <cassert>
 #include <cctype>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <stdexcept>
-#include <vector>
+#include <utility>
 #include <getopt.h>
 #include <libgen.h>
 #include <cstddef>
+#include "elfobj.h"
+#include "lzss.h"
 
 namespace
 {
 
-/** @brief LZSS maximum encodable size */
-#define LZSS_MAX_ENCODE_LEN 0x00FFFFFF
-
-/** @brief LZSS maximum (theoretical) decodable size
- *  (LZSS_MAX_ENCODE_LEN+1)*9/8 + 4 - 1
- */
-#define LZSS_MAX_DECODE_LEN 0x01B00003
-
-/** @brief LZ10 maximum match length */
-#define LZ10_MAX_LEN  18
-
-/** @brief LZ10 maximum displacement */
-#define LZ10_MAX_DISP 4096
-
-/** @brief LZ11 maximum match length */
-#define LZ11_MAX_LEN  65808
-
-/** @brief LZ11 maximum displacement */
-#define LZ11_MAX_DISP 4096
-
-/** @brief LZ compression mode */
-enum LZSS_t
-{
-  LZ10 = 0x10, ///< LZ10 compression
-  LZ11 = 0x11, ///< LZ11 compression
-};
-
-/** @brief Buffer object */
-typedef std::vector<uint8_t> Buffer;
-
-/** @brief Find last instance of a byte in a buffer
- *  @param[in] first Beginning of buffer
- *  @param[in] last  End of buffer
- *  @param[in] val   Byte to find
- *
- *  @returns iterator to found byte
- *  @retval last if no match found
- */
-Buffer::const_iterator
-rfind(Buffer::const_iterator first, Buffer::const_iterator last,
-      const uint8_t &val)
-{
-  assert(last >= first);
-
-  auto it = last;
-  while(--it >= first)
-  {
-    if(*it == val)
-      return it;
-  }
-
-  return last;
-}
-
-/** @brief Find best buffer match
- *  @param[in]  source   Source buffer
- *  @param[in]  it       Position in source buffer
- *  @param[in]  len      Maximum length to match
- *  @param[in]  max_disp Maximum displacement
- *  @param[in]  vram     VRAM-safe
- *  @param[out] outlen   Length of match
- *  @returns Iterator to best match
- *  @retval source.cend() for no match
- */
-Buffer::const_iterator
-find_best_match(const Buffer &source, Buffer::const_iterator it, size_t len,
-                size_t max_disp, bool vram, size_t &outlen)
-{
-  auto begin = source.cbegin();
-  auto end   = source.cend();
-
-  assert(it > source.cbegin());
-  assert(it < source.cend());
-
-  // clamp start to maximum displacement from buffer
-  if(it - begin > static_cast<ptrdiff_t>(max_disp))
-    begin = it - max_disp;
-
-  // clamp len to end of buffer
-  if(end - it < static_cast<ptrdiff_t>(len))
-    len = end - it;
-
-  auto   best_start = it;
-  size_t best_len = 0;
-
-  // find nearest matching start byte
-  auto last_p = it;
-  auto p = rfind(begin, last_p, *it);
-  while(p != last_p)
-  {
-    // find length of match
-    size_t test_len = 1;
-    for(size_t i = 1; i < len; ++i)
-    {
-      if(*(p+i) == *(it+i))
-        ++test_len;
-      else
-        break;
-    }
-
-    // vram requires displacement != 1
-    if(vram && (it - p) == 1)
-      test_len = 0;
-
-    if(test_len >= best_len)
-    {
-      // this match is the best so far, so save it
-      best_start = p;
-      best_len   = test_len;
-    }
-
-    // if we maximized the match, stop here
-    if(best_len == len)
-      break;
-
-    // find next nearest matching byte and try again
-    last_p = p;
-    p = rfind(begin, last_p, *it);
-  }
-
-  if(best_len)
-  {
-    // we found a match, so return it
-    outlen = best_len;
-    return best_start;
-  }
-
-  // no match found
-  outlen = 0;
-  return source.cend();
-}
-
-/** @brief Output a GBA-style compression header
- *  @param[out] header Output header
- *  @param[in]  type   Compression type
- *  @param[in]  size   Uncompressed data size
- */
-void
-header(Buffer &buffer, uint8_t type, size_t size)
-{
-  buffer.push_back(type);
-  buffer.push_back(size >>  0);
-  buffer.push_back(size >>  8);
-  buffer.push_back(size >> 16);
-}
-
-/** @brief LZ10/LZ11 compression
- *  @param[in] source Source buffer
- *  @param[in] mode   LZ mode
- *  @param[in] vram   VRAM-safe
- *  @returns Compressed buffer
- */
-Buffer
-lzss_encode(const Buffer &source, LZSS_t mode, bool vram)
-{
-  // get maximum match length
-  const size_t max_len  = mode == LZ10 ? LZ10_MAX_LEN  : LZ11_MAX_LEN;
-
-  // get maximum displacement
-  const size_t max_disp = mode == LZ10 ? LZ10_MAX_DISP : LZ11_MAX_DISP;
-
-  assert(mode == LZ10 || mode == LZ11);
-
-  // create output buffer
-  Buffer result;
-
-  // append compression header
-  header(result, mode, source.size());
-
-  // reserve an encode byte in output buffer
-  size_t code_pos = result.size();
-  result.push_back(0);
-
-  // initialize shift
-  size_t shift = 8;
-
-  // encode every byte
-  auto it = source.cbegin();
-  auto end = source.cend();
-  while(it < end)
-  {
-    if(shift == 0)
-    {
-      // we need to encode more data, so add a new code byte
-      shift = 8;
-      code_pos = result.size();
-      result.push_back(0);
-    }
-
-    // advance code byte bit position
-    if(shift != 0)
-      --shift;
-
-    const size_t len = end - it;
-    auto         tmp = source.cend();
-    size_t       tmplen = 0;
-
-    if(it == source.cbegin())
-    {
-      // beginning of stream must be primed with at least one value
-      tmplen = 1;
-    }
-    else
-    {
-      // find best match
-      tmp = find_best_match(source, it, std::min(len, max_len), max_disp, vram,
-                            tmplen);
-      if(tmp != source.cend())
-      {
-        assert(!vram || tmp - it != 1);
-        assert(tmp >= source.cbegin());
-        assert(tmp < it);
-        assert(it - tmp <= static_cast<ptrdiff_t>(max_disp));
-        assert(tmplen <= max_len);
-        assert(tmplen <= len);
-        assert(std::equal(it, it+tmplen, tmp));
-      }
-    }
-
-    if(tmplen > 2 && tmplen < len)
-    {
-      // this match is long enough to be compressed; let's check if it's
-      // cheaper to encode this byte as a copy and start compression at the
-      // next byte
-      size_t skip_len, next_len;
-
-      // get best match starting at the next byte
-      find_best_match(source, it+1, std::min(len-1, max_len), max_disp, vram,
-                      skip_len);
-
-      // check if the match is too small to compress
-      if(skip_len < 3)
-        skip_len = 1;
-
-      // get best match for data following the current compressed chunk
-      find_best_match(source, it+tmplen, std::min(len-tmplen, max_len),
-                      max_disp, vram, next_len);
-
-      // check if the match is too small to compress
-      if(next_len < 3)
-        next_len = 1;
-
-      // if compressing this chunk and the next chunk is less valuable than
-      // skipping this byte and starting compression at the next byte, mark
-      // this byte as being needed to copy
-      if(tmplen + next_len <= skip_len + 1)
-        tmplen = 1;
-    }
-
-    if(tmplen < 3)
-    {
-      // this is a copy chunk; append this byte to the output buffer
-      result.push_back(*it);
-
-      // only one byte is copied
-      tmplen = 1;
-    }
-    else if(mode == LZ10)
-    {
-      // mark this chunk as compressed
-      assert(code_pos < result.size());
-      result[code_pos] |= (1 << shift);
-
-      // encode the displacement and length
-      size_t disp = it - tmp - 1;
-      assert(tmplen-3 <= 0xF);
-      assert(disp <= 0xFFF);
-      result.push_back(((tmplen-3) << 4) | (disp >> 8));
-      result.push_back(disp);
-    }
-    else if(tmplen <= 0x10)
-    {
-      // mark this chunk as compressed
-      assert(code_pos < result.size());
-      result[code_pos] |= (1 << shift);
-
-      // encode the displacement and length
-      size_t disp = it - tmp - 1;
-      assert(tmplen > 2);
-      assert(tmplen-1 <= 0xF);
-      assert(disp <= 0xFFF);
-      result.push_back(((tmplen-1) << 4) | (disp >> 8));
-      result.push_back(disp);
-    }
-    else if(tmplen <= 0x110)
-    {
-      // mark this chunk as compressed
-      assert(code_pos < result.size());
-      result[code_pos] |= (1 << shift);
-
-      // encode the displacement and length
-      size_t disp = it - tmp - 1;
-      assert(tmplen >= 0x11);
-      assert(tmplen-0x11 <= 0xFF);
-      assert(disp <= 0xFFF);
-      result.push_back((tmplen-0x11) >> 4);
-      result.push_back(((tmplen-0x11) << 4) | (disp >> 8));
-      result.push_back(disp);
-    }
-    else
-    {
-      // mark this chunk as compressed
-      assert(code_pos < result.size());
-      result[code_pos] |= (1 << shift);
-
-      // encode the displacement and length
-      size_t disp = it - tmp - 1;
-      assert(tmplen >= 0x111);
-      assert(tmplen-0x111 <= 0xFFFF);
-      assert(disp <= 0xFFF);
-      result.push_back((1 << 4) | (tmplen-0x111) >> 12);
-      result.push_back(((tmplen-0x111) >> 4));
-      result.push_back(((tmplen-0x111) << 4) | (disp >> 8));
-      result.push_back(disp);
-    }
-
-    // advance input buffer
-    it += tmplen;
-  }
-
-  // pad the output buffer to 4 bytes
-  if(result.size() & 0x3)
-    result.resize((result.size()+3) & ~0x3);
-
-  // return the output data
-  return result;
-}
-
-/** @brief LZ10 compression
- *  @param[in] source Source buffer
- *  @param[in] vram   VRAM-safe
- *  @returns Compressed buffer
- */
-Buffer
-lz10_encode(const Buffer &source, bool vram)
-{
-  return lzss_encode(source, LZ10, vram);
-}
-
-/** @brief LZ11 compression
- *  @param[in] source Source buffer
- *  @param[in] vram   VRAM-safe
- *  @returns Compressed buffer
- */
-Buffer
-lz11_encode(const Buffer &source, bool vram)
-{
-  return lzss_encode(source, LZ11, vram);
-}
-
-/** @brief LZ10 Decompression
- *  @param[in] source Source buffer
- *  @param[in] vram   VRAM-safe
- *  @returns Decompressed buffer
- */
-Buffer
-lz10_decode(const Buffer &source, bool vram)
-{
-  if(source.size() < 4 || source[0] != LZ10)
-    throw std::runtime_error("Error: Invalid LZ10 header");
-
-  size_t size = source[1] | (source[2] << 8) | (source[3] << 16);
-
-  bool printed_error = false;
-  bool printed_vram_error = false;
-
-  auto    src   = source.cbegin() + 4;
-  uint8_t flags = 0;
-  uint8_t mask  = 0;
-
-  Buffer result;
-
-  while(size > 0)
-  {
-    if(mask == 0)
-    {
-      // read in the flags data
-      // from bit 7 to bit 0:
-      //     0: raw byte
-      //     1: compressed block
-      flags = *src++;
-      mask  = 0x80;
-    }
-
-    if(flags & mask) // compressed block
-    {
-      size_t len  = (((*src) & 0xF0) >> 4) + 3;
-      size_t disp = ((*src++) & 0x0F) << 8;
-      disp |= *src++;
-      ++disp;
-
-      if(len > size)
-      {
-        if(!printed_error)
-        {
-          std::fprintf(stderr, "Warning: Badly encoded LZ10 stream; compressed "
-                       "block exceeds output length specified by header. "
-                       "Truncating output.\n");
-          printed_error = true;
-        }
-
-        // truncate output
-        len = size;
-      }
-
-      if(result.size() < disp)
-        throw std::runtime_error("Error: Badly encoded LZ10 stream; encoded "
-                                 "displacement causes read prior to start of "
-                                 "output buffer.");
-
-      if(vram && !printed_vram_error)
-      {
-        if(disp == 1)
-        {
-          std::fprintf(stderr, "Warning: LZ10 stream is not vram safe.\n");
-          printed_vram_error = true;
-        }
-      }
-      
-      size -= len;
-
-      // for len, copy data from the displacement
-      // to the current buffer position
-      while(len-- > 0)
-        result.push_back(*(std::end(result)-disp));
-    }
-    else // uncompressed block
-    {
-      // copy a raw byte from the input to the output
-      result.push_back(*src++);
-      --size;
-    }
-
-    mask >>= 1;
-  }
-
-  return result;
-}
-
-/** @brief LZ11 Decompression
- *  @param[in] source Source buffer
- *  @param[in] vram   VRAM-safe
- *  @returns Decompressed buffer
- */
-Buffer
-lz11_decode(const Buffer &source, bool vram)
-{
-  if(source.size() < 4 || source[0] != LZ11)
-    throw std::runtime_error("Error: Invalid LZ11 header");
-
-  size_t size = source[1] | (source[2] << 8) | (source[3] << 16);
-
-  bool printed_error = false;
-  bool printed_vram_error = false;
-
-  auto    src   = source.cbegin() + 4;
-  uint8_t flags = 0;
-  uint8_t mask  = 0;
-
-  Buffer result;
-
-  while(size > 0)
-  {
-    if(mask == 0)
-    {
-      // read in the flags data
-      // from bit 7 to bit 0:
-      //     0: raw byte
-      //     1: compressed block
-      flags = *src++;
-      mask  = 0x80;
-    }
-
-    if(flags & mask) // compressed block
-    {
-      size_t len;
-      switch((*src) >> 4)
-      {
-        case 0: // extended block
-          len   = (*src++) << 4;
-          len  |= ((*src) >> 4);
-          len  += 0x11;
-          break;
-
-        case 1: // extra extended block
-          len   = ((*src++) & 0x0F) << 12;
-          len  |= (*src++) << 4;
-          len  |= ((*src) >> 4);
-          len  += 0x111;
-          break;
-
-        default: // normal block
-          len   = ((*src) >> 4) + 1;
-          break;
-      }
-
-      size_t disp = ((*src++) & 0x0F) << 8;
-      disp |= *src++;
-      ++disp;
-
-      if(len > size)
-      {
-        if(!printed_error)
-        {
-          std::fprintf(stderr, "Warning: Badly encoded LZ11 stream; compressed "
-                       "block exceeds output length specified by header. "
-                       "Truncating output.\n");
-          printed_error = true;
-        }
-
-        // truncate output
-        len = size;
-      }
-
-      if(result.size() < disp)
-        throw std::runtime_error("Error: Badly encoded LZ11 stream; encoded "
-                                 "displacement causes read prior to start of "
-                                 "output buffer.");
-
-      if(vram && !printed_vram_error)
-      {
-        if(disp == 1)
-        {
-          std::fprintf(stderr, "Warning: LZ10 stream is not vram safe.\n");
-          printed_vram_error = true;
-        }
-      }
- 
-      size -= len;
-
-      // for len, copy data from the displacement
-      // to the current buffer position
-      while(len-- > 0)
-        result.push_back(*(std::end(result)-disp));
-    }
-    else // uncompressed block
-    {
-      // copy a raw byte from the input to the output
-      result.push_back(*src++);
-      --size;
-    }
-
-    mask >>= 1;
-  }
-
-  return result;
-}
-
 /** @brief Read input file
  *  @param[in] fp    Input file stream
  *  @param[in] limit Maximum file size to read
@@ -642,11 +94,24 @@ bool write_file(FILE *fp, const Buffer &buffer)
 void usage(FILE *fp, const char *program)
 {
   std::fprintf(fp,
-    "Usage: %s [-h|--help] [--lz11] [--vram] <d|e> <infile> <outfile>\n"
+    "Usage: %s [-h|--help] [--lz11] [--vram] [--fast] [--prescan[=raw]]\n"
+    "       [--prev-in=<file> --prev-out=<file>]\n"
+    "       [--elf [--section=<name>] [--align=<n>] [--symbol=<name>]] <d|e> <infile> <outfile>\n"
     "\tOptions:\n"
     "\t\t-h, --help\tShow this help\n"
     "\t\t--lz11    \tCompress using LZ11 instead of LZ10\n"
     "\t\t--vram    \tGenerate VRAM-safe output (required by GBA BIOS)\n"
+    "\t\t--fast    \tCompress using the fast-decode format (see lzfast.h)\n"
+    "\t\t--prescan[=raw]\tSkip the match search for incompressible input;\n"
+    "\t\t          \twrite an all-literal stream, or with =raw write\n"
+    "\t\t          \tnothing and exit with status 2\n"
+    "\t\t--prev-in=<file>\tPrevious version of <infile>\n"
+    "\t\t--prev-out=<file>\tPrevious output for --prev-in; only the edited\n"
+    "\t\t          \tregion is compressed again\n"
+    "\t\t--elf     \tWrite <outfile> as an ARM ELF object\n"
+    "\t\t--section=<name>\tELF section (default " ELFOBJ_DEFAULT_SECTION ")\n"
+    "\t\t--align=<n>\tELF section alignment (default 4)\n"
+    "\t\t--symbol=<name>\tELF symbol name (default from <outfile>)\n"
     "\n"
     "\tArguments\n"
     "\t\te         \tCompress <infile> into <outfile>\n"
@@ -662,6 +127,14 @@ const struct option long_options[] =
   { "help",    no_argument, nullptr, 'h', },
   { "lz11",    no_argument, nullptr, '1', },
   { "vram",    no_argument, nullptr, 'v', },
+  { "fast",    no_argument, nullptr, 'f', },
+  { "prescan", optional_argument, nullptr, 'p', },
+  { "prev-in", required_argument, nullptr, 'i', },
+  { "prev-out", required_argument, nullptr, 'o', },
+  { "elf",     no_argument,       nullptr, 'e', },
+  { "section", required_argument, nullptr, 's', },
+  { "align",   required_argument, nullptr, 'a', },
+  { "symbol",  required_argument, nullptr, 'n', },
   { nullptr,   no_argument, nullptr,   0, },
 };
 
@@ -674,6 +147,15 @@ int main(int argc, char *argv[])
 
   bool lz11 = false;
   bool vram = false;
+  bool fast = false;
+  bool prescan = false;
+  bool prescan_raw = false;
+  const char *prev_infile = nullptr;
+  const char *prev_outfile = nullptr;
+  bool elf = false;
+  const char *section = ELFOBJ_DEFAULT_SECTION;
+  unsigned long align = ELFOBJ_DEFAULT_ALIGN;
+  const char *symbol = nullptr;
 
   // parse options
   int c;
@@ -693,6 +175,51 @@ int main(int argc, char *argv[])
         vram = true;
         break;
 
+      case 'f':
+        fast = true;
+        break;
+
+      case 'p':
+        prescan = true;
+        if(optarg && std::strcmp(optarg, "raw") == 0)
+          prescan_raw = true;
+        else if(optarg)
+        {
+          std::fprintf(stderr, "Error: Invalid prescan action '%s'\n", optarg);
+          usage(stderr, program);
+          return EXIT_FAILURE;
+        }
+        break;
+
+      case 'i':
+        prev_infile = optarg;
+        break;
+
+      case 'o':
+        prev_outfile = optarg;
+        break;
+
+      case 'e':
+        elf = true;
+        break;
+
+      case 's':
+        section = optarg;
+        break;
+
+      case 'a':
+        align = std::strtoul(optarg, nullptr, 0);
+        if(!elfobj_valid_align(align))
+        {
+          std::fprintf(stderr, "Error: Invalid alignment '%s'\n", optarg);
+          return EXIT_FAILURE;
+        }
+        break;
+
+      case 'n':
+        symbol = optarg;
+        break;
+
       default:
         std::fprintf(stderr, "Error: Invalid option '%c'\n", optopt);
         usage(stderr, program);
@@ -709,11 +236,39 @@ int main(int argc, char *argv[])
     return EXIT_FAILURE;
   }
 
+  // the fast format has its own decoder and is never read by the BIOS
+  if(fast && (lz11 || vram))
+  {
+    std::fprintf(stderr, "Error: --fast cannot be combined with --lz11 or --vram\n");
+    return EXIT_FAILURE;
+  }
+
+  // incremental encoding needs both halves of the previous run
+  if(!prev_infile != !prev_outfile)
+  {
+    std::fprintf(stderr, "Error: --prev-in and --prev-out must be used together\n");
+    return EXIT_FAILURE;
+  }
+
   // get program non-options
   bool encode = std::tolower(*argv[optind++]) == 'e';
   const char *infile = argv[optind++];
   const char *outfile = argv[optind++];
 
+  // name the ELF symbols after the output file
+  char symbuf[256];
+  if(elf && !symbol)
+  {
+    if((std::strlen(outfile) == 1 && *outfile == '-')
+    || elfobj_symbol_from_path(symbuf, sizeof(symbuf), outfile) != 0)
+    {
+      std::fprintf(stderr, "Error: --symbol is required for '%s'\n", outfile);
+      return EXIT_FAILURE;
+    }
+
+    symbol = symbuf;
+  }
+
   // open input file
   FILE *fp;
   if(std::strlen(infile) == 1 && *infile == '-')
@@ -749,10 +304,61 @@ int main(int argc, char *argv[])
   // close input file
   std::fclose(fp);
 
+  // read previous input and output
+  Buffer prev_in, prev_out;
+  if(encode && prev_infile)
+  {
+    for(auto prev : { std::make_pair(prev_infile, &prev_in),
+                      std::make_pair(prev_outfile, &prev_out) })
+    {
+      fp = std::fopen(prev.first, "rb");
+      if(!fp)
+      {
+        std::fprintf(stderr, "Error: Failed to open '%s' for reading\n",
+                     prev.first);
+        return EXIT_FAILURE;
+      }
+
+      try
+      {
+        *prev.second = read_file(fp, LZSS_MAX_DECODE_LEN);
+      }
+      catch(const std::runtime_error &e)
+      {
+        std::fprintf(stderr, "%s: %s\n", prev.first, e.what());
+        std::fclose(fp);
+        return EXIT_FAILURE;
+      }
+
+      std::fclose(fp);
+    }
+  }
+
+  // check whether the match search is worth running
+  bool skip_search = false;
+  if(encode && prescan && incompressible(buffer))
+  {
+    if(prescan_raw)
+    {
+      std::fprintf(stderr, "%s: incompressible; store it raw\n", infile);
+      return 2;
+    }
+
+    std::fprintf(stderr, "%s: incompressible; writing literals only\n", infile);
+    skip_search = true;
+  }
+
   // process input file
   try
   {
-    if(encode)
+    if(skip_search)
+      buffer = literal_encode(buffer, fast ? LZFAST : lz11 ? LZ11 : LZ10);
+    else if(encode && prev_infile)
+      buffer = incremental_encode(buffer, prev_in, prev_out,
+                                  fast ? LZFAST : lz11 ? LZ11 : LZ10, vram);
+    else if(fast)
+      buffer = encode ? fast_encode(buffer) : fast_decode(buffer);
+    else if(encode)
       buffer = (lz11 ? lz11_encode : lz10_encode)(buffer, vram);
     else
       buffer = (lz11 ? lz11_decode : lz10_decode)(buffer, vram);
@@ -780,7 +386,9 @@ int main(int argc, char *argv[])
   }
 
   // write output file
-  if(!write_file(fp, buffer))
+  if(elf ? elfobj_write(fp, buffer.data(), buffer.size(), section, align,
+                        symbol) != 0
+         : !write_file(fp, buffer))
   {
     std::fprintf(stderr, "Error: Failed to write '%s'\n", outfile);
     std::fclose(fp);
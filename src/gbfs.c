@@ -49,206 +49,2511 @@ reformatted for consistency
 #include <string.h>
 #include <errno.h>
 #include <libgen.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <limits.h>
+#include <ctype.h>
+#include <sys/stat.h>
+
+#include "gbfs_host.h"
+#include "elfobj.h"
+#include "fileio.h"
+#include "gbfshash.h"
+#include "hash.h"
+#include "lzss.h"
+#include "mapfile.h"
+#include "parallel.h"
+#include "romspace.h"
+#include "tar.h"
 
-typedef unsigned short u16;
-typedef unsigned long u32;  /* this needs to be changed on 64-bit systems */
+static const char GBFS_magic[] = "PinEightGBFS\r\n\032\n";
+
+static const char help_text[] =
+"Creates a GBFS archive.\n"
+"usage: gbfs [OPTIONS] ARCHIVE [FILE...]\n"
+"  -u, --update      add or replace FILEs in the existing ARCHIVE in place\n"
+"  -D, --delete=NAME remove object NAME from the existing ARCHIVE\n"
+"  --compact         squeeze holes out of the existing ARCHIVE after any\n"
+"                    updates\n"
+"  -f, --files-from=LIST  add the files listed in LIST (- for stdin),\n"
+"                    one \"PATH\" or \"PATH<TAB>NAME\" per line\n"
+"  --from-tar=TAR    add the regular files in tar archive TAR (- for stdin)\n"
+"  -j, --jobs=N      copy up to N files at once (default: one per CPU)\n"
+"  -d, --dedup       store byte-identical files only once\n"
+"  -z, --compress=T  compress each file with lz10, lz11 or fast\n"
+"  --vram            make lz10/lz11 data safe to decompress to VRAM\n"
+"  --auto            compress only files that get smaller (default lz10)\n"
+"  -a, --data-align=N  align each file to N bytes, 4 to 256 (default 16)\n"
+"  -o, --order=FILE  place files in the order listed in FILE, one\n"
+"                    \"NAME [ALIGN]\" per line, ahead of the rest\n"
+"  -i, --index       add a hashed index for constant-time name lookup\n"
+"  --dir-at-end      put the directory after the data instead of before\n"
+"  --rom=ROMFILE     write the archive straight into the GBFS_SPACE named\n"
+"                    ARCHIVE in ROMFILE instead of a file of its own\n"
+"  --elf             write ARCHIVE as an ARM ELF object instead\n"
+"  --section=NAME    ELF section (default " ELFOBJ_DEFAULT_SECTION ")\n"
+"  --align=N         ELF section alignment (default 4)\n"
+"  --symbol=NAME     ELF symbol name (default from ARCHIVE)\n";
+
+static const struct option long_options[] = {
+	{ "files-from", required_argument, NULL, 'f' },
+	{ "from-tar", required_argument, NULL, 'T' },
+	{ "update",  no_argument,       NULL, 'u' },
+	{ "delete",  required_argument, NULL, 'D' },
+	{ "compact", no_argument,       NULL, 'c' },
+	{ "jobs",    required_argument, NULL, 'j' },
+	{ "dedup",   no_argument,       NULL, 'd' },
+	{ "compress", required_argument, NULL, 'z' },
+	{ "vram",    no_argument,       NULL, 'v' },
+	{ "auto",    no_argument,       NULL, 'A' },
+	{ "data-align", required_argument, NULL, 'a' },
+	{ "order",   required_argument, NULL, 'o' },
+	{ "index",   no_argument,       NULL, 'i' },
+	{ "dir-at-end", no_argument,    NULL, 'E' },
+	{ "rom",     required_argument, NULL, 'R' },
+	{ "elf",     no_argument,       NULL, 'e' },
+	{ "section", required_argument, NULL, 's' },
+	{ "align",   required_argument, NULL, 'l' },
+	{ "symbol",  required_argument, NULL, 'n' },
+	{ "help",    no_argument,       NULL, 'h' },
+	{ NULL,      0,                 NULL,  0  },
+};
+
+/* an input file and where its data goes in the archive */
+typedef struct GBFS_INPUT {
+	const char *path;
+	char *path_buf;        /* path, if read from a file list or tar */
+	unsigned char *data;   /* contents, if read from a tar stream */
+	unsigned long len;
+	unsigned long data_offset;
+	unsigned int dup_of;   /* index of the input holding this data */
+	uint64_t hash;
+	unsigned char *packed; /* compressed data, or NULL if stored */
+	unsigned long packed_len;
+	unsigned int type;     /* CMPR table byte; 0 if stored */
+	unsigned long align;   /* alignment of data_offset */
+	unsigned int placed;   /* already in the layout sequence */
+} GBFS_INPUT;
+
+/* an extension block to append after the data */
+typedef struct GBFS_EXT_OUT {
+	const char *tag;
+	unsigned char *data;
+	unsigned long len;
+	unsigned long offset;
+} GBFS_EXT_OUT;
+
+#define MAX_EXTS 3
+
+/* past 65535, the directory is given by a "DIR2" block */
+#define MAX_ENTRIES 0x100000
+
+/* the "MPHI" index counts names in 16 bits */
+#define MAX_INDEXED 65535
+
+/* open-addressed table of entry indices by name, for spotting
+   duplicate names; a power of two well over MAX_ENTRIES */
+#define NAME_SLOTS 0x200000
+
+/* largest data alignment, 256 bytes */
+#define MAX_ALIGN_LOG2 8
+
+/* a run of padding in the archive that later objects may fill */
+typedef struct GBFS_GAP {
+	unsigned long start, end;
+} GBFS_GAP;
+
+typedef struct PACK_CTX {
+	GBFS_INPUT *inputs;
+	unsigned int type;
+	int vram;
+	int keep_smaller;
+} PACK_CTX;
+
+typedef struct INGEST_CTX {
+	GBFS_INPUT *inputs;
+	int out_fd;
+	off_t base;            /* where the archive starts in out_fd */
+} INGEST_CTX;
+
+GBFS_FILE header;
+GBFS_ENTRY *entries;
+
+
+/*---------------------------------------------------------------------------------
+	puti16()
+	store a 16-bit integer in intel format
+---------------------------------------------------------------------------------*/
+void puti16(unsigned char *dst, unsigned int in) {
+//---------------------------------------------------------------------------------
+	dst[0] = in;
+	dst[1] = in >> 8;
+}
+
+
+/*---------------------------------------------------------------------------------
+	puti32()
+	store a 32-bit integer in intel format
+---------------------------------------------------------------------------------*/
+void puti32(unsigned char *dst, unsigned long in) {
+//---------------------------------------------------------------------------------
+	dst[0] = in;
+	dst[1] = in >> 8;
+	dst[2] = in >> 16;
+	dst[3] = in >> 24;
+}
+
+
+/*---------------------------------------------------------------------------------
+	namecmp()
+	compares the first 24 bytes of a pair of strings.
+	useful for sorting names.
+---------------------------------------------------------------------------------*/
+int namecmp(const void *a, const void *b) {
+//---------------------------------------------------------------------------------
+	return memcmp(a, b, 24);
+}
+
+
+/*---------------------------------------------------------------------------------
+	ingest_file()
+	copy one input file to its place in the archive.
+	runs on the thread pool, so it only touches its own entry.
+---------------------------------------------------------------------------------*/
+static int ingest_file(void *ctx, size_t i) {
+//---------------------------------------------------------------------------------
+	INGEST_CTX *ic = ctx;
+	GBFS_INPUT *in = &ic->inputs[i];
+	struct stat st;
+	int fd;
+
+	/* duplicates share another input's data */
+	if(in->dup_of != i)
+		return 0;
+
+	if(in->packed) {
+		if(pwrite_full(ic->out_fd, in->packed, in->packed_len, ic->base + in->data_offset)) {
+			fprintf(stderr, "could not write %s: %s\n", in->path, strerror(errno));
+			return -1;
+		}
+		return 0;
+	}
+
+	if(in->data) {
+		if(pwrite_full(ic->out_fd, in->data, in->len, ic->base + in->data_offset)) {
+			fprintf(stderr, "could not write %s: %s\n", in->path, strerror(errno));
+			return -1;
+		}
+		return 0;
+	}
+
+	fd = open(in->path, O_RDONLY | O_BINARY);
+
+	if(fd < 0) {
+		fprintf(stderr, "could not open %s: %s\n", in->path, strerror(errno));
+		return -1;
+	}
+
+	if(copy_range(ic->out_fd, ic->base + in->data_offset, fd, 0, in->len)) {
+		fprintf(stderr, "could not copy %s: %s\n", in->path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	/* the layout was computed from the sizes measured up front */
+	if(fstat(fd, &st) || (unsigned long)st.st_size != in->len) {
+		fprintf(stderr, "%s changed size while being archived\n", in->path);
+		close(fd);
+		return -1;
+	}
+
+	close(fd);
+	return 0;
+}
+
+
+/*---------------------------------------------------------------------------------
+	map_input()
+	Makes an input's contents readable: mapped from its file, or in
+	place if it came from a tar stream.  Returns 0 for success or
+	nonzero for failure.
+---------------------------------------------------------------------------------*/
+static int map_input(MAPPED_FILE *mf, const GBFS_INPUT *in) {
+//---------------------------------------------------------------------------------
+	if(in->data) {
+		mf->data = in->data;
+		mf->len = in->len;
+		mf->mapped = 0;
+		return 0;
+	}
+
+	if(map_file(mf, in->path)) {
+		fprintf(stderr, "could not read %s: %s\n", in->path, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+
+/*---------------------------------------------------------------------------------
+	unmap_input()
+	release what map_input() set up
+---------------------------------------------------------------------------------*/
+static void unmap_input(MAPPED_FILE *mf, const GBFS_INPUT *in) {
+//---------------------------------------------------------------------------------
+	if(!in->data)
+		unmap_file(mf);
+}
+
+
+/*---------------------------------------------------------------------------------
+	pack_file()
+	compress one input into memory.
+	runs on the thread pool, so it only touches its own entry.
+---------------------------------------------------------------------------------*/
+static int pack_file(void *ctx, size_t i) {
+//---------------------------------------------------------------------------------
+	PACK_CTX *pc = ctx;
+	GBFS_INPUT *in = &pc->inputs[i];
+	MAPPED_FILE mf;
+	size_t packed_len;
+
+	/* too big for a 24-bit header: store as-is */
+	if(in->dup_of != i || !in->len || in->len > LZSS_MAX_ENCODE_LEN)
+		return 0;
+
+	if(map_input(&mf, in))
+		return -1;
+
+	if(mf.len != in->len) {
+		fprintf(stderr, "%s changed size while being archived\n", in->path);
+		unmap_input(&mf, in);
+		return -1;
+	}
+
+	if(pc->keep_smaller && lzss_incompressible(mf.data, mf.len)) {
+		unmap_input(&mf, in);
+		return 0;
+	}
+
+	if(lzss_compress(mf.data, mf.len, pc->type, pc->vram,
+	                 &in->packed, &packed_len)) {
+		fprintf(stderr, "could not compress %s\n", in->path);
+		unmap_input(&mf, in);
+		return -1;
+	}
+	unmap_input(&mf, in);
+
+	if(pc->keep_smaller && packed_len >= in->len) {
+		free(in->packed);
+		in->packed = NULL;
+		return 0;
+	}
+
+	in->packed_len = packed_len;
+	in->type = pc->type;
+	return 0;
+}
+
+
+/*---------------------------------------------------------------------------------
+	free_inputs()
+	release the input list and any compressed data it holds
+---------------------------------------------------------------------------------*/
+static void free_inputs(GBFS_INPUT *inputs, unsigned int n) {
+//---------------------------------------------------------------------------------
+	unsigned int i;
+
+	for(i = 0; i < n; i++) {
+		free(inputs[i].packed);
+		free(inputs[i].path_buf);
+		free(inputs[i].data);
+	}
+	free(inputs);
+}
+
+
+/*---------------------------------------------------------------------------------
+	hash_file()
+	hash one input's contents for deduplication.
+	runs on the thread pool.
+---------------------------------------------------------------------------------*/
+static int hash_file(void *ctx, size_t i) {
+//---------------------------------------------------------------------------------
+	GBFS_INPUT *in = &((GBFS_INPUT *)ctx)[i];
+	MAPPED_FILE mf;
+
+	/* only inputs sharing their size with another are candidates */
+	if(in->dup_of != i)
+		return 0;
+
+	if(map_input(&mf, in))
+		return -1;
+
+	in->hash = hash_xxh64(mf.data, mf.len, 0);
+	unmap_input(&mf, in);
+	return 0;
+}
+
+
+/*---------------------------------------------------------------------------------
+	same_contents()
+	compare two inputs byte for byte.
+	returns 1 if identical, 0 if not, -1 on error.
+---------------------------------------------------------------------------------*/
+static int same_contents(const GBFS_INPUT *a, const GBFS_INPUT *b) {
+//---------------------------------------------------------------------------------
+	MAPPED_FILE ma, mb;
+	int same;
+
+	if(map_input(&ma, a))
+		return -1;
+
+	if(map_input(&mb, b)) {
+		unmap_input(&ma, a);
+		return -1;
+	}
+
+	same = ma.len == mb.len && !memcmp(ma.data, mb.data, ma.len);
+	unmap_input(&ma, a);
+	unmap_input(&mb, b);
+	return same;
+}
+
+
+static GBFS_INPUT *cmp_inputs;
+static GBFS_ENTRY *cmp_entries;
+
+/*---------------------------------------------------------------------------------
+	entcmp()
+	orders entry indices by name, then command-line position
+---------------------------------------------------------------------------------*/
+static int entcmp(const void *a, const void *b) {
+//---------------------------------------------------------------------------------
+	unsigned int ia = *(const unsigned int *)a, ib = *(const unsigned int *)b;
+	int c = namecmp(cmp_entries[ia].name, cmp_entries[ib].name);
+
+	return c ? c : ia < ib ? -1 : ia > ib;
+}
+
+
+/*---------------------------------------------------------------------------------
+	dupcmp()
+	orders input indices by size, then hash, then command-line position
+---------------------------------------------------------------------------------*/
+static int dupcmp(const void *a, const void *b) {
+//---------------------------------------------------------------------------------
+	unsigned int ia = *(const unsigned int *)a, ib = *(const unsigned int *)b;
+	const GBFS_INPUT *pa = &cmp_inputs[ia], *pb = &cmp_inputs[ib];
+
+	if(pa->len != pb->len)
+		return pa->len < pb->len ? -1 : 1;
+	if(pa->hash != pb->hash)
+		return pa->hash < pb->hash ? -1 : 1;
+	return ia < ib ? -1 : ia > ib;
+}
+
+
+/*---------------------------------------------------------------------------------
+	find_duplicates()
+	Points dup_of of every input whose contents match an earlier
+	input's at that input.  Files are hashed in parallel, and hash
+	matches are confirmed byte for byte.  Returns the number of
+	archive bytes saved, or -1 on error.
+---------------------------------------------------------------------------------*/
+static long find_duplicates(GBFS_INPUT *inputs, unsigned int n, unsigned int jobs,
+                            unsigned int *n_dups) {
+//---------------------------------------------------------------------------------
+	unsigned int *order, i, j;
+	long saved = 0;
+
+	*n_dups = 0;
+	order = malloc((n ? n : 1) * sizeof(*order));
+	if(!order) {
+		perror("could not allocate memory for deduplication");
+		return -1;
+	}
+
+	/* group by size; a file with a unique size can't be a duplicate */
+	for(i = 0; i < n; i++) {
+		order[i] = i;
+		inputs[i].hash = 0;
+	}
+	cmp_inputs = inputs;
+	qsort(order, n, sizeof(*order), dupcmp);
+
+	for(i = 0; i < n; i++) {
+		unsigned int k = order[i];
+		int shared = (i > 0 && inputs[order[i - 1]].len == inputs[k].len)
+		          || (i + 1 < n && inputs[order[i + 1]].len == inputs[k].len);
+
+		/* inputs[k].dup_of == k marks a candidate for hash_file() */
+		inputs[k].dup_of = shared && inputs[k].len ? k : n;
+	}
+
+	if(parallel_for(n, jobs, hash_file, inputs)) {
+		free(order);
+		return -1;
+	}
+
+	for(i = 0; i < n; i++)
+		inputs[i].dup_of = i;
+
+	/* within each run of equal size and hash, match against earlier
+	   distinct contents */
+	qsort(order, n, sizeof(*order), dupcmp);
+
+	for(i = 0; i < n; i = j) {
+		for(j = i + 1; j < n
+		    && inputs[order[j]].len == inputs[order[i]].len
+		    && inputs[order[j]].hash == inputs[order[i]].hash; j++) {
+			unsigned int k = order[j], r;
+
+			if(!inputs[k].len)
+				continue;
+
+			for(r = i; r < j; r++) {
+				unsigned int rep = order[r];
+				int same;
+
+				if(inputs[rep].dup_of != rep)
+					continue;
+
+				same = same_contents(&inputs[rep], &inputs[k]);
+				if(same < 0) {
+					free(order);
+					return -1;
+				}
+				if(same) {
+					inputs[k].dup_of = rep;
+					saved += (inputs[k].len + 0x000f) & ~0x000fUL;
+					(*n_dups)++;
+					break;
+				}
+			}
+		}
+	}
+
+	free(order);
+	return saved;
+}
+
+
+/*---------------------------------------------------------------------------------
+	valid_data_align()
+	data alignment must be a power of two the GBA's DMA can use
+---------------------------------------------------------------------------------*/
+static int valid_data_align(unsigned long align) {
+//---------------------------------------------------------------------------------
+	return align >= 4 && align <= (1UL << MAX_ALIGN_LOG2) && !(align & (align - 1));
+}
+
+
+/*---------------------------------------------------------------------------------
+	find_name()
+	binary search the name-sorted index for the first entry named name.
+	returns its position in sorted, or n if there is none.
+---------------------------------------------------------------------------------*/
+static unsigned int find_name(const GBFS_ENTRY *entries, const unsigned int *sorted,
+                              unsigned int n, const char *name) {
+//---------------------------------------------------------------------------------
+	char key[24];
+	unsigned int lo = 0, hi = n;
+
+	gbfs_put_name(key, name);
+
+	while(lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+
+		if(namecmp(entries[sorted[mid]].name, key) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo < n && !namecmp(entries[sorted[lo]].name, key) ? lo : n;
+}
+
+
+/*---------------------------------------------------------------------------------
+	read_order()
+	Reads an access-order hint file.  Each line names an object and
+	optionally its alignment; blank lines and lines starting with #
+	are ignored.  Appends the named objects to seq in file order,
+	raising their alignment as asked.  Returns the number of objects
+	appended, or -1 on error.
+---------------------------------------------------------------------------------*/
+static long read_order(const char *path, GBFS_INPUT *inputs, const GBFS_ENTRY *entries,
+                       const unsigned int *sorted, unsigned int n, unsigned int *seq) {
+//---------------------------------------------------------------------------------
+	FILE *fp = fopen(path, "r");
+	char line[1024];
+	unsigned long line_no = 0;
+	long n_seq = 0;
+
+	if(!fp) {
+		fputs("could not open ", stderr);
+		perror(path);
+		return -1;
+	}
+
+	while(fgets(line, sizeof(line), fp)) {
+		char *name = line, *end = line + strlen(line), *last;
+		unsigned long align = 0;
+		unsigned int k, first;
+
+		line_no++;
+
+		while(end > line && isspace((unsigned char)end[-1]))
+			*--end = 0;
+		while(isspace((unsigned char)*name))
+			name++;
+		if(!*name || *name == '#')
+			continue;
+
+		/* a trailing number is the alignment */
+		for(last = end; last > name && !isspace((unsigned char)last[-1]); last--)
+			;
+		if(last > name && isdigit((unsigned char)*last)) {
+			char *num_end;
+
+			align = strtoul(last, &num_end, 0);
+			if(*num_end || !valid_data_align(align)) {
+				fprintf(stderr, "%s:%lu: invalid alignment %s\n", path, line_no, last);
+				fclose(fp);
+				return -1;
+			}
+			for(end = last; end > name && isspace((unsigned char)end[-1]); )
+				*--end = 0;
+		}
+
+		k = find_name(entries, sorted, n, name);
+		if(k == n) {
+			fprintf(stderr, "%s:%lu: warning: no object named %s\n", path, line_no, name);
+			continue;
+		}
+
+		/* every object of that name; duplicates stand in for their data */
+		for(first = k; k < n && !namecmp(entries[sorted[k]].name, entries[sorted[first]].name); k++) {
+			GBFS_INPUT *rep = &inputs[inputs[sorted[k]].dup_of];
+
+			if(align > rep->align)
+				rep->align = align;
+			if(!rep->placed) {
+				rep->placed = 1;
+				seq[n_seq++] = inputs[sorted[k]].dup_of;
+			}
+		}
+	}
+
+	fclose(fp);
+	return n_seq;
+}
+
+
+/*---------------------------------------------------------------------------------
+	place_object()
+	Picks the offset of one object of len bytes.  With fill set, the
+	first gap left by alignment padding that can hold it is used;
+	otherwise it goes after everything placed so far.  max_fit[k]
+	bounds the largest object aligned to 1 << k that any gap can
+	hold, so most objects skip the search.
+---------------------------------------------------------------------------------*/
+static unsigned long place_object(GBFS_GAP *gaps, unsigned int *n_gaps,
+                                  unsigned long *max_fit, unsigned long *end,
+                                  unsigned long len, unsigned long align, int fill) {
+//---------------------------------------------------------------------------------
+	unsigned long pos;
+	unsigned int g, k;
+
+	for(k = 0; (1UL << k) < align; k++)
+		;
+
+	if(fill && len && len <= max_fit[k]) {
+		for(g = 0; g < *n_gaps; g++) {
+			GBFS_GAP gap = gaps[g];
+
+			pos = (gap.start + align - 1) & ~(align - 1);
+			if(pos + len > gap.end)
+				continue;
+
+			/* split what is left around the object */
+			if(pos > gap.start) {
+				gaps[g].end = pos;
+				if(pos + len < gap.end) {
+					gaps[*n_gaps].start = pos + len;
+					gaps[(*n_gaps)++].end = gap.end;
+				}
+			} else if(pos + len < gap.end) {
+				gaps[g].start = pos + len;
+			} else {
+				gaps[g] = gaps[--*n_gaps];
+			}
+			return pos;
+		}
+	}
+
+	pos = (*end + align - 1) & ~(align - 1);
+	if(!len)
+		return pos;
+	if(pos > *end) {
+		gaps[*n_gaps].start = *end;
+		gaps[(*n_gaps)++].end = pos;
+		for(k = 0; k < MAX_ALIGN_LOG2 + 1; k++) {
+			unsigned long a = 1UL << k, fit = (*end + a - 1) & ~(a - 1);
+
+			if(fit < pos && pos - fit > max_fit[k])
+				max_fit[k] = pos - fit;
+		}
+	}
+	*end = pos + len;
+	return pos;
+}
+
+
+/*---------------------------------------------------------------------------------
+	layout_data()
+	Assigns each distinct blob its offset in the archive, starting at
+	start.  Objects named in the order file come first, back to back
+	in the order given, so that objects loaded together are read
+	sequentially from ROM.  The rest follow in command-line order,
+	and small ones are tucked into the padding left by larger
+	alignments.  Returns the end of the data, or 0 on error.
+---------------------------------------------------------------------------------*/
+static unsigned long layout_data(GBFS_INPUT *inputs, GBFS_ENTRY *entries,
+                                 const unsigned int *sorted, unsigned int n,
+                                 unsigned long start, const char *order_path) {
+//---------------------------------------------------------------------------------
+	unsigned int *seq = malloc((n ? n : 1) * sizeof(*seq));
+	GBFS_GAP *gaps = malloc((n * 2 + 1) * sizeof(*gaps));
+	unsigned int i, n_gaps = 0;
+	unsigned long n_hinted = 0, n_seq, end = start;
+	unsigned long max_fit[MAX_ALIGN_LOG2 + 1] = {0};
+
+	if(!seq || !gaps) {
+		perror("could not allocate memory for layout");
+		free(seq);
+		free(gaps);
+		return 0;
+	}
+
+	if(order_path) {
+		long got = read_order(order_path, inputs, entries, sorted, n, seq);
+
+		if(got < 0) {
+			free(seq);
+			free(gaps);
+			return 0;
+		}
+		n_hinted = got;
+	}
+
+	n_seq = n_hinted;
+	for(i = 0; i < n; i++)
+		if(inputs[i].dup_of == i && !inputs[i].placed)
+			seq[n_seq++] = i;
+
+	for(i = 0; i < n_seq; i++) {
+		GBFS_INPUT *in = &inputs[seq[i]];
+
+		in->data_offset = place_object(gaps, &n_gaps, max_fit, &end,
+		                               entries[seq[i]].len, in->align,
+		                               i >= n_hinted);
+	}
+
+	for(i = 0; i < n; i++) {
+		inputs[i].data_offset = inputs[inputs[i].dup_of].data_offset;
+		entries[i].data_offset = inputs[i].data_offset;
+	}
+
+	free(seq);
+	free(gaps);
+
+	/* pad archive with 0's to para boundary */
+	return (end + 0x000f) & ~0x000fUL;
+}
+
+
+static const unsigned int *cmp_counts;
+
+/*---------------------------------------------------------------------------------
+	bucketcmp()
+	orders bucket numbers by size, largest first
+---------------------------------------------------------------------------------*/
+static int bucketcmp(const void *a, const void *b) {
+//---------------------------------------------------------------------------------
+	unsigned int ia = *(const unsigned int *)a, ib = *(const unsigned int *)b;
+
+	if(cmp_counts[ia] != cmp_counts[ib])
+		return cmp_counts[ia] > cmp_counts[ib] ? -1 : 1;
+	return ia < ib ? -1 : ia > ib;
+}
+
+
+/*---------------------------------------------------------------------------------
+	place_buckets()
+	One attempt at the hash index: hashes every key with seed, then
+	finds a displacement for each bucket, largest first, that moves
+	all its keys to free slots.  Returns 0 for success or nonzero if
+	some bucket would not fit.
+---------------------------------------------------------------------------------*/
+static int place_buckets(const unsigned char *dir, const unsigned int *keys,
+                         unsigned int m, unsigned int n_buckets, unsigned int seed,
+                         unsigned int *disp, unsigned int *slot_entry,
+                         unsigned int *work) {
+//---------------------------------------------------------------------------------
+	unsigned int *start = work, *count = work + m, *members = work + 2 * m,
+	             *border = work + 3 * m, *first = work + 4 * m,
+	             *taken = work + 5 * m;
+	unsigned int i, b, next_free = 0;
+
+	/* empty buckets keep displacement 0 */
+	for(b = 0; b < n_buckets; b++)
+		count[b] = disp[b] = 0;
+	for(i = 0; i < m; i++) {
+		uint32_t h = gbfs_name_hash((const char *)dir + 32 * keys[i], seed);
+
+		start[i] = gbfs_hash_start(h, m);
+		members[i] = gbfs_hash_bucket(h, n_buckets);
+		count[members[i]]++;
+		taken[i] = 0;
+	}
+
+	/* group keys by bucket: first[b] indexes border, which holds keys */
+	for(b = 0, i = 0; b < n_buckets; b++) {
+		first[b] = i;
+		i += count[b];
+	}
+	for(i = 0; i < m; i++)
+		border[first[members[i]]++] = i;
+	for(b = 0; b < n_buckets; b++)
+		first[b] -= count[b];
+
+	/* members now lists buckets, biggest first */
+	for(b = 0; b < n_buckets; b++)
+		members[b] = b;
+	cmp_counts = count;
+	qsort(members, n_buckets, sizeof(*members), bucketcmp);
+
+	for(i = 0; i < n_buckets; i++) {
+		unsigned int *bk = border + first[members[i]];
+		unsigned int size = count[members[i]], d, j;
+
+		if(!size)
+			break;
+
+		if(size == 1) {
+			/* a lone key can go straight to any free slot */
+			while(taken[next_free])
+				next_free++;
+			d = next_free + m - start[bk[0]];
+			if(d >= m)
+				d -= m;
+		} else {
+			for(d = 0; d < m; d++) {
+				for(j = 0; j < size; j++) {
+					unsigned int s = start[bk[j]] + d;
+
+					if(s >= m)
+						s -= m;
+					if(taken[s])
+						break;
+					taken[s] = 1;
+				}
+				if(j == size)
+					break;
+
+				/* undo the partial claim */
+				while(j-- > 0) {
+					unsigned int s = start[bk[j]] + d;
+
+					taken[s >= m ? s - m : s] = 0;
+				}
+			}
+			if(d == m)
+				return -1;
+		}
+
+		disp[members[i]] = d;
+		for(j = 0; j < size; j++) {
+			unsigned int s = start[bk[j]] + d;
+
+			if(s >= m)
+				s -= m;
+			taken[s] = 1;
+			slot_entry[s] = keys[bk[j]];
+		}
+	}
+
+	return 0;
+}
+
+
+/*---------------------------------------------------------------------------------
+	build_index()
+	Builds the "MPHI" minimal perfect hash of the distinct names in a
+	sorted directory (see gbfshash.h) and checks that every name
+	resolves through it.  Returns the block payload, or NULL on error.
+---------------------------------------------------------------------------------*/
+static unsigned char *build_index(const unsigned char *dir, unsigned int n,
+                                  unsigned long *out_len) {
+//---------------------------------------------------------------------------------
+	unsigned int *keys = malloc((n ? n : 1) * 9 * sizeof(*keys));
+	unsigned int *disp = keys + n, *slot_entry = keys + 2 * n, *work = keys + 3 * n;
+	unsigned int i, m = 0, n_buckets, seed = 0, placed = 0;
+	unsigned char *ix = NULL;
+
+	if(n > MAX_INDEXED) {
+		fprintf(stderr, "--index can't cover more than %u objects\n", MAX_INDEXED);
+		return NULL;
+	}
+
+	if(!keys) {
+		perror("could not allocate memory for index");
+		return NULL;
+	}
+
+	for(i = 0; i < n; i++)
+		if(!i || namecmp(dir + 32 * i, dir + 32 * (i - 1)))
+			keys[m++] = i;
+
+	/* about three names to a bucket, then more buckets until it fits */
+	n_buckets = m > 3 ? m / 3 : 1;
+	while(m && !placed) {
+		for(seed = 0; seed < 16; seed++) {
+			placed = !place_buckets(dir, keys, m, n_buckets, seed,
+			                        disp, slot_entry, work);
+			if(placed)
+				break;
+		}
+		if(!placed && n_buckets >= m)
+			break;
+		if(!placed)
+			n_buckets = n_buckets * 2 < m ? n_buckets * 2 : m;
+	}
+
+	if(m && !placed) {
+		fputs("could not build hash index\n", stderr);
+		free(keys);
+		return NULL;
+	}
+
+	*out_len = 6 + 2 * (m ? n_buckets + m : 0);
+	ix = calloc(1, *out_len);
+	if(!ix) {
+		perror("could not allocate memory for index");
+		free(keys);
+		return NULL;
+	}
+
+	if(m) {
+		puti16(ix, m);
+		puti16(ix + 2, n_buckets);
+		puti16(ix + 4, seed);
+		for(i = 0; i < n_buckets; i++)
+			puti16(ix + 6 + 2 * i, disp[i]);
+		for(i = 0; i < m; i++)
+			puti16(ix + 6 + 2 * n_buckets + 2 * i, slot_entry[i]);
+	}
+	free(keys);
+
+	/* check it with the reference lookup */
+	for(i = 0; i < n; i++) {
+		long found = gbfs_hash_lookup(ix, *out_len, dir, n, (const char *)dir + 32 * i);
+
+		if(found < 0 || namecmp(dir + 32 * found, dir + 32 * i)) {
+			fputs("hash index failed verification\n", stderr);
+			free(ix);
+			return NULL;
+		}
+	}
+
+	return ix;
+}
+
+
+/*---------------------------------------------------------------------------------
+	free_exts()
+	release the payloads of the extension blocks
+---------------------------------------------------------------------------------*/
+static void free_exts(GBFS_EXT_OUT *exts, unsigned int n) {
+//---------------------------------------------------------------------------------
+	while(n-- > 0)
+		free(exts[n].data);
+}
+
+
+/*---------------------------------------------------------------------------------
+	write_exts()
+	write the chain of extension blocks to the archive at base in fd
+---------------------------------------------------------------------------------*/
+static int write_exts(int fd, off_t base, const GBFS_EXT_OUT *exts, unsigned int n) {
+//---------------------------------------------------------------------------------
+	unsigned int i;
+
+	for(i = 0; i < n; i++) {
+		unsigned char hdr[sizeof(GBFS_EXT)];
+
+		memcpy(hdr, exts[i].tag, 4);
+		puti32(hdr + 4, exts[i].len);
+		puti32(hdr + 8, i + 1 < n ? exts[i + 1].offset : 0);
+
+		if(pwrite_full(fd, hdr, sizeof(hdr), base + exts[i].offset)
+		   || pwrite_full(fd, exts[i].data, exts[i].len, base + exts[i].offset + sizeof(hdr)))
+			return -1;
+	}
+
+	return 0;
+}
+
+
+/*---------------------------------------------------------------------------------
+	set_dir_location()
+	Points the header hdr at a directory of n entries at dir_off.
+	Where the 16-bit fields can't hold it, they describe an empty
+	directory and a "DIR2" block is added to exts instead (see
+	gbfs.h).  Returns 0 for success or nonzero for failure.
+---------------------------------------------------------------------------------*/
+static int set_dir_location(unsigned char *hdr, unsigned long dir_off, unsigned int n,
+                            GBFS_EXT_OUT *exts, unsigned int *n_exts) {
+//---------------------------------------------------------------------------------
+	GBFS_EXT_OUT *x = &exts[*n_exts];
+
+	if(dir_off <= 0xFFFF && n <= 0xFFFF) {
+		puti16(hdr + 20, dir_off);
+		puti16(hdr + 22, n);
+		return 0;
+	}
+
+	x->data = malloc(8);
+	if(!x->data) {
+		perror("could not allocate memory for directory");
+		return -1;
+	}
+	x->tag = GBFS_EXT_DIR2;
+	x->len = 8;
+	puti32(x->data, dir_off);
+	puti32(x->data + 4, n);
+	++*n_exts;
+
+	puti16(hdr + 20, 32);
+	puti16(hdr + 22, 0);
+	hdr[28] |= GBFS_FLAG_DIR2;
+	return 0;
+}
+
+
+/*---------------------------------------------------------------------------------
+	find_rom_space()
+	Finds the GBFS_SPACE called name in the ROM at path.  Returns 0
+	for success or nonzero for failure.
+---------------------------------------------------------------------------------*/
+static int find_rom_space(const char *path, const char *name, ROM_SPACE *space) {
+//---------------------------------------------------------------------------------
+	MAPPED_FILE rom;
+	int err;
+
+	if(map_file(&rom, path)) {
+		fputs("could not open ", stderr);
+		perror(path);
+		return -1;
+	}
+
+	err = rom_space_find(rom.data, rom.len, name, space);
+	unmap_file(&rom);
+
+	if(err == ROM_SPACE_NOT_FOUND) {
+		fprintf(stderr, "could not find GBFS_SPACE %s in %s\n", name, path);
+		return -1;
+	}
+	if(err == ROM_SPACE_BAD_SIZE) {
+		fprintf(stderr, "the size of GBFS_SPACE %s in %s is not a number of KB that fits the file\n",
+		        name, path);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/*---------------------------------------------------------------------------------
+	spancmp()
+	qsort comparator: ranges of the archive by start
+---------------------------------------------------------------------------------*/
+static int spancmp(const void *a, const void *b) {
+//---------------------------------------------------------------------------------
+	const GBFS_GAP *x = a, *y = b;
+
+	return x->start < y->start ? -1 : x->start > y->start;
+}
+
+
+/*---------------------------------------------------------------------------------
+	clear_padding()
+	Zeroes the bytes of an archive written in place at base in fd
+	that no header, directory entry, object or extension block
+	covers, as a new file's would be, so that whatever the space
+	held before doesn't show through.  Returns 0 for success or
+	nonzero for failure.
+---------------------------------------------------------------------------------*/
+static int clear_padding(int fd, off_t base, unsigned long total_len,
+                         const GBFS_INPUT *inputs, unsigned int n,
+                         unsigned long dir_off, const GBFS_EXT_OUT *exts,
+                         unsigned int n_exts) {
+//---------------------------------------------------------------------------------
+	static const unsigned char zeroes[4096];
+	GBFS_GAP *spans = malloc((n + n_exts + 2) * sizeof(*spans));
+	unsigned long pos = 0;
+	unsigned int n_spans = 0, i;
+
+	if(!spans)
+		return -1;
+
+	spans[n_spans].start = 0;
+	spans[n_spans++].end = 32;
+	spans[n_spans].start = dir_off;
+	spans[n_spans++].end = dir_off + n * sizeof(GBFS_ENTRY);
+	for(i = 0; i < n; i++) {
+		if(inputs[i].dup_of != i)
+			continue;
+		spans[n_spans].start = inputs[i].data_offset;
+		spans[n_spans++].end = inputs[i].data_offset
+		                       + (inputs[i].packed ? inputs[i].packed_len : inputs[i].len);
+	}
+	for(i = 0; i < n_exts; i++) {
+		spans[n_spans].start = exts[i].offset;
+		spans[n_spans++].end = exts[i].offset + sizeof(GBFS_EXT) + exts[i].len;
+	}
+	qsort(spans, n_spans, sizeof(*spans), spancmp);
+
+	for(i = 0; i <= n_spans; i++) {
+		unsigned long end = i < n_spans ? spans[i].start : total_len;
+
+		while(pos < end) {
+			unsigned long chunk = end - pos < sizeof(zeroes) ? end - pos : sizeof(zeroes);
+
+			if(pwrite_full(fd, zeroes, chunk, base + pos)) {
+				free(spans);
+				return -1;
+			}
+			pos += chunk;
+		}
+		if(i < n_spans && spans[i].end > pos)
+			pos = spans[i].end;
+	}
+
+	free(spans);
+	return 0;
+}
+
+
+static unsigned int *name_slots;
+
+/*---------------------------------------------------------------------------------
+	add_input()
+	Measures one input file and appends it to inputs and entries,
+	growing both as needed.  The object is called name, or after the
+	file if name is NULL.  If data is not NULL, it holds the len
+	bytes of the file, read from a tar stream, and path only names
+	it.  path_buf, if not NULL, is the allocated path, and it and
+	data are owned by the list from then on.  Returns 0 for success
+	or nonzero for failure.
+---------------------------------------------------------------------------------*/
+static int add_input(GBFS_INPUT **inputs, unsigned int *n, unsigned int *cap,
+                     const char *path, char *path_buf, const char *name,
+                     unsigned char *data, unsigned long len,
+                     unsigned long data_align) {
+//---------------------------------------------------------------------------------
+	struct stat st;
+	GBFS_ENTRY *e;
+	char *base = NULL;
+	unsigned int slot;
+
+	if(*n == MAX_ENTRIES) {
+		fprintf(stderr, "too many files: a GBFS archive holds at most %u objects\n",
+		        MAX_ENTRIES);
+		free(path_buf);
+		free(data);
+		return -1;
+	}
+
+	if(*n == *cap) {
+		unsigned int new_cap = *cap ? *cap * 2 : 256;
+		GBFS_INPUT *new_inputs;
+		GBFS_ENTRY *new_entries;
+
+		if(new_cap > MAX_ENTRIES)
+			new_cap = MAX_ENTRIES;
+		new_inputs = realloc(*inputs, new_cap * sizeof(GBFS_INPUT));
+		if(new_inputs)
+			*inputs = new_inputs;
+		new_entries = realloc(entries, new_cap * sizeof(GBFS_ENTRY));
+		if(new_entries)
+			entries = new_entries;
+		if(!new_inputs || !new_entries) {
+			perror("could not allocate memory for directory");
+			free(path_buf);
+			free(data);
+			return -1;
+		}
+		*cap = new_cap;
+	}
+
+	/* a tar member's size was checked as the stream was read */
+	if(!data) {
+		if(stat(path, &st)) {
+			fprintf(stderr, "could not open %s: %s\n", path, strerror(errno));
+			free(path_buf);
+			return -1;
+		}
+
+		if(!S_ISREG(st.st_mode)) {
+			fprintf(stderr, "%s is not a regular file\n", path);
+			free(path_buf);
+			return -1;
+		}
+
+		/* entry lengths and offsets are 32 bits */
+		if((uintmax_t)st.st_size > 0xFFFFFFFFu) {
+			fprintf(stderr, "%s is too large for a GBFS archive\n", path);
+			free(path_buf);
+			return -1;
+		}
+		len = st.st_size;
+	}
+
+	e = &entries[*n];
+	memset(e, 0, sizeof(*e));
+	e->len = len;
+
+	/* a name given in a file list must fit as is; a file name is cut
+	   to fit, as it always has been */
+	if(name) {
+		if(!*name || strlen(name) > sizeof(e->name)) {
+			fprintf(stderr, "invalid object name \"%s\" for %s: names are 1 to %u bytes\n",
+			        name, path, (unsigned int)sizeof(e->name));
+			free(path_buf);
+			free(data);
+			return -1;
+		}
+	} else {
+		/* basename() may modify its argument */
+		base = strdup(path);
+		if(!base) {
+			perror("could not allocate memory for directory");
+			free(path_buf);
+			free(data);
+			return -1;
+		}
+		name = basename(base);
+	}
+	gbfs_put_name(e->name, name);
+	free(base);
+
+	/* two objects of one name can't both be found */
+	for(slot = gbfs_name_hash(e->name, 0) & (NAME_SLOTS - 1);
+	    name_slots[slot];
+	    slot = (slot + 1) & (NAME_SLOTS - 1)) {
+		unsigned int k = name_slots[slot] - 1;
+
+		if(!namecmp(entries[k].name, e->name)) {
+			char nameout[sizeof(e->name) + 1];
+
+			memcpy(nameout, e->name, sizeof(e->name));
+			nameout[sizeof(e->name)] = 0;
+			fprintf(stderr, "%s and %s would both be named %s\n",
+			        (*inputs)[k].path, path, nameout);
+			free(path_buf);
+			free(data);
+			return -1;
+		}
+	}
+	name_slots[slot] = *n + 1;
+
+	memset(&(*inputs)[*n], 0, sizeof(GBFS_INPUT));
+	(*inputs)[*n].path = path;
+	(*inputs)[*n].path_buf = path_buf;
+	(*inputs)[*n].data = data;
+	(*inputs)[*n].len = len;
+	(*inputs)[*n].dup_of = *n;
+	(*inputs)[*n].align = data_align;
+
+	/* diagnostic */
+	{
+		char nameout[sizeof(e->name) + 1];
+
+		memcpy(nameout, e->name, sizeof(e->name));
+		nameout[sizeof(e->name)] = 0;
+		printf("%10lu %s\n", (unsigned long)len, nameout);
+	}
+
+	++*n;
+	return 0;
+}
+
+
+/*---------------------------------------------------------------------------------
+	read_file_list()
+	Adds the files listed in path, or on stdin if path is "-".  Each
+	line is a file's path, optionally followed by a tab and the name
+	to give it in the archive; blank lines and lines starting with #
+	are ignored.  Returns 0 for success or nonzero for failure.
+---------------------------------------------------------------------------------*/
+static int read_file_list(const char *path, GBFS_INPUT **inputs, unsigned int *n,
+                          unsigned int *cap, unsigned long data_align) {
+//---------------------------------------------------------------------------------
+	int from_stdin = !strcmp(path, "-");
+	FILE *fp = from_stdin ? stdin : fopen(path, "r");
+	const char *label = from_stdin ? "<stdin>" : path;
+	char *line = NULL;
+	size_t line_cap = 0;
+	ssize_t len;
+	unsigned long line_no = 0;
+	int err = 0;
+
+	if(!fp) {
+		fputs("could not open ", stderr);
+		perror(path);
+		return -1;
+	}
+
+	while(!err && (len = getline(&line, &line_cap, fp)) >= 0) {
+		char *tab, *file;
+
+		line_no++;
+		while(len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+			line[--len] = 0;
+		if(!len || line[0] == '#')
+			continue;
+
+		tab = strchr(line, '\t');
+		if(tab)
+			*tab++ = 0;
+
+		if(!line[0]) {
+			fprintf(stderr, "%s:%lu: missing file name\n", label, line_no);
+			err = -1;
+			break;
+		}
+
+		file = strdup(line);
+		if(!file) {
+			perror("could not allocate memory for file list");
+			err = -1;
+			break;
+		}
+
+		/* add_input() owns file from here */
+		if(add_input(inputs, n, cap, file, file, tab, NULL, 0, data_align)) {
+			fprintf(stderr, "%s:%lu: could not add %s\n", label, line_no,
+			        tab ? tab : line);
+			err = -1;
+		}
+	}
+
+	if(!err && ferror(fp)) {
+		fputs("could not read ", stderr);
+		perror(label);
+		err = -1;
+	}
+
+	free(line);
+	if(!from_stdin)
+		fclose(fp);
+	return err;
+}
+
+
+/*---------------------------------------------------------------------------------
+	read_tar()
+	Adds the regular files in the tar archive at path, or on stdin if
+	path is "-", each named after its file as on the command line.
+	The stream is read once, front to back, so it can come straight
+	from a pipe.  Directories are passed over, and other members with
+	a warning.  Returns 0 for success or nonzero for failure.
+---------------------------------------------------------------------------------*/
+static int read_tar(const char *path, GBFS_INPUT **inputs, unsigned int *n,
+                    unsigned int *cap, unsigned long data_align) {
+//---------------------------------------------------------------------------------
+	int from_stdin = !strcmp(path, "-");
+	FILE *fp = from_stdin ? stdin : fopen(path, "rb");
+	const char *label = from_stdin ? "<stdin>" : path;
+	int at_end = 0, err = 0;
+
+	if(!fp) {
+		fputs("could not open ", stderr);
+		perror(path);
+		return -1;
+	}
+
+	while(!err) {
+		TAR_MEMBER m;
+		unsigned char *data;
+
+		if(tar_read_member(fp, &m, &at_end)) {
+			if(errno) {
+				fputs("could not read ", stderr);
+				perror(label);
+			} else {
+				fprintf(stderr, "%s: not a valid tar archive\n", label);
+			}
+			err = -1;
+			break;
+		}
+		if(at_end)
+			break;
+
+		if(m.type != TAR_REGULAR) {
+			if(m.type != TAR_DIRECTORY)
+				fprintf(stderr, "%s: skipping %s, which is not a regular file\n",
+				        label, m.name);
+			free(m.name);
+			if(tar_skip_data(fp, m.size)) {
+				fputs("could not read ", stderr);
+				perror(label);
+				err = -1;
+			}
+			continue;
+		}
+
+		/* entry lengths and offsets are 32 bits */
+		if(m.size > 0xFFFFFFFFu) {
+			fprintf(stderr, "%s: %s is too large for a GBFS archive\n", label, m.name);
+			free(m.name);
+			err = -1;
+			break;
+		}
+
+		data = malloc(m.size ? m.size : 1);
+		if(!data) {
+			perror("could not allocate memory for tar member");
+			free(m.name);
+			err = -1;
+			break;
+		}
+
+		if(tar_read_data(fp, data, m.size)) {
+			fputs("could not read ", stderr);
+			perror(label);
+			free(m.name);
+			free(data);
+			err = -1;
+			break;
+		}
+
+		/* add_input() owns the name and data from here */
+		if(add_input(inputs, n, cap, m.name, m.name, NULL, data, m.size, data_align)) {
+			fprintf(stderr, "%s: could not add member\n", label);
+			err = -1;
+		}
+	}
+
+	if(!from_stdin)
+		fclose(fp);
+	return err;
+}
+
+
+/* an object of an archive being updated in place */
+typedef struct UPDATE_OBJ {
+	char name[24];
+	unsigned long len, offset;     /* where the data will be */
+	unsigned long old_len, old_offset, slot_end;
+	unsigned int type;             /* CMPR table byte */
+	unsigned int order;            /* old directory position, then input order */
+	long input;                    /* input with the new data, or -1 */
+	int deleted, has_old, shared;
+	unsigned char *moved;          /* data read out to be moved */
+} UPDATE_OBJ;
 
-#include "gbfs.h"
+static UPDATE_OBJ *cmp_objs;
 
-static const char GBFS_magic[] = "PinEightGBFS\r\n\032\n";
+/*---------------------------------------------------------------------------------
+	objnamecmp()
+	orders object indices by name, then old directory position
+---------------------------------------------------------------------------------*/
+static int objnamecmp(const void *a, const void *b) {
+//---------------------------------------------------------------------------------
+	const UPDATE_OBJ *pa = &cmp_objs[*(const unsigned int *)a];
+	const UPDATE_OBJ *pb = &cmp_objs[*(const unsigned int *)b];
+	int c = namecmp(pa->name, pb->name);
 
-static const char help_text[] =
-"Creates a GBFS archive.\n"
-"usage: gbfs ARCHIVE [FILE...]\n";
+	return c ? c : pa->order < pb->order ? -1 : pa->order > pb->order;
+}
 
-GBFS_FILE header;
-GBFS_ENTRY *entries;
 
+/*---------------------------------------------------------------------------------
+	objoffcmp()
+	orders object indices by data offset, then name order
+---------------------------------------------------------------------------------*/
+static int objoffcmp(const void *a, const void *b) {
 //---------------------------------------------------------------------------------
-unsigned long fcopy(FILE *dst, FILE *src) {
+	const UPDATE_OBJ *pa = &cmp_objs[*(const unsigned int *)a];
+	const UPDATE_OBJ *pb = &cmp_objs[*(const unsigned int *)b];
+
+	if(pa->offset != pb->offset)
+		return pa->offset < pb->offset ? -1 : 1;
+	return pa->order < pb->order ? -1 : pa->order > pb->order;
+}
+
+
+/*---------------------------------------------------------------------------------
+	find_old()
+	binary search the old directory for the first object named name.
+	returns its index, or n if there is none.
+---------------------------------------------------------------------------------*/
+static unsigned int find_old(const UPDATE_OBJ *objs, unsigned int n, const char *name) {
 //---------------------------------------------------------------------------------
-	char buf[16384];
-	unsigned long sz = 0, this_sz;
+	char key[24];
+	unsigned int lo = 0, hi = n;
 
-	do {
-		this_sz = fread(buf, 1, sizeof(buf), src);
+	gbfs_put_name(key, name);
 
-		if(this_sz) {
-			fwrite(buf, 1, this_sz, dst);  /* FIXME: need error checking */
-			sz += this_sz;
-		}
-	} while(this_sz != 0);
+	while(lo < hi) {
+		unsigned int mid = lo + (hi - lo) / 2;
+
+		if(namecmp(objs[mid].name, key) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
 
-	return sz;
+	return lo < n && !namecmp(objs[lo].name, key) ? lo : n;
 }
 
 
 /*---------------------------------------------------------------------------------
-	fputi16()
-	write a 16-bit integer in intel format to a file
+	move_data()
+	copy len bytes within the archive from src down to dst, a chunk
+	at a time from the front so that overlapping moves are safe
 ---------------------------------------------------------------------------------*/
-void fputi16(unsigned int in, FILE *f) {
+static int move_data(int fd, unsigned long dst, unsigned long src, unsigned long len) {
 //---------------------------------------------------------------------------------
-	fputc(in, f);
-	fputc(in >> 8, f);
+	static unsigned char buf[65536];
+
+	while(len) {
+		size_t chunk = len < sizeof(buf) ? len : sizeof(buf);
+
+		if(pread_full(fd, buf, chunk, src) || pwrite_full(fd, buf, chunk, dst))
+			return -1;
+		src += chunk;
+		dst += chunk;
+		len -= chunk;
+	}
+
+	return 0;
 }
 
 
 /*---------------------------------------------------------------------------------
-	fputi32()
-	write a 32-bit integer in intel format to a file
+	finish_update()
+	Writes the extension blocks, sorted directory and header of an
+	updated archive whose live objects are listed in live, and trims
+	the file to the new total_len.  The directory follows the header,
+	or the data if dir_at_end is set.  Returns 0 for success or
+	nonzero for failure.
 ---------------------------------------------------------------------------------*/
-void fputi32(unsigned long in, FILE *f) {
+static int finish_update(int fd, const char *archive, UPDATE_OBJ *objs,
+                         unsigned int *live, unsigned int n, int index,
+                         int dir_at_end) {
 //---------------------------------------------------------------------------------
-	fputc(in, f);
-	fputc(in >> 8, f);
-	fputc(in >> 16, f);
-	fputc(in >> 24, f);
+	static const unsigned char zeroes[4096];
+	unsigned long dir_len = 32 + 32UL * n, data_end = dir_at_end ? 32 : dir_len;
+	unsigned long dir_off, off, total_len;
+	unsigned char *dir = calloc(1, dir_len);
+	GBFS_EXT_OUT exts[MAX_EXTS];
+	unsigned int n_exts = 0, i;
+	int compressed = 0;
+
+	if(!dir) {
+		perror("could not allocate memory for directory");
+		return -1;
+	}
+
+	cmp_objs = objs;
+	qsort(live, n, sizeof(*live), objnamecmp);
+
+	memcpy(dir, GBFS_magic, 16);
+
+	for(i = 0; i < n; i++) {
+		const UPDATE_OBJ *o = &objs[live[i]];
+		unsigned char *p = dir + 32 + 32 * i;
+
+		memcpy(p, o->name, sizeof(o->name));
+		puti32(p + 24, o->len);
+		puti32(p + 28, o->offset);
+		if(o->offset + o->len > data_end)
+			data_end = o->offset + o->len;
+		if(o->type)
+			compressed = 1;
+	}
+
+	if(compressed) {
+		exts[n_exts].tag = GBFS_EXT_COMPRESSION;
+		exts[n_exts].len = n;
+		exts[n_exts].data = malloc(n ? n : 1);
+		if(!exts[n_exts].data) {
+			perror("could not allocate memory for compression table");
+			free(dir);
+			return -1;
+		}
+		for(i = 0; i < n; i++)
+			exts[n_exts].data[i] = objs[live[i]].type;
+		n_exts++;
+	}
+
+	if(index) {
+		exts[n_exts].tag = GBFS_EXT_HASH_INDEX;
+		exts[n_exts].data = build_index(dir + 32, n, &exts[n_exts].len);
+		if(!exts[n_exts].data) {
+			free_exts(exts, n_exts);
+			free(dir);
+			return -1;
+		}
+		n_exts++;
+	}
+
+	dir_off = dir_at_end ? (data_end + 0x000f) & ~0x000fUL : 32;
+	if(set_dir_location(dir, dir_off, n, exts, &n_exts)) {
+		free_exts(exts, n_exts);
+		free(dir);
+		return -1;
+	}
+
+	off = dir_at_end ? dir_off + 32UL * n : (data_end + 3) & ~3UL;
+	for(i = 0; i < n_exts; i++) {
+		exts[i].offset = off;
+		off = (off + sizeof(GBFS_EXT) + exts[i].len + 3) & ~3UL;
+	}
+	total_len = (off + 0x000f) & ~0x000fUL;
+	puti32(dir + 16, total_len);
+	puti32(dir + 24, n_exts ? exts[0].offset : 0);
+
+	/* the tail may hold stale data; make the padding zeroes again */
+	for(off = data_end; off < total_len; off += sizeof(zeroes)) {
+		unsigned long chunk = total_len - off;
+
+		if(pwrite_full(fd, zeroes, chunk < sizeof(zeroes) ? chunk : sizeof(zeroes), off))
+			break;
+	}
+
+	/* the directory goes last, once everything it points to is there */
+	if(off < total_len || write_exts(fd, 0, exts, n_exts) || ftruncate(fd, total_len)
+	   || pwrite_full(fd, dir + 32, dir_len - 32, dir_off)
+	   || pwrite_full(fd, dir, 32, 0)) {
+		fputs("could not write ", stderr);
+		perror(archive);
+		free_exts(exts, n_exts);
+		free(dir);
+		return -1;
+	}
+
+	free_exts(exts, n_exts);
+	free(dir);
+	return 0;
 }
 
 
 /*---------------------------------------------------------------------------------
-	namecmp()
-	compares the first 24 bytes of a pair of strings.
-	useful for sorting names.
+	compact_archive()
+	Slides the data of an updated archive down over the holes left
+	by deleted and moved objects, keeping each object's order and the
+	alignment of its offset (up to 256 bytes), then rewrites the
+	directory.  Returns the number of bytes reclaimed, or -1 on error.
 ---------------------------------------------------------------------------------*/
-int namecmp(const void *a, const void *b) {
+static long compact_archive(int fd, const char *archive, UPDATE_OBJ *objs,
+                            unsigned int *live, unsigned int n, int index,
+                            int dir_at_end) {
 //---------------------------------------------------------------------------------
-	return memcmp(a, b, 24);
+	unsigned long cursor = dir_at_end ? 32 : 32 + 32UL * n, old_end = cursor, i;
+
+	cmp_objs = objs;
+	qsort(live, n, sizeof(*live), objoffcmp);
+
+	for(i = 0; i < n; i++) {
+		UPDATE_OBJ *o = &objs[live[i]];
+		unsigned long align, dst, j;
+
+		if(o->offset + o->len > old_end)
+			old_end = o->offset + o->len;
+
+		if(!o->len) {
+			o->offset = cursor;
+			continue;
+		}
+
+		for(align = 1; align < 256 && !(o->offset & align); align <<= 1)
+			;
+		dst = (cursor + align - 1) & ~(align - 1);
+		if(dst > o->offset)
+			dst = o->offset;  /* overlapping data stays where it is */
+
+		if(dst < o->offset && move_data(fd, dst, o->offset, o->len)) {
+			fputs("could not compact ", stderr);
+			perror(archive);
+			return -1;
+		}
+
+		/* objects sharing this data move with it */
+		for(j = i + 1; j < n && objs[live[j]].offset == o->offset
+		               && objs[live[j]].len == o->len; j++)
+			objs[live[j]].offset = dst;
+
+		cursor = dst + o->len;
+		o->offset = dst;
+		i = j - 1;
+	}
+
+	if(finish_update(fd, archive, objs, live, n, index, dir_at_end))
+		return -1;
+
+	return (long)(old_end - cursor);
 }
 
 
+/*---------------------------------------------------------------------------------
+	update_archive()
+	Applies additions, replacements and deletions to an existing
+	archive without rebuilding it.  New data that fits the slot of
+	the object it replaces is written there; anything else, and any
+	object the growing directory runs into, goes after the last data
+	still in use.  A directory already after the data stays there.
+	Returns 0 for success or nonzero for failure.
+---------------------------------------------------------------------------------*/
+static int update_archive(const char *archive, GBFS_INPUT *inputs, unsigned int n_inputs,
+                          char **deletes, unsigned int n_deletes, unsigned int jobs,
+                          unsigned long data_align, int index, int compact,
+                          int dir_at_end) {
 //---------------------------------------------------------------------------------
-int main(int argc, char **argv) {
-//---------------------------------------------------------------------------------
-	FILE *outfile;
-	unsigned int arg = 2;
-	unsigned int n_entries = 0;
-
-	if(argc < 3) {
-		fputs(help_text, stderr);
+	GBFS_HOST gh;
+	UPDATE_OBJ *objs;
+	unsigned int *live = NULL, *by_off = NULL;
+	unsigned int n_old, n_objs = 0, n_live = 0, i, j;
+	unsigned int n_in_place = 0, n_appended = 0, n_moved = 0, n_deleted = 0;
+	unsigned long data_limit, dir_end, cursor;
+	const unsigned char *types;
+	u32 types_len, ext_off;
+	INGEST_CTX ingest;
+	int fd = -1, err = 1;
+
+	switch(gbfs_host_open(&gh, archive)) {
+	case GBFS_HOST_IO_ERROR:
+		fputs("could not open ", stderr);
+		perror(archive);
+		return 1;
+	case GBFS_HOST_NOT_GBFS:
+		fprintf(stderr, "%s: not a GBFS file\n", archive);
 		return 1;
 	}
 
-	entries = malloc(argc * sizeof(GBFS_ENTRY));
+	/* the file is resized to fit, so it must be the archive alone */
+	if((const unsigned char *)gh.file != gh.map.data
+	   || gbfs_total_len(gh.file) != gh.map.len) {
+		fprintf(stderr, "%s: can only update a file holding one GBFS archive and nothing else\n",
+		        archive);
+		gbfs_host_close(&gh);
+		return 1;
+	}
 
-	if(!entries) {
+	n_old = gbfs_count_objs(gh.file);
+	dir_at_end |= (const unsigned char *)gbfs_get_dir(gh.file, NULL) - gh.map.data > 32;
+	index |= gbfs_get_ext(gh.file, GBFS_EXT_HASH_INDEX, NULL) != NULL;
+	types = gbfs_get_ext(gh.file, GBFS_EXT_COMPRESSION, &types_len);
+	if(types && types_len < n_old)
+		types = NULL;
+
+	/* data ends where the extension blocks begin */
+	data_limit = gbfs_total_len(gh.file);
+	ext_off = gh.map.data[24] | (gh.map.data[25] << 8)
+	        | (gh.map.data[26] << 16) | ((u32)gh.map.data[27] << 24);
+	if(ext_off && ext_off < data_limit)
+		data_limit = ext_off;
+
+	objs = calloc(n_old + n_inputs + 1, sizeof(*objs));
+	live = malloc((n_old + n_inputs + 1) * sizeof(*live));
+	by_off = malloc((n_old + 1) * sizeof(*by_off));
+	if(!objs || !live || !by_off) {
 		perror("could not allocate memory for directory");
+		goto out;
+	}
+
+	n_objs = n_old;
+	for(i = 0; i < n_old; i++) {
+		UPDATE_OBJ *o = &objs[i];
+		char name[25];
+		u32 len;
+		const unsigned char *data = gbfs_get_nth_obj(gh.file, i, name, &len);
+
+		if(!data) {
+			fprintf(stderr, "%s: object %u lies outside the archive\n", archive, i);
+			goto out;
+		}
+
+		gbfs_put_name(o->name, name);
+		o->len = o->old_len = len;
+		o->offset = o->old_offset = data - gh.map.data;
+		o->type = types ? types[i] : 0;
+		o->order = i;
+		o->input = -1;
+		o->has_old = 1;
+		by_off[i] = i;
+	}
+
+	/* each object's slot runs to the next object's data */
+	cmp_objs = objs;
+	qsort(by_off, n_old, sizeof(*by_off), objoffcmp);
+	{
+		unsigned long next = data_limit;
+
+		for(i = n_old; i-- > 0; ) {
+			UPDATE_OBJ *o = &objs[by_off[i]];
+
+			if(i + 1 < n_old && objs[by_off[i + 1]].old_offset > o->old_offset)
+				next = objs[by_off[i + 1]].old_offset;
+			o->slot_end = next;
+			if(o->slot_end < o->old_offset + o->old_len)
+				o->slot_end = o->old_offset + o->old_len;
+		}
+	}
+
+	for(i = 0; i < n_deletes; i++) {
+		int found = 0;
+
+		for(j = find_old(objs, n_old, deletes[i]); j < n_old
+		    && !strncmp(objs[j].name, deletes[i], sizeof(objs[j].name)); j++) {
+			found |= !objs[j].deleted;
+			objs[j].deleted = 1;
+		}
+		if(!found) {
+			fprintf(stderr, "%s: no object named %s to delete\n", archive, deletes[i]);
+			goto out;
+		}
+		n_deleted++;
+	}
+
+	/* an input replaces every object of its name */
+	n_objs = n_old;
+	for(i = 0; i < n_inputs; i++) {
+		const GBFS_ENTRY *e = &entries[i];
+		UPDATE_OBJ *o = NULL;
+
+		for(j = find_old(objs, n_old, e->name); j < n_old
+		    && !namecmp(objs[j].name, e->name); j++) {
+			if(objs[j].deleted)
+				continue;
+			if(o)
+				objs[j].deleted = 1;
+			else
+				o = &objs[j];
+		}
+
+		if(!o) {
+			o = &objs[n_objs];
+			memcpy(o->name, e->name, sizeof(o->name));
+			o->order = n_objs++;
+		}
+
+		o->input = i;
+		o->len = e->len;
+		o->type = inputs[i].type;
+	}
+
+	gbfs_host_close(&gh);
+	gh.map.data = NULL;
+
+	/* data two live objects share can't be overwritten for one */
+	for(i = 0; i < n_old; i = j) {
+		unsigned int n_live_here = 0, k;
+
+		for(j = i; j < n_old && objs[by_off[j]].old_offset == objs[by_off[i]].old_offset; j++)
+			n_live_here += !objs[by_off[j]].deleted && objs[by_off[j]].old_len;
+		for(k = i; k < j; k++)
+			objs[by_off[k]].shared = n_live_here > 1;
+	}
+
+	for(i = 0; i < n_objs; i++)
+		if(!objs[i].deleted)
+			live[n_live++] = i;
+	if(n_live > MAX_ENTRIES) {
+		fprintf(stderr, "too many objects: a GBFS archive holds at most %u\n", MAX_ENTRIES);
+		goto out;
+	}
+	dir_end = dir_at_end ? 32 : 32 + 32UL * n_live;
+
+	fd = open(archive, O_RDWR | O_BINARY);
+	if(fd < 0) {
+		fputs("could not open ", stderr);
+		perror(archive);
+		goto out;
+	}
+
+	/* decide what stays put; the rest goes after the last of it */
+	cursor = dir_end;
+	for(i = 0; i < n_live; i++) {
+		UPDATE_OBJ *o = &objs[live[i]];
+
+		if(!o->has_old) {
+			o->offset = ~0UL;
+			continue;
+		}
+
+		if(o->old_offset < dir_end && (o->old_len || o->input >= 0)) {
+			o->offset = ~0UL;  /* in the directory's way */
+		} else if(o->input < 0) {
+			o->offset = o->old_offset;
+		} else if(!o->shared && !(o->old_offset % data_align)
+		          && o->len <= o->slot_end - o->old_offset) {
+			o->offset = o->old_offset;
+			n_in_place++;
+		} else {
+			o->offset = ~0UL;
+		}
+
+		if(o->offset != ~0UL && o->offset + o->len > cursor)
+			cursor = o->offset + o->len;
+	}
+
+	/* read out kept data that has to move before anything overwrites it */
+	for(i = 0; i < n_live; i++) {
+		UPDATE_OBJ *o = &objs[live[i]];
+
+		if(o->input >= 0 || o->offset != ~0UL || !o->len)
+			continue;
+
+		o->moved = malloc(o->len);
+		if(!o->moved) {
+			perror("could not allocate memory for moved object");
+			goto out;
+		}
+		if(pread_full(fd, o->moved, o->len, o->old_offset)) {
+			fputs("could not read ", stderr);
+			perror(archive);
+			goto out;
+		}
+	}
+
+	/* place what moves, sharing data where it was shared before */
+	for(i = 0; i < n_live; i++) {
+		UPDATE_OBJ *o = &objs[live[i]];
+
+		if(o->offset != ~0UL)
+			continue;
+
+		if(o->input < 0) {
+			for(j = 0; j < i; j++) {
+				const UPDATE_OBJ *p = &objs[live[j]];
+
+				if(p->input < 0 && p->has_old && p->old_offset == o->old_offset
+				   && p->old_len == o->old_len && p->moved) {
+					o->offset = p->offset;
+					free(o->moved);
+					o->moved = NULL;
+					break;
+				}
+			}
+			if(o->offset != ~0UL)
+				continue;
+			n_moved++;
+		} else {
+			n_appended++;
+		}
+
+		if(o->len) {
+			cursor = (cursor + data_align - 1) & ~(data_align - 1);
+			o->offset = cursor;
+			cursor += o->len;
+		} else {
+			o->offset = cursor;
+		}
+	}
+
+	if(cursor > 0xFFFFFFFFUL - 0x40000 - 33UL * n_live) {
+		fprintf(stderr, "%s would grow too large for a GBFS archive\n", archive);
+		goto out;
+	}
+
+	for(i = 0; i < n_live; i++) {
+		UPDATE_OBJ *o = &objs[live[i]];
+
+		if(o->input >= 0)
+			inputs[o->input].data_offset = o->offset;
+		else if(o->moved && pwrite_full(fd, o->moved, o->len, o->offset)) {
+			fputs("could not write ", stderr);
+			perror(archive);
+			goto out;
+		}
+	}
+
+	/* new data, concurrently */
+	ingest.inputs = inputs;
+	ingest.out_fd = fd;
+	ingest.base = 0;
+	if(parallel_for(n_inputs, jobs, ingest_file, &ingest))
+		goto out;
+
+	if(finish_update(fd, archive, objs, live, n_live, index, dir_at_end))
+		goto out;
+
+	printf("%u replaced in place, %u appended, %u moved, %u deleted\n",
+	       n_in_place, n_appended, n_moved, n_deleted);
+
+	if(compact) {
+		long saved = compact_archive(fd, archive, objs, live, n_live, index,
+		                             dir_at_end);
+
+		if(saved < 0)
+			goto out;
+		printf("%ld bytes reclaimed\n", saved);
+	}
+
+	if(close(fd)) {
+		fd = -1;
+		fputs("could not write ", stderr);
+		perror(archive);
+		goto out;
+	}
+	fd = -1;
+	err = 0;
+
+out:
+	if(fd >= 0)
+		close(fd);
+	if(gh.map.data)
+		gbfs_host_close(&gh);
+	if(objs)
+		for(i = 0; i < n_objs; i++)
+			free(objs[i].moved);
+	free(objs);
+	free(live);
+	free(by_off);
+	return err;
+}
+
+
+/*---------------------------------------------------------------------------------
+	write_archive()
+	Writes the laid out archive: to gbfs.$$$, or over the GBFS_SPACE
+	space in the ROM at rom_path if that is not NULL, once it is
+	known to fit there.  The directory is the dir_len bytes at dir,
+	the entries of which go at dir_off.  Returns 0 for success or
+	nonzero for failure, leaving no gbfs.$$$ behind.
+---------------------------------------------------------------------------------*/
+static int write_archive(const char *archive, const char *rom_path,
+                         const ROM_SPACE *space, unsigned long max_align,
+                         GBFS_INPUT *inputs, unsigned int n,
+                         const unsigned char *dir, unsigned long dir_len,
+                         unsigned long dir_off, const GBFS_EXT_OUT *exts,
+                         unsigned int n_exts, unsigned int jobs) {
+//---------------------------------------------------------------------------------
+	const char *out_path = rom_path ? rom_path : "gbfs.$$$";
+	off_t base = rom_path ? (off_t)space->offset : 0;
+	INGEST_CTX ingest;
+	int fd = -1, err = 1;
+
+	if(rom_path) {
+		if(header.total_len > space->size) {
+			fprintf(stderr, "the archive of %lu bytes doesn't fit GBFS_SPACE %s of %lu KB in %s\n",
+			        (unsigned long)header.total_len, archive,
+			        (unsigned long)(space->size / 1024), rom_path);
+			return 1;
+		}
+
+		/* data offsets are only as aligned as the space they're in */
+		if(space->offset % max_align) {
+			fprintf(stderr, "GBFS_SPACE %s in %s is not aligned to %lu bytes\n",
+			        archive, rom_path, max_align);
+			return 1;
+		}
+
+		fd = open(rom_path, O_RDWR | O_BINARY);
+	} else {
+		fd = open("gbfs.$$$", O_RDWR | O_CREAT | O_TRUNC | O_BINARY, 0666);
+	}
+
+	if(fd < 0) {
+		fprintf(stderr, "could not open %s for writing: %s\n", out_path, strerror(errno));
 		return 1;
 	}
 
- 	memcpy(header.magic, GBFS_magic, sizeof(header.magic));
-	header.dir_off = 32;
-	n_entries = 0;
+	/* presize the archive; the padding reads back as zeroes.  In a
+	   ROM, only the padding is cleared and the rest written once */
+	if(rom_path ? clear_padding(fd, base, header.total_len, inputs, n,
+	                            dir_off, exts, n_exts)
+	            : ftruncate(fd, header.total_len)) {
+		fprintf(stderr, "could not size the archive in %s: %s\n", out_path, strerror(errno));
+		goto out;
+	}
+
+	/* copy file contents concurrently */
+	ingest.inputs = inputs;
+	ingest.out_fd = fd;
+	ingest.base = base;
+	if(parallel_for(n, jobs, ingest_file, &ingest))
+		goto out;
+
+	if(write_exts(fd, base, exts, n_exts)) {
+		fprintf(stderr, "could not write extension blocks to %s: %s\n", out_path, strerror(errno));
+		goto out;
+	}
 
-	/*	note that this creates some wasted space if n_entries turns out
-		to be less than argc - 2 */
-	header.total_len = header.dir_off + (argc - 2) * sizeof(GBFS_ENTRY);
+	if(pwrite_full(fd, dir + 32, dir_len - 32, base + dir_off)
+	   || pwrite_full(fd, dir, 32, base)) {
+		fprintf(stderr, "could not write directory to %s: %s\n", out_path, strerror(errno));
+		goto out;
+	}
+
+	if(close(fd)) {
+		fd = -1;
+		fputs("could not write ", stderr);
+		perror(out_path);
+		goto out;
+	}
+	fd = -1;
+	err = 0;
+
+out:
+	if(fd >= 0)
+		close(fd);
+	if(err && !rom_path)
+		remove("gbfs.$$$");
+	return err;
+}
 
-	outfile = fopen("gbfs.$$$", "wb+");
 
-	if(!outfile) {
-		perror("could not open temporary file gbfs.$$$ for writing");
+/*---------------------------------------------------------------------------------
+	write_elf()
+	Wraps the finished archive in gbfs.$$$ in an object file called
+	archive, then removes gbfs.$$$.  Returns 0 for success or nonzero
+	for failure.
+---------------------------------------------------------------------------------*/
+static int write_elf(const char *archive, const char *section, unsigned long align,
+                     const char *symbol) {
+//---------------------------------------------------------------------------------
+	MAPPED_FILE mf;
+	FILE *objfile;
+
+	if(map_file(&mf, "gbfs.$$$")) {
+		perror("could not read back gbfs.$$$");
 		return 1;
 	}
 
-	fseek(outfile, header.total_len, SEEK_SET);
+	objfile = fopen(archive, "wb");
+	if(!objfile) {
+		fputs("could not open ", stderr);
+		perror(archive);
+		fputs("leaving finished archive in gbfs.$$$\n", stderr);
+		unmap_file(&mf);
+		return 1;
+	}
 
-	while(arg < argc) {
+	if(elfobj_write(objfile, mf.data, mf.len, section, align, symbol)
+	   || fclose(objfile)) {
+		fputs("could not write ", stderr);
+		perror(archive);
+		unmap_file(&mf);
+		return 1;
+	}
 
-		FILE *infile;
-		unsigned long flen;
+	unmap_file(&mf);
+	remove("gbfs.$$$");
+	return 0;
+}
 
-		infile = fopen(argv[arg], "rb");
 
-		if(!infile) {
-			fprintf(stderr, "could not open %s: %s", argv[arg], strerror(errno));
-			fclose(outfile);
-			remove("gbfs.$$$");
-			free(entries);
-			return -1;
+//---------------------------------------------------------------------------------
+int main(int argc, char **argv) {
+//---------------------------------------------------------------------------------
+	int arg, err = 1;
+	unsigned int n_entries = 0, inputs_cap = 0;
+	const char *archive;
+	int elf = 0, c;
+	const char *section = ELFOBJ_DEFAULT_SECTION;
+	unsigned long align = ELFOBJ_DEFAULT_ALIGN;
+	const char *symbol = NULL;
+	char symbuf[256];
+	unsigned int jobs = parallel_default_jobs();
+	int dedup = 0;
+	unsigned int compress = 0;
+	int vram = 0, keep_smaller = 0;
+	int compressed = 0, index = 0, dir_at_end = 0;
+	GBFS_EXT_OUT exts[MAX_EXTS];
+	unsigned int n_exts = 0;
+	unsigned long data_align = 16, max_align, data_end;
+	int update = 0, compact = 0;
+	char **deletes = malloc(argc * sizeof(*deletes));
+	unsigned int n_deletes = 0;
+	const char *order_path = NULL, *list_path = NULL, *tar_path = NULL;
+	const char *rom_path = NULL;
+	ROM_SPACE space;
+	unsigned int *order = NULL;
+	GBFS_INPUT *inputs = NULL;
+	unsigned char *dir = NULL;
+	unsigned long dir_len, dir_off;
+
+	while((c = getopt_long(argc, argv, "hdiuD:f:j:z:a:o:", long_options, NULL)) != -1) {
+		switch(c) {
+		case 'f':
+			list_path = optarg;
+			break;
+		case 'T':
+			tar_path = optarg;
+			break;
+		case 'u':
+			update = 1;
+			break;
+		case 'D':
+			deletes[n_deletes++] = optarg;
+			update = 1;
+			break;
+		case 'c':
+			compact = update = 1;
+			break;
+		case 'j':
+			jobs = strtoul(optarg, NULL, 0);
+			if(jobs < 1) {
+				fprintf(stderr, "invalid job count %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'd':
+			dedup = 1;
+			break;
+		case 'z':
+			if(!strcmp(optarg, "lz10"))
+				compress = LZ10_TYPE;
+			else if(!strcmp(optarg, "lz11"))
+				compress = LZ11_TYPE;
+			else if(!strcmp(optarg, "fast"))
+				compress = LZFAST_TYPE;
+			else {
+				fprintf(stderr, "unknown compression %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'v':
+			vram = 1;
+			break;
+		case 'A':
+			keep_smaller = 1;
+			break;
+		case 'e':
+			elf = 1;
+			break;
+		case 's':
+			section = optarg;
+			break;
+		case 'a':
+			data_align = strtoul(optarg, NULL, 0);
+			if(!valid_data_align(data_align)) {
+				fprintf(stderr, "invalid data alignment %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'o':
+			order_path = optarg;
+			break;
+		case 'i':
+			index = 1;
+			break;
+		case 'E':
+			dir_at_end = 1;
+			break;
+		case 'R':
+			rom_path = optarg;
+			break;
+		case 'l':
+			align = strtoul(optarg, NULL, 0);
+			if(!elfobj_valid_align(align)) {
+				fprintf(stderr, "invalid alignment %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'n':
+			symbol = optarg;
+			break;
+		default:
+			fputs(help_text, stderr);
+			return 1;
 		}
+	}
+
+	if(!deletes) {
+		perror("could not allocate memory");
+		return 1;
+	}
+
+	if(argc - optind < (list_path || tar_path || update ? 1 : 2)) {
+		fputs(help_text, stderr);
+		goto out;
+	}
 
-		/* get current file offset */
-		entries[n_entries].data_offset = ftell(outfile);
+	archive = argv[optind];
+	arg = optind + 1;
 
-		/* copy the file into the data area */
-		flen = fcopy(outfile, infile);
-		entries[n_entries].len = flen;
+	if(list_path && tar_path && !strcmp(list_path, "-") && !strcmp(tar_path, "-")) {
+		fputs("--files-from and --from-tar can't both read standard input\n", stderr);
+		goto out;
+	}
 
-		/* copy name */
-		strncpy(	entries[n_entries].name,
-					basename(argv[arg]),
-					sizeof(entries[n_entries].name));
+	if(update && (elf || dedup || order_path)) {
+		fputs("--elf, --dedup and --order can't be used when updating an archive\n", stderr);
+		goto out;
+	}
 
-		/* diagnostic */
-		{
-			char nameout[32] = {0};
+	if(rom_path && (update || elf)) {
+		fputs("--rom can't be used with --elf or when updating an archive\n", stderr);
+		goto out;
+	}
 
-			strncpy(nameout, entries[n_entries].name, sizeof(entries[n_entries].name));
-			printf("%10lu %s\n", flen, nameout);
-		}
+	/* find the space before doing any work, and write nothing to
+	   the ROM unless the finished archive fits it */
+	if(rom_path && find_rom_space(rom_path, archive, &space))
+		goto out;
 
-		/* pad file with 0's to para boundary */
+	if(keep_smaller && !compress)
+		compress = LZ10_TYPE;
 
-		while(ftell(outfile) & 0x000f) {
-			fputc(0, outfile);
+	if(elf && !symbol) {
+		if(elfobj_symbol_from_path(symbuf, sizeof(symbuf), archive)) {
+			fprintf(stderr, "--symbol is required for %s\n", archive);
+			goto out;
 		}
+		symbol = symbuf;
+	}
+
+	name_slots = calloc(NAME_SLOTS, sizeof(*name_slots));
+	if(!name_slots) {
+		perror("could not allocate memory for directory");
+		goto out;
+	}
+
+ 	memcpy(header.magic, GBFS_magic, sizeof(header.magic));
+
+	/* measure every input up front so that each file's place in the
+	   archive is known before any data is copied */
+	for(; arg < argc; arg++) {
+		if(add_input(&inputs, &n_entries, &inputs_cap, argv[arg], NULL, NULL,
+		              NULL, 0, data_align))
+			break;
+	}
+
+	if(arg < argc
+	   || (list_path && read_file_list(list_path, &inputs, &n_entries, &inputs_cap, data_align))
+	   || (tar_path && read_tar(tar_path, &inputs, &n_entries, &inputs_cap, data_align)))
+		goto out;
+
+	free(name_slots);
+	name_slots = NULL;
+
+	/* the data follows the header, or the directory if that comes first */
+	header.total_len = 32 + (dir_at_end ? 0 : n_entries * sizeof(GBFS_ENTRY));
+
+	order = malloc((n_entries ? n_entries : 1) * sizeof(*order));
+	if(!order) {
+		perror("could not allocate memory for directory");
+		goto out;
+	}
+
+	/* store each distinct blob once */
+	if(dedup) {
+		unsigned int n_dups;
+		long saved = find_duplicates(inputs, n_entries, jobs, &n_dups);
+
+		if(saved < 0)
+			goto out;
+
+		printf("%u duplicate objects, %ld bytes saved\n", n_dups, saved);
+	}
 
-		// close the current input file
-		fclose(infile);
+	/* compress each distinct blob concurrently */
+	if(compress) {
+		PACK_CTX pack;
+		unsigned int i, n_packed = 0;
+		long saved = 0;
 
-		/* next file please */
-		n_entries++;
-		arg++;
+		pack.inputs = inputs;
+		pack.type = compress;
+		pack.vram = vram;
+		pack.keep_smaller = keep_smaller;
+
+		if(parallel_for(n_entries, jobs, pack_file, &pack))
+			goto out;
+
+		for(i = 0; i < n_entries; i++) {
+			const GBFS_INPUT *rep = &inputs[inputs[i].dup_of];
+
+			inputs[i].type = rep->type;
+			if(rep->packed)
+				entries[i].len = rep->packed_len;
+
+			if(inputs[i].dup_of == i && rep->packed) {
+				n_packed++;
+				saved += (long)inputs[i].len - (long)inputs[i].packed_len;
+			}
+		}
+
+		printf("%u objects compressed, %ld bytes saved\n", n_packed, saved);
 	}
 
-	header.total_len = ftell(outfile);
-	rewind(outfile);
+	/* change the existing archive instead of writing a new one */
+	if(update) {
+		err = update_archive(archive, inputs, n_entries, deletes, n_deletes,
+		                     jobs, data_align, index, compact, dir_at_end);
+		goto out;
+	}
 
 	/* sort directory by name */
-	qsort(entries, n_entries, sizeof(entries[0]), namecmp);
+	{
+		unsigned int i;
+
+		for(i = 0; i < n_entries; i++)
+			order[i] = i;
+		cmp_entries = entries;
+		qsort(order, n_entries, sizeof(*order), entcmp);
+	}
 
-	/* write header */
-	fwrite(GBFS_magic, 16, 1, outfile);
-	fputi32(header.total_len, outfile);
-	fputi16(header.dir_off, outfile);
-	fputi16(n_entries, outfile);
+	data_end = layout_data(inputs, entries, order, n_entries,
+	                       header.total_len, order_path);
 
+	/* total_len is 32 bits, and the extension blocks come after the data */
+	if(data_end > 0xFFFFFFFFUL - 0x40000 - 33UL * n_entries) {
+		fputs("the files are too large for one GBFS archive\n", stderr);
+		data_end = 0;
+	}
 
-	/* write directory */
-	fseek(outfile, header.dir_off, SEEK_SET);
+	if(!data_end)
+		goto out;
+	header.total_len = data_end;
 
 	{
 		unsigned int i;
 
+		max_align = 16;
 		for(i = 0; i < n_entries; i++) {
-			fwrite(entries[i].name, sizeof(entries[i].name), 1, outfile);
-			fputi32(entries[i].len, outfile);
-			fputi32(entries[i].data_offset, outfile);
+			if(inputs[i].type)
+				compressed = 1;
+			if(inputs[i].align > max_align)
+				max_align = inputs[i].align;
 		}
 	}
 
-	free(entries);
-	fclose(outfile);
+	/* offsets are only as aligned as the archive itself */
+	if(elf && align < max_align)
+		align = max_align;
 
-	remove(argv[1]);  /* some systems don't auto-remove the rename target */
+	/* build header and directory */
+	dir_off = dir_at_end ? header.total_len : 32;
+	if(dir_at_end)
+		header.total_len += n_entries * sizeof(GBFS_ENTRY);
+	dir_len = 32 + n_entries * sizeof(GBFS_ENTRY);
+	dir = calloc(1, dir_len);
 
-	if(rename("gbfs.$$$", argv[1])) {
-		fputs("could not rename gbfs.$$$ to ", stderr);
-		perror(argv[1]);
-		fputs("leaving finished archive in gbfs.$$$\n", stderr);
+	if(!dir) {
+		perror("could not allocate memory for directory");
+		goto out;
 	}
 
-	return 0;
+	memcpy(dir, GBFS_magic, 16);
+
+	{
+		unsigned int i;
+
+		for(i = 0; i < n_entries; i++) {
+			unsigned char *p = dir + 32 + i * sizeof(GBFS_ENTRY);
+			const GBFS_ENTRY *e = &entries[order[i]];
+
+			memcpy(p, e->name, sizeof(e->name));
+			puti32(p + 24, e->len);
+			puti32(p + 28, e->data_offset);
+		}
+	}
+
+	/* compression table, in directory order */
+	if(compressed) {
+		unsigned int i;
+
+		exts[n_exts].tag = GBFS_EXT_COMPRESSION;
+		exts[n_exts].len = n_entries;
+		exts[n_exts].data = malloc(n_entries);
+		if(!exts[n_exts].data) {
+			perror("could not allocate memory for compression table");
+			goto out;
+		}
+		for(i = 0; i < n_entries; i++)
+			exts[n_exts].data[i] = inputs[order[i]].type;
+		n_exts++;
+	}
+
+	if(index) {
+		exts[n_exts].tag = GBFS_EXT_HASH_INDEX;
+		exts[n_exts].data = build_index(dir + 32, n_entries, &exts[n_exts].len);
+		if(!exts[n_exts].data)
+			goto out;
+		n_exts++;
+	}
+
+	if(set_dir_location(dir, dir_off, n_entries, exts, &n_exts))
+		goto out;
+
+	/* extension blocks follow the data */
+	if(n_exts) {
+		unsigned long off = header.total_len;
+		unsigned int i;
+
+		for(i = 0; i < n_exts; i++) {
+			exts[i].offset = off;
+			off = (off + sizeof(GBFS_EXT) + exts[i].len + 3) & ~3UL;
+		}
+		header.total_len = (off + 0x000f) & ~0x000fUL;
+		puti32(dir + 24, exts[0].offset);
+	}
+
+	puti32(dir + 16, header.total_len);
+
+	if(write_archive(archive, rom_path, &space, max_align, inputs, n_entries,
+	                 dir, dir_len, dir_off, exts, n_exts, jobs))
+		goto out;
+
+	if(elf) {
+		/* wrap the finished archive in an object file */
+		err = write_elf(archive, section, align, symbol);
+		goto out;
+	}
+
+	if(rom_path) {
+		printf("%lu of %lu bytes of GBFS_SPACE %s used\n",
+		       (unsigned long)header.total_len, (unsigned long)space.size, archive);
+	} else {
+		remove(archive);  /* some systems don't auto-remove the rename target */
+
+		if(rename("gbfs.$$$", archive)) {
+			fputs("could not rename gbfs.$$$ to ", stderr);
+			perror(archive);
+			fputs("leaving finished archive in gbfs.$$$\n", stderr);
+		}
+	}
+	err = 0;
+
+out:
+	free_exts(exts, n_exts);
+	free(dir);
+	free(order);
+	free(name_slots);
+	free(entries);
+	free_inputs(inputs, n_entries);
+	free(deletes);
+	return err;
 }
 
 /* The behavior of this program with respect to ordering of files
 
 This information is subject to change.
 
-Currently, the app writes the objects' data in order of appearance
-on the command line, but it writes the directory in ABC order as
-required by the format spec.
+Currently, the app writes the objects' data in the order given by
+the --order file, then in order of appearance on the command line,
+except that small objects may be moved into padding left by larger
+alignments.  It writes the directory in ABC order as required by
+the format spec.
 
 */
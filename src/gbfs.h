@@ -52,7 +52,8 @@ typedef struct GBFS_FILE
   u32  total_len;    /* total length of archive */
   u16  dir_off;      /* offset in bytes to directory */
   u16  dir_nmemb;    /* number of files */
-  char reserved[8];  /* for future use */
+  char reserved[8];  /* bytes 0-3: offset of first GBFS_EXT, or 0;
+                        byte 4: GBFS_FLAG_* bits */
 } GBFS_FILE;
 
 typedef struct GBFS_ENTRY
@@ -62,6 +63,42 @@ typedef struct GBFS_ENTRY
   u32  data_offset;  /* in bytes from beginning of file */
 } GBFS_ENTRY;
 
+/* Extension blocks
+
+If the first four bytes of reserved[] are nonzero, they hold the
+offset (little-endian, from the beginning of the file) of a chain of
+extension blocks.  Each block is a GBFS_EXT header followed by len
+bytes of payload; next is the offset of the following block, or 0.
+Blocks start on 4-byte boundaries within total_len.  Readers skip
+blocks whose tag they don't recognize.
+
+"CMPR"  one byte per directory entry, in directory order: 0 if the
+        object is stored as-is, or else the type byte of the GBA
+        BIOS-style header its data starts with (0x10 LZ77, 0x11 LZ11,
+        0x70 fast LZ).  len in the directory is then the compressed
+        length; the unpacked length is in the data's header.
+
+"DIR2"  two 32-bit little-endian words: the offset of the directory
+        and the number of entries in it.  Present in version 2
+        archives, whose reserved[4] has GBFS_FLAG_DIR2 set; readers
+        must then take the directory from this block.  When the
+        directory also fits the 16-bit dir_off and dir_nmemb, they
+        point to it as well, so older readers see every object;
+        otherwise they describe an empty directory.
+*/
+typedef struct GBFS_EXT
+{
+  char tag[4];       /* block type */
+  u32  len;          /* length of payload in bytes */
+  u32  next;         /* offset of next block, or 0 */
+} GBFS_EXT;
+
+#define GBFS_EXT_COMPRESSION "CMPR"
+#define GBFS_EXT_DIR2        "DIR2"
+
+/* bits of reserved[4] */
+#define GBFS_FLAG_DIR2       0x01  /* directory is given by a "DIR2" block */
+
 
 const GBFS_FILE *find_first_gbfs_file(const void *start);
 const void *skip_gbfs_file(const GBFS_FILE *file);
@@ -0,0 +1,457 @@
+/* gbfs_host.c
+   the gbfs.h reader API for the host, over mapped files
+
+This file is part of gba-tools.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to
+  Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+  Boston, MA  02111-1307, USA.
+GNU licenses can be viewed online at http://www.gnu.org/copyleft/
+
+*/
+
+#include <pthread.h>
+#include <string.h>
+
+#include "gbfs_host.h"
+#include "gbfshash.h"
+#include "match16.h"
+
+/* the mapped files that pointers passed to the gbfs.h functions may
+   point into, like the cartridge address space on the GBA.  Readers
+   run on parallel_for() workers while other threads open and close
+   files, so the table is only touched with regions_lock held. */
+#define MAX_REGIONS 16
+
+typedef struct REGION
+{
+  const unsigned char *start, *end;
+} REGION;
+
+static REGION regions[MAX_REGIONS];
+static pthread_mutex_t regions_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char GBFS_magic[] = "PinEightGBFS\r\n\032\n";
+
+
+/* geti16() ****************************
+   read a 16-bit integer in intel format
+*/
+static unsigned int geti16(const unsigned char *src)
+{
+  return src[0] | (src[1] << 8);
+}
+
+
+/* geti32() ****************************
+   read a 32-bit integer in intel format
+*/
+static u32 geti32(const unsigned char *src)
+{
+  return (u32)src[0] | ((u32)src[1] << 8) |
+         ((u32)src[2] << 16) | ((u32)src[3] << 24);
+}
+
+
+/* find_region() ***********************
+   Copies the registered mapping containing p to out.  Returns 0, or
+   -1 if p isn't in one.
+*/
+static int find_region(const void *p, REGION *out)
+{
+  const unsigned char *c = p;
+  unsigned int i;
+  int err = -1;
+
+  pthread_mutex_lock(&regions_lock);
+  for(i = 0; i < MAX_REGIONS; i++)
+    if(regions[i].start && c >= regions[i].start && c < regions[i].end)
+    {
+      *out = regions[i];
+      err = 0;
+      break;
+    }
+  pthread_mutex_unlock(&regions_lock);
+
+  return err;
+}
+
+
+/* dir_location() **********************
+   Finds the directory of the archive at p: in the "DIR2" block if
+   the header flags one, or else in the header.  Returns 0, or -1 if
+   a version 2 archive has no usable "DIR2" block.
+*/
+static int dir_location(const unsigned char *p, u32 *dir_off, u32 *dir_nmemb)
+{
+  if(p[28] & GBFS_FLAG_DIR2)
+  {
+    u32 len;
+    const unsigned char *d2 = gbfs_get_ext((const GBFS_FILE *)p,
+                                           GBFS_EXT_DIR2, &len);
+
+    if(!d2 || len < 8)
+      return -1;
+
+    *dir_off = geti32(d2);
+    *dir_nmemb = geti32(d2 + 4);
+    return 0;
+  }
+
+  *dir_off = geti16(p + 20);
+  *dir_nmemb = geti16(p + 22);
+  return 0;
+}
+
+
+/* valid_archive() *********************
+   Returns nonzero if an archive with a sane header and directory
+   starts at p and fits before end.
+*/
+static int valid_archive(const unsigned char *p, const unsigned char *end)
+{
+  size_t avail = end - p;
+  u32 total_len, dir_off, dir_nmemb;
+
+  if(avail < 32 || memcmp(p, GBFS_magic, 16))
+    return 0;
+
+  total_len = geti32(p + 16);
+  if(total_len > avail || dir_location(p, &dir_off, &dir_nmemb))
+    return 0;
+
+  return dir_off >= 32 && dir_off <= total_len
+      && dir_nmemb <= (total_len - dir_off) / 32;
+}
+
+
+/* scan_magic() ************************
+   Returns the first of p, p + 256, p + 512, ... that holds the GBFS
+   magic with at least 32 bytes before end, or NULL.  Four candidates
+   are tested per pass so their loads overlap.
+*/
+static const unsigned char *scan_magic(const unsigned char *p,
+                                       const unsigned char *end)
+{
+  size_t n;
+
+  if(p >= end || (size_t)(end - p) < 32)
+    return NULL;
+
+  /* candidates with room for a header */
+  n = ((size_t)(end - p) - 32) / 256 + 1;
+
+  for(; n >= 4; n -= 4, p += 1024)
+  {
+    int hit = match16(p, GBFS_magic) | match16(p + 256, GBFS_magic)
+            | match16(p + 512, GBFS_magic) | match16(p + 768, GBFS_magic);
+
+    if(hit)
+      break;
+  }
+
+  for(; n > 0; n--, p += 256)
+    if(match16(p, GBFS_magic))
+      return p;
+
+  return NULL;
+}
+
+
+/* gbfs_host_open() ********************
+   Maps the file at path and finds the first archive in it.
+   Returns GBFS_HOST_OK, GBFS_HOST_IO_ERROR with errno set, or
+   GBFS_HOST_NOT_GBFS.
+*/
+int gbfs_host_open(GBFS_HOST *gh, const char *path)
+{
+  unsigned int i;
+
+  gh->file = NULL;
+  if(map_file(&gh->map, path))
+    return GBFS_HOST_IO_ERROR;
+
+  pthread_mutex_lock(&regions_lock);
+  for(i = 0; i < MAX_REGIONS && regions[i].start; i++)
+    ;
+
+  if(i == MAX_REGIONS || !gh->map.data)
+  {
+    pthread_mutex_unlock(&regions_lock);
+    unmap_file(&gh->map);
+    return GBFS_HOST_NOT_GBFS;
+  }
+
+  regions[i].start = gh->map.data;
+  regions[i].end = gh->map.data + gh->map.len;
+  pthread_mutex_unlock(&regions_lock);
+
+  gh->file = find_first_gbfs_file(gh->map.data);
+  if(!gh->file)
+  {
+    gbfs_host_close(gh);
+    return GBFS_HOST_NOT_GBFS;
+  }
+
+  return GBFS_HOST_OK;
+}
+
+
+/* gbfs_host_close() *******************
+   Unmaps a file opened with gbfs_host_open().
+*/
+void gbfs_host_close(GBFS_HOST *gh)
+{
+  unsigned int i;
+
+  pthread_mutex_lock(&regions_lock);
+  for(i = 0; i < MAX_REGIONS; i++)
+    if(regions[i].start && regions[i].start == gh->map.data)
+      regions[i].start = regions[i].end = NULL;
+  pthread_mutex_unlock(&regions_lock);
+
+  unmap_file(&gh->map);
+  gh->file = NULL;
+}
+
+
+/* find_first_gbfs_file() **************
+   Finds the first archive at or after start on a 256-byte boundary
+   of its mapping, as GBFS_SPACE and the linker place them.
+*/
+const GBFS_FILE *find_first_gbfs_file(const void *start)
+{
+  const unsigned char *p = start;
+  REGION r;
+  size_t off;
+
+  if(find_region(start, &r))
+    return NULL;
+
+  off = ((p - r.start) + 0xff) & ~(size_t)0xff;
+  for(p = scan_magic(r.start + off, r.end); p;
+      p = scan_magic(p + 256, r.end))
+    if(valid_archive(p, r.end))
+      return (const GBFS_FILE *)p;
+
+  return NULL;
+}
+
+
+/* skip_gbfs_file() ********************
+   Returns a pointer just past the end of an archive, from which to
+   search for the next one.
+*/
+const void *skip_gbfs_file(const GBFS_FILE *file)
+{
+  return (const char *)file + gbfs_total_len(file);
+}
+
+
+/* gbfs_total_len() ********************
+   Returns the length of an archive.
+*/
+u32 gbfs_total_len(const GBFS_FILE *file)
+{
+  return geti32((const unsigned char *)file + 16);
+}
+
+
+/* gbfs_count_objs() *******************
+   Returns the number of objects in an archive.
+*/
+size_t gbfs_count_objs(const GBFS_FILE *file)
+{
+  size_t n = 0;
+
+  gbfs_get_dir(file, &n);
+  return n;
+}
+
+
+/* gbfs_get_dir() **********************
+   Returns a pointer to the directory of an archive, an array of
+   32-byte entries laid out as GBFS_ENTRY, and stores their number,
+   wherever the header or a "DIR2" block puts it.
+*/
+const void *gbfs_get_dir(const GBFS_FILE *file, size_t *nmemb)
+{
+  const unsigned char *base = (const unsigned char *)file;
+  u32 dir_off, dir_nmemb;
+
+  if(!file || dir_location(base, &dir_off, &dir_nmemb))
+  {
+    if(nmemb)
+      *nmemb = 0;
+    return NULL;
+  }
+
+  if(nmemb)
+    *nmemb = dir_nmemb;
+  return base + dir_off;
+}
+
+
+/* entry_data() ************************
+   Returns a pointer to the data of directory entry n and stores its
+   length, or NULL if it does not lie within the archive.
+*/
+static const void *entry_data(const GBFS_FILE *file, size_t n, u32 *len)
+{
+  const unsigned char *base = (const unsigned char *)file;
+  const unsigned char *e = (const unsigned char *)gbfs_get_dir(file, NULL)
+                           + 32 * n;
+  u32 total_len = gbfs_total_len(file);
+  u32 obj_len = geti32(e + 24), obj_off = geti32(e + 28);
+
+  if(obj_off > total_len || obj_len > total_len - obj_off)
+    return NULL;
+
+  if(len)
+    *len = obj_len;
+  return base + obj_off;
+}
+
+
+/* gbfs_find_obj() *********************
+   Finds an object by name, through the hashed index if the archive
+   has one and by binary search of the directory otherwise, so only
+   a few directory entries are read.  Returns its directory index, or
+   -1 if there is none.
+*/
+long gbfs_find_obj(const GBFS_FILE *file, const char *name)
+{
+  size_t lo = 0, hi;
+  const unsigned char *dir = gbfs_get_dir(file, &hi);
+  const void *index;
+  char key[24];
+  u32 index_len;
+
+  if(!dir)
+    return -1;
+
+  index = gbfs_get_ext(file, GBFS_EXT_HASH_INDEX, &index_len);
+  if(index)
+    return gbfs_hash_lookup(index, index_len, dir, hi, name);
+
+  gbfs_put_name(key, name);
+  while(lo < hi)
+  {
+    size_t mid = lo + (hi - lo) / 2;
+    int c = memcmp(dir + 32 * mid, key, sizeof(key));
+
+    if(c == 0)
+      return mid;
+    if(c < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  return -1;
+}
+
+
+/* gbfs_get_obj() **********************
+   Finds an object by name.  Returns a pointer to its data and stores
+   its length, or returns NULL.
+*/
+const void *gbfs_get_obj(const GBFS_FILE *file, const char *name, u32 *len)
+{
+  long n = gbfs_find_obj(file, name);
+
+  return n < 0 ? NULL : entry_data(file, n, len);
+}
+
+
+/* gbfs_get_nth_obj() ******************
+   Returns a pointer to the data of the nth object in directory order
+   and stores its length and name, or returns NULL.  name, if not
+   NULL, must have room for 25 chars.
+*/
+const void *gbfs_get_nth_obj(const GBFS_FILE *file, size_t n, char *name,
+                             u32 *len)
+{
+  size_t nmemb;
+  const unsigned char *dir = gbfs_get_dir(file, &nmemb);
+
+  if(n >= nmemb)
+    return NULL;
+
+  if(name)
+  {
+    memcpy(name, dir + 32 * n, 24);
+    name[24] = 0;
+  }
+
+  return entry_data(file, n, len);
+}
+
+
+/* gbfs_copy_obj() *********************
+   Copies an object by name to dst.  Returns dst, or NULL if there is
+   no such object.
+*/
+void *gbfs_copy_obj(void *dst, const GBFS_FILE *file, const char *name)
+{
+  u32 len;
+  const void *src = gbfs_get_obj(file, name, &len);
+
+  if(!src)
+    return NULL;
+
+  memcpy(dst, src, len);
+  return dst;
+}
+
+
+/* gbfs_get_ext() **********************
+   Finds the payload of the extension block with the given tag (see
+   gbfs.h) and stores its length, or returns NULL.
+*/
+const void *gbfs_get_ext(const GBFS_FILE *file, const char *tag, u32 *len)
+{
+  const unsigned char *base = (const unsigned char *)file;
+  u32 total_len, next, hops;
+
+  if(!file)
+    return NULL;
+
+  total_len = gbfs_total_len(file);
+  next = geti32(base + 24);
+
+  /* give up on chains that leave the archive or loop */
+  for(hops = 0; next && hops < 64; hops++)
+  {
+    const unsigned char *ext = base + next;
+    u32 ext_len;
+
+    if((next & 3) || total_len < 12 || next > total_len - 12)
+      break;
+
+    ext_len = geti32(ext + 4);
+    if(ext_len > total_len - next - 12)
+      break;
+
+    if(!memcmp(ext, tag, 4))
+    {
+      if(len)
+        *len = ext_len;
+      return ext + 12;
+    }
+    next = geti32(ext + 8);
+  }
+
+  return NULL;
+}
@@ -0,0 +1,79 @@
+/* gbfs_host.h
+   the gbfs.h reader API for the host, over mapped files
+
+This file is part of gba-tools.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to
+  Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+  Boston, MA  02111-1307, USA.
+GNU licenses can be viewed online at http://www.gnu.org/copyleft/
+
+*/
+
+#ifndef INCLUDE_GBFS_HOST_H
+#define INCLUDE_GBFS_HOST_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* gbfs.h wants these; they must be exactly 16 and 32 bits wide */
+typedef uint16_t u16;
+typedef uint32_t u32;
+
+#include "gbfs.h"
+#include "mapfile.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* On the GBA, the functions in gbfs.h search and read the cartridge
+   directly.  On the host, the equivalent of the cartridge is a file
+   opened with gbfs_host_open(): the functions then work on pointers
+   into its mapping, without copying, and never read past its end.
+   Headers and directory entries are read byte by byte, so this works
+   on hosts of either byte order, but the GBFS_FILE and GBFS_ENTRY
+   fields themselves are little-endian.
+
+   A ROM image may hold several archives, each starting on a 256-byte
+   boundary; visit them all with
+     for(f = gh.file; f; f = find_first_gbfs_file(skip_gbfs_file(f)))
+   as a GBA program would.
+
+   Any thread may open and close files and read archives at once, but
+   a file must stay open while another thread reads from it. */
+
+typedef struct GBFS_HOST
+{
+  MAPPED_FILE map;
+  const GBFS_FILE *file;  /* first archive in the file */
+} GBFS_HOST;
+
+/* gbfs_host_open() return values */
+#define GBFS_HOST_OK          0
+#define GBFS_HOST_IO_ERROR   -1  /* errno is set */
+#define GBFS_HOST_NOT_GBFS    1  /* no valid archive in the file */
+
+int gbfs_host_open(GBFS_HOST *gh, const char *path);
+void gbfs_host_close(GBFS_HOST *gh);
+
+u32 gbfs_total_len(const GBFS_FILE *file);
+const void *gbfs_get_dir(const GBFS_FILE *file, size_t *nmemb);
+long gbfs_find_obj(const GBFS_FILE *file, const char *name);
+const void *gbfs_get_ext(const GBFS_FILE *file, const char *tag, u32 *len);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
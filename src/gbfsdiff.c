@@ -0,0 +1,819 @@
+/* gbfsdiff.c
+   make and apply binary patches between GBFS archives or ROM builds
+
+This file is part of gba-tools.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to
+  Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+  Boston, MA  02111-1307, USA.
+GNU licenses can be viewed online at http://www.gnu.org/copyleft/
+
+*/
+
+/* Patch format (all integers little-endian):
+
+     "GBFSDIF1"        magic
+     u32 old_len       length of the file the patch applies to
+     u32 old_crc       its CRC-32
+     u32 new_len       length of the file the patch makes
+     u32 new_crc       its CRC-32
+     ops...
+
+   Each op starts with a LEB128 varint v.  v == 0 ends the patch.
+   Otherwise the op covers v >> 1 bytes of the new file: if v is odd
+   they are copied from the old file at the previous copy's end plus
+   a zigzag-coded LEB128 displacement that follows, and if v is even
+   they follow literally. */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "gbfs_host.h"
+#include "hash.h"
+
+static const char help_text[] =
+"makes or applies a binary patch between two GBFS archives or ROMs\n"
+"syntax: gbfsdiff [OPTIONS] OLD NEW PATCH\n"
+"        gbfsdiff --apply OLD PATCH NEW\n"
+"  -a, --apply     apply PATCH to OLD, writing NEW\n"
+"  -q, --quiet     don't print statistics\n";
+
+static const struct option long_options[] = {
+  { "apply", no_argument, NULL, 'a' },
+  { "quiet", no_argument, NULL, 'q' },
+  { "help",  no_argument, NULL, 'h' },
+  { NULL,    0,           NULL,  0  },
+};
+
+static const char patch_magic[8] = "GBFSDIF1";
+
+#define PATCH_HEADER_LEN 24
+
+/* bytes per indexed block of the old file; shorter matches are only
+   found next to other matches or at objects matched by name */
+#define BLOCK_LEN   32
+
+/* shortest match worth a copy op */
+#define MIN_MATCH   8
+
+/* multiplier of the rolling hash */
+#define ROLL_MULT   0x01000193u
+
+/* a place where the new file's data probably came from the old */
+typedef struct HINT
+{
+  size_t new_off, old_off;
+} HINT;
+
+/* one slot of the block index, kept together so that a probe
+   touches one cache line */
+typedef struct BLOCK_SLOT
+{
+  uint32_t hash;
+  uint32_t offset;  /* offset + 1, 0 if empty */
+} BLOCK_SLOT;
+
+/* the old file's blocks by rolling hash, with a bitmap of the
+   hashes present that is small enough to stay in cache and turns
+   away most lookups of new data */
+typedef struct BLOCK_INDEX
+{
+  BLOCK_SLOT *slots;
+  size_t mask;
+  unsigned char *filter;
+} BLOCK_INDEX;
+
+#define FILTER_BITS 24
+
+/* a growing output buffer */
+typedef struct OUTBUF
+{
+  unsigned char *data;
+  size_t len, cap;
+} OUTBUF;
+
+typedef struct DIFF_STATS
+{
+  size_t copied, added, n_copies, n_adds;
+} DIFF_STATS;
+
+
+/* put_bytes() *************************
+   append bytes to an output buffer.  Returns 0 or -1 if out of memory.
+*/
+static int put_bytes(OUTBUF *ob, const void *src, size_t len)
+{
+  if(ob->len + len > ob->cap)
+  {
+    size_t cap = ob->cap ? ob->cap : 4096;
+    unsigned char *data;
+
+    while(cap < ob->len + len)
+      cap *= 2;
+    data = realloc(ob->data, cap);
+    if(!data)
+      return -1;
+    ob->data = data;
+    ob->cap = cap;
+  }
+
+  if(len)
+    memcpy(ob->data + ob->len, src, len);
+  ob->len += len;
+  return 0;
+}
+
+
+/* put_varint() ************************
+   append an unsigned LEB128 number
+*/
+static int put_varint(OUTBUF *ob, uint64_t v)
+{
+  unsigned char buf[10];
+  size_t n = 0;
+
+  do
+  {
+    buf[n] = v & 0x7f;
+    v >>= 7;
+    if(v)
+      buf[n] |= 0x80;
+    n++;
+  } while(v);
+
+  return put_bytes(ob, buf, n);
+}
+
+
+/* get_varint() ************************
+   read an unsigned LEB128 number.  Returns 0 or -1 if it runs off
+   the end or is too long.
+*/
+static int get_varint(const unsigned char **p, const unsigned char *end,
+                      uint64_t *v)
+{
+  unsigned int shift;
+
+  *v = 0;
+  for(shift = 0; shift < 64; shift += 7)
+  {
+    unsigned char c;
+
+    if(*p >= end)
+      return -1;
+    c = *(*p)++;
+    *v |= (uint64_t)(c & 0x7f) << shift;
+    if(!(c & 0x80))
+      return 0;
+  }
+
+  return -1;
+}
+
+
+/* geti32() ****************************
+   read a 32-bit integer in intel format
+*/
+static uint32_t geti32(const unsigned char *src)
+{
+  return (uint32_t)src[0] | ((uint32_t)src[1] << 8) |
+         ((uint32_t)src[2] << 16) | ((uint32_t)src[3] << 24);
+}
+
+
+/* puti32() ****************************
+   store a 32-bit integer in intel format
+*/
+static void puti32(unsigned char *dst, uint32_t in)
+{
+  dst[0] = in;
+  dst[1] = in >> 8;
+  dst[2] = in >> 16;
+  dst[3] = in >> 24;
+}
+
+
+/* open_input() ************************
+   map a file and find any archives in it.  A file with no archive
+   is still diffed, just without name hints.  Returns 0 or nonzero
+   after printing an error.
+*/
+static int open_input(GBFS_HOST *gh, const char *path)
+{
+  switch(gbfs_host_open(gh, path))
+  {
+  case GBFS_HOST_OK:
+    return 0;
+  case GBFS_HOST_NOT_GBFS:
+    if(!map_file(&gh->map, path))
+    {
+      gh->file = NULL;
+      return 0;
+    }
+    break;
+  }
+
+  fputs("could not open ", stderr);
+  perror(path);
+  return -1;
+}
+
+
+/* block_hash() ************************
+   the rolling hash of BLOCK_LEN bytes, computed from scratch
+*/
+static uint32_t block_hash(const unsigned char *p)
+{
+  uint32_t h = 0;
+  unsigned int i;
+
+  for(i = 0; i < BLOCK_LEN; i++)
+    h = h * ROLL_MULT + p[i];
+  return h;
+}
+
+
+/* slot_of() ***************************
+   where a hash starts probing in the block index
+*/
+static size_t slot_of(const BLOCK_INDEX *bi, uint32_t h)
+{
+  return (size_t)((h ^ (h >> 15)) * 0x2C1B3C6Du) & bi->mask;
+}
+
+
+/* filter_bit() ************************
+   which bit of the filter a hash sets
+*/
+static uint32_t filter_bit(uint32_t h)
+{
+  return (h * 0x9E3779B1u) >> (32 - FILTER_BITS);
+}
+
+
+/* build_index() ***********************
+   hash each whole block of the old file.  Where blocks hash alike,
+   only the first is kept, so runs of padding cost one slot.
+   Returns 0 or -1 if out of memory.
+*/
+static int build_index(BLOCK_INDEX *bi, const unsigned char *old,
+                       size_t old_len)
+{
+  size_t n_blocks = old_len / BLOCK_LEN, size = 16, i;
+
+  while(size < 2 * n_blocks)
+    size *= 2;
+
+  bi->mask = size - 1;
+  bi->slots = calloc(size, sizeof(*bi->slots));
+  bi->filter = calloc(1, 1 << (FILTER_BITS - 3));
+  if(!bi->slots || !bi->filter)
+    return -1;
+
+  for(i = 0; i < n_blocks; i++)
+  {
+    uint32_t h = block_hash(old + i * BLOCK_LEN);
+    size_t s;
+
+    for(s = slot_of(bi, h); bi->slots[s].offset; s = (s + 1) & bi->mask)
+      if(bi->slots[s].hash == h)
+        break;
+
+    if(!bi->slots[s].offset)
+    {
+      uint32_t f = filter_bit(h);
+
+      bi->filter[f >> 3] |= 1 << (f & 7);
+      bi->slots[s].hash = h;
+      bi->slots[s].offset = i * BLOCK_LEN + 1;
+    }
+  }
+
+  return 0;
+}
+
+
+/* lookup_block() **********************
+   Returns the offset of an old block with the same contents as the
+   BLOCK_LEN bytes at p, or (size_t)-1.
+*/
+static size_t lookup_block(const BLOCK_INDEX *bi, const unsigned char *old,
+                           const unsigned char *p, uint32_t h)
+{
+  uint32_t f = filter_bit(h);
+  size_t s;
+
+  if(!(bi->filter[f >> 3] & (1 << (f & 7))))
+    return (size_t)-1;
+
+  for(s = slot_of(bi, h); bi->slots[s].offset; s = (s + 1) & bi->mask)
+    if(bi->slots[s].hash == h)
+    {
+      size_t off = bi->slots[s].offset - 1;
+
+      return memcmp(old + off, p, BLOCK_LEN) ? (size_t)-1 : off;
+    }
+
+  return (size_t)-1;
+}
+
+
+/* min_size() **************************
+   the smaller of two sizes
+*/
+static size_t min_size(size_t a, size_t b)
+{
+  return a < b ? a : b;
+}
+
+
+/* match_len() *************************
+   count the bytes that agree from a and b on, up to max
+*/
+static size_t match_len(const unsigned char *a, const unsigned char *b,
+                        size_t max)
+{
+  size_t n = 0;
+
+  /* a word at a time through long matches */
+  while(n + 8 <= max)
+  {
+    uint64_t x, y;
+
+    memcpy(&x, a + n, 8);
+    memcpy(&y, b + n, 8);
+    if(x != y)
+      break;
+    n += 8;
+  }
+
+  while(n < max && a[n] == b[n])
+    n++;
+  return n;
+}
+
+
+/* hintcmp() ***************************
+   orders hints by new offset
+*/
+static int hintcmp(const void *a, const void *b)
+{
+  const HINT *pa = a, *pb = b;
+
+  if(pa->new_off != pb->new_off)
+    return pa->new_off < pb->new_off ? -1 : 1;
+  return 0;
+}
+
+
+/* find_hints() ************************
+   pair each object of the new file's archives with the first object
+   of the same name in the old file's.  The old file is scanned for
+   archives once, up front.  Returns the number of hints, or -1 if
+   out of memory.
+*/
+static long find_hints(const GBFS_HOST *old, const GBFS_HOST *new_,
+                       HINT **out)
+{
+  const GBFS_FILE *nf, *of, **old_files = NULL;
+  size_t n = 0, cap = 0, n_old = 0, old_cap = 0;
+  HINT *hints = NULL;
+
+  for(of = old->file; of; of = find_first_gbfs_file(skip_gbfs_file(of)))
+  {
+    if(n_old == old_cap)
+    {
+      const GBFS_FILE **f;
+
+      old_cap = old_cap ? old_cap * 2 : 8;
+      f = realloc(old_files, old_cap * sizeof(*old_files));
+      if(!f)
+      {
+        free(old_files);
+        return -1;
+      }
+      old_files = f;
+    }
+    old_files[n_old++] = of;
+  }
+
+  for(nf = new_->file; nf; nf = find_first_gbfs_file(skip_gbfs_file(nf)))
+  {
+    size_t n_objs = gbfs_count_objs(nf), i, j;
+
+    for(i = 0; i < n_objs; i++)
+    {
+      char name[25];
+      u32 new_len, old_len;
+      const unsigned char *nd = gbfs_get_nth_obj(nf, i, name, &new_len);
+
+      if(!nd || !new_len)
+        continue;
+
+      for(j = 0; j < n_old; j++)
+      {
+        const unsigned char *od = gbfs_get_obj(old_files[j], name, &old_len);
+
+        if(!od || !old_len)
+          continue;
+
+        if(n == cap)
+        {
+          HINT *h;
+
+          cap = cap ? cap * 2 : 256;
+          h = realloc(hints, cap * sizeof(*hints));
+          if(!h)
+          {
+            free(hints);
+            free(old_files);
+            return -1;
+          }
+          hints = h;
+        }
+
+        hints[n].new_off = nd - new_->map.data;
+        hints[n].old_off = od - old->map.data;
+        n++;
+        break;
+      }
+    }
+  }
+
+  free(old_files);
+  if(n)
+    qsort(hints, n, sizeof(*hints), hintcmp);
+  *out = hints;
+  return n;
+}
+
+
+/* emit_add() **************************
+   append an op with len literal bytes
+*/
+static int emit_add(OUTBUF *ob, DIFF_STATS *st, const unsigned char *src,
+                    size_t len)
+{
+  if(!len)
+    return 0;
+
+  st->added += len;
+  st->n_adds++;
+  return put_varint(ob, (uint64_t)len << 1) || put_bytes(ob, src, len);
+}
+
+
+/* emit_copy() *************************
+   append an op copying len bytes from the old file at off
+*/
+static int emit_copy(OUTBUF *ob, DIFF_STATS *st, size_t *last_end,
+                     size_t off, size_t len)
+{
+  int64_t disp = (int64_t)off - (int64_t)*last_end;
+
+  st->copied += len;
+  st->n_copies++;
+  *last_end = off + len;
+  return put_varint(ob, ((uint64_t)len << 1) | 1)
+      || put_varint(ob, ((uint64_t)disp << 1) ^ (uint64_t)(disp >> 63));
+}
+
+
+/* make_patch() ************************
+   Writes the ops turning old into new.  At each position of the new
+   file, a match is looked for first where the last copy would
+   continue, then at an object of the same name, then through the
+   block index; each is extended as far as the data agrees, so the
+   whole pass is linear in the two files' sizes.
+   Returns 0 or -1 if out of memory.
+*/
+static int make_patch(OUTBUF *ob, DIFF_STATS *st,
+                      const unsigned char *old, size_t old_len,
+                      const unsigned char *new_, size_t new_len,
+                      const BLOCK_INDEX *bi, const HINT *hints,
+                      size_t n_hints)
+{
+  size_t i = 0, add_start = 0, last_end = 0, next_hint = 0;
+  ptrdiff_t delta = 0;  /* old offset minus new offset of the last copy */
+  uint32_t h = 0, out_pow = 1;
+  int have_hash = 0;
+  unsigned int k;
+
+  /* ROLL_MULT ** (BLOCK_LEN - 1), to take the oldest byte out of the hash */
+  for(k = 1; k < BLOCK_LEN; k++)
+    out_pow *= ROLL_MULT;
+
+  while(i + MIN_MATCH <= new_len)
+  {
+    size_t cand = (size_t)-1, len = 0, back;
+
+    /* where the last copy left off, as after a small edit */
+    if((ptrdiff_t)i + delta >= 0 && i + delta + MIN_MATCH <= old_len)
+    {
+      len = match_len(old + i + delta, new_ + i,
+                      min_size(old_len - (i + delta), new_len - i));
+      if(len >= MIN_MATCH)
+        cand = i + delta;
+    }
+
+    /* the old object of the same name */
+    while(next_hint < n_hints && hints[next_hint].new_off < i)
+      next_hint++;
+    if(cand == (size_t)-1 && next_hint < n_hints
+       && hints[next_hint].new_off == i)
+    {
+      size_t o = hints[next_hint].old_off;
+
+      len = match_len(old + o, new_ + i, min_size(old_len - o, new_len - i));
+      if(len >= MIN_MATCH)
+        cand = o;
+    }
+
+    /* anywhere in the old file */
+    if(cand == (size_t)-1 && i + BLOCK_LEN <= new_len)
+    {
+      if(!have_hash)
+      {
+        h = block_hash(new_ + i);
+        have_hash = 1;
+      }
+
+      cand = lookup_block(bi, old, new_ + i, h);
+      if(cand != (size_t)-1)
+        len = BLOCK_LEN + match_len(old + cand + BLOCK_LEN,
+                                    new_ + i + BLOCK_LEN,
+                                    min_size(old_len - cand - BLOCK_LEN,
+                                             new_len - i - BLOCK_LEN));
+    }
+
+    if(cand == (size_t)-1)
+    {
+      /* slide the window one byte */
+      if(have_hash && i + BLOCK_LEN < new_len)
+        h = (h - new_[i] * out_pow) * ROLL_MULT + new_[i + BLOCK_LEN];
+      else
+        have_hash = 0;
+      i++;
+      continue;
+    }
+
+    /* take back literal bytes that the match also covers */
+    for(back = 0; i - back > add_start && cand - back > 0
+        && old[cand - back - 1] == new_[i - back - 1]; back++)
+      ;
+
+    if(emit_add(ob, st, new_ + add_start, i - back - add_start)
+       || emit_copy(ob, st, &last_end, cand - back, len + back))
+      return -1;
+
+    delta = (ptrdiff_t)cand - (ptrdiff_t)i;
+    i += len;
+    add_start = i;
+    have_hash = 0;
+  }
+
+  if(emit_add(ob, st, new_ + add_start, new_len - add_start))
+    return -1;
+  return put_varint(ob, 0);
+}
+
+
+/* write_file() ************************
+   write a buffer to a new file.  Returns 0 or nonzero after printing
+   an error.
+*/
+static int write_file(const char *path, const void *data, size_t len)
+{
+  FILE *fp = fopen(path, "wb");
+
+  if(!fp || (len && fwrite(data, len, 1, fp) != 1) || fclose(fp))
+  {
+    fputs("could not write ", stderr);
+    perror(path);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+/* diff_files() ************************
+   make a patch from old_path to new_path.  Returns the exit status.
+*/
+static int diff_files(const char *old_path, const char *new_path,
+                      const char *patch_path, int quiet)
+{
+  GBFS_HOST old, new_;
+  BLOCK_INDEX bi = { NULL, 0, NULL };
+  OUTBUF ob = { NULL, 0, 0 };
+  DIFF_STATS st = { 0, 0, 0, 0 };
+  HINT *hints = NULL;
+  long n_hints;
+  unsigned char header[PATCH_HEADER_LEN];
+  int err = 1;
+
+  if(open_input(&old, old_path))
+    return 1;
+  if(open_input(&new_, new_path))
+  {
+    gbfs_host_close(&old);
+    return 1;
+  }
+
+  if(old.map.len > 0xFFFFFFFFu || new_.map.len > 0xFFFFFFFFu)
+  {
+    fputs("files over 4 GiB can't be patched\n", stderr);
+    goto out;
+  }
+
+  n_hints = find_hints(&old, &new_, &hints);
+  if(n_hints < 0 || build_index(&bi, old.map.data, old.map.len))
+  {
+    perror("could not allocate memory for the patch");
+    goto out;
+  }
+
+  memcpy(header, patch_magic, 8);
+  puti32(header + 8, old.map.len);
+  puti32(header + 12, hash_crc32(0, old.map.data, old.map.len));
+  puti32(header + 16, new_.map.len);
+  puti32(header + 20, hash_crc32(0, new_.map.data, new_.map.len));
+
+  if(put_bytes(&ob, header, sizeof(header))
+     || make_patch(&ob, &st, old.map.data, old.map.len,
+                   new_.map.data, new_.map.len, &bi, hints, n_hints))
+  {
+    perror("could not allocate memory for the patch");
+    goto out;
+  }
+
+  if(write_file(patch_path, ob.data, ob.len))
+    goto out;
+
+  if(!quiet)
+    printf("%lu bytes copied in %lu runs, %lu bytes added in %lu runs, "
+           "%lu objects matched by name\npatch is %lu bytes\n",
+           (unsigned long)st.copied, (unsigned long)st.n_copies,
+           (unsigned long)st.added, (unsigned long)st.n_adds,
+           (unsigned long)n_hints, (unsigned long)ob.len);
+  err = 0;
+
+out:
+  free(ob.data);
+  free(bi.slots);
+  free(bi.filter);
+  free(hints);
+  gbfs_host_close(&new_);
+  gbfs_host_close(&old);
+  return err;
+}
+
+
+/* apply_patch() ***********************
+   apply the patch at patch_path to old_path, writing new_path.
+   Returns the exit status.
+*/
+static int apply_patch(const char *old_path, const char *patch_path,
+                       const char *new_path)
+{
+  MAPPED_FILE old, patch;
+  const unsigned char *p, *end;
+  unsigned char *out = NULL;
+  size_t new_len, pos = 0, last_end = 0;
+  int err = 1;
+
+  if(map_file(&old, old_path))
+  {
+    fputs("could not open ", stderr);
+    perror(old_path);
+    return 1;
+  }
+  if(map_file(&patch, patch_path))
+  {
+    fputs("could not open ", stderr);
+    perror(patch_path);
+    unmap_file(&old);
+    return 1;
+  }
+
+  p = patch.data;
+  end = p + patch.len;
+  if(patch.len < PATCH_HEADER_LEN || memcmp(p, patch_magic, 8))
+  {
+    fprintf(stderr, "%s: not a gbfsdiff patch\n", patch_path);
+    goto out;
+  }
+
+  if(geti32(p + 8) != old.len
+     || geti32(p + 12) != hash_crc32(0, old.data, old.len))
+  {
+    fprintf(stderr, "%s: patch is for a different file than %s\n",
+            patch_path, old_path);
+    goto out;
+  }
+
+  new_len = geti32(p + 16);
+  out = malloc(new_len ? new_len : 1);
+  if(!out)
+  {
+    perror("could not allocate memory for the output");
+    goto out;
+  }
+
+  for(p += PATCH_HEADER_LEN; ; )
+  {
+    uint64_t v, len;
+
+    if(get_varint(&p, end, &v))
+      goto corrupt;
+    if(!v)
+      break;
+
+    len = v >> 1;
+    if(len > new_len - pos)
+      goto corrupt;
+
+    if(v & 1)
+    {
+      uint64_t z, off;
+
+      if(get_varint(&p, end, &z))
+        goto corrupt;
+
+      off = last_end + ((z >> 1) ^ -(z & 1));
+      if(off > old.len || len > old.len - off)
+        goto corrupt;
+      memcpy(out + pos, old.data + off, len);
+      last_end = off + len;
+    }
+    else
+    {
+      if(len > (uint64_t)(end - p))
+        goto corrupt;
+      memcpy(out + pos, p, len);
+      p += len;
+    }
+    pos += len;
+  }
+
+  if(pos != new_len || geti32(patch.data + 20) != hash_crc32(0, out, new_len))
+    goto corrupt;
+
+  err = write_file(new_path, out, new_len) ? 1 : 0;
+  goto out;
+
+corrupt:
+  fprintf(stderr, "%s: patch is corrupt\n", patch_path);
+
+out:
+  free(out);
+  unmap_file(&patch);
+  unmap_file(&old);
+  return err;
+}
+
+
+int main(int argc, char **argv)
+{
+  int apply = 0, quiet = 0, c;
+
+  while((c = getopt_long(argc, argv, "haq", long_options, NULL)) != -1)
+  {
+    switch(c)
+    {
+    case 'a':
+      apply = 1;
+      break;
+    case 'q':
+      quiet = 1;
+      break;
+    default:
+      fputs(help_text, stderr);
+      return 1;
+    }
+  }
+
+  if(argc - optind != 3)
+  {
+    fputs(help_text, stderr);
+    return 1;
+  }
+
+  if(apply)
+    return apply_patch(argv[optind], argv[optind + 1], argv[optind + 2]);
+  return diff_files(argv[optind], argv[optind + 1], argv[optind + 2], quiet);
+}
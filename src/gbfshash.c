@@ -0,0 +1,133 @@
+/* gbfshash.c
+   hashed name lookup for GBFS archives
+
+This file is part of gba-tools.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to
+  Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+  Boston, MA  02111-1307, USA.
+GNU licenses can be viewed online at http://www.gnu.org/copyleft/
+
+*/
+
+#include <string.h>
+
+#include "gbfshash.h"
+
+
+/* geti16() ****************************
+   read a 16-bit integer in intel format
+*/
+static unsigned int geti16(const unsigned char *src)
+{
+  return src[0] | (src[1] << 8);
+}
+
+
+/* gbfs_put_name() *********************
+   copy at most 24 bytes of name into a directory name field
+*/
+void gbfs_put_name(char *field, const char *name)
+{
+  size_t len = strlen(name);
+
+  memset(field, 0, 24);
+  memcpy(field, name, len < 24 ? len : 24);
+}
+
+
+/* gbfs_name_hash() ********************
+   Hashes the first 24 bytes of a name, stopping at a nul: FNV-1a
+   finished with the MurmurHash3 mixer so that the high bits used by
+   gbfs_hash_range() are well distributed.
+*/
+uint32_t gbfs_name_hash(const char *name, uint32_t seed)
+{
+  uint32_t h = 0x811C9DC5 ^ (seed * 0x9E3779B1);
+  unsigned int i;
+
+  for(i = 0; i < 24 && name[i]; i++)
+  {
+    h ^= (unsigned char)name[i];
+    h *= 0x01000193;
+  }
+
+  h ^= h >> 16;
+  h *= 0x85EBCA6B;
+  h ^= h >> 13;
+  h *= 0xC2B2AE35;
+  h ^= h >> 16;
+  return h;
+}
+
+
+/* gbfs_hash_bucket() ******************
+   picks a name's displacement bucket from its hash
+*/
+unsigned int gbfs_hash_bucket(uint32_t h, unsigned int n_buckets)
+{
+  return gbfs_hash_range(h, n_buckets);
+}
+
+
+/* gbfs_hash_start() *******************
+   picks the slot a name's bucket displacement is added to, from bits
+   of its hash independent of the bucket
+*/
+unsigned int gbfs_hash_start(uint32_t h, unsigned int n_slots)
+{
+  return gbfs_hash_range((h ^ (h >> 15)) * 0x2C1B3C6D, n_slots);
+}
+
+
+/* gbfs_hash_lookup() ******************
+   Finds name using an "MPHI" block payload of index_len bytes and the
+   directory it was built for.  Returns the directory index of the
+   object, or -1 if there is none or the index is malformed.
+*/
+long gbfs_hash_lookup(const void *index, size_t index_len,
+                      const void *dir, size_t dir_nmemb, const char *name)
+{
+  const unsigned char *ix = index;
+  char key[24];
+  unsigned int n_slots, n_buckets, disp, slot, entry;
+  uint32_t h;
+
+  if(index_len < 6)
+    return -1;
+
+  n_slots = geti16(ix);
+  n_buckets = geti16(ix + 2);
+  if(!n_slots || !n_buckets
+     || index_len < 6 + 2 * ((size_t)n_buckets + n_slots))
+    return -1;
+
+  /* names are compared the way they are stored */
+  gbfs_put_name(key, name);
+
+  h = gbfs_name_hash(key, geti16(ix + 4));
+  disp = geti16(ix + 6 + 2 * gbfs_hash_bucket(h, n_buckets));
+  if(disp >= n_slots)
+    return -1;
+  slot = gbfs_hash_start(h, n_slots) + disp;
+  if(slot >= n_slots)
+    slot -= n_slots;
+  entry = geti16(ix + 6 + 2 * n_buckets + 2 * slot);
+
+  if(entry >= dir_nmemb
+     || memcmp((const char *)dir + 32 * (size_t)entry, key, sizeof(key)))
+    return -1;
+
+  return entry;
+}
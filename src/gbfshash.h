@@ -0,0 +1,71 @@
+/* gbfshash.h
+   hashed name lookup for GBFS archives
+
+This file is part of gba-tools.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to
+  Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+  Boston, MA  02111-1307, USA.
+GNU licenses can be viewed online at http://www.gnu.org/copyleft/
+
+*/
+
+#ifndef INCLUDE_GBFSHASH_H
+#define INCLUDE_GBFSHASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The "MPHI" extension block is a minimal perfect hash of the
+   distinct object names in the directory, so that a name is found
+   with one hash and a single name comparison.  All fields are
+   little-endian 16-bit words:
+
+     n_slots       number of distinct names
+     n_buckets     number of displacement buckets
+     seed          hash seed
+     disp[n_buckets]  each less than n_slots
+     entry[n_slots]  directory index of the name in each slot
+
+   With h = gbfs_name_hash(name, seed), where name is nul-padded to 24
+   bytes as in the directory, the name's slot is
+     (gbfs_hash_start(h, n_slots) + disp[gbfs_hash_bucket(h, n_buckets)])
+       mod n_slots
+   The entry in that slot is the only one that can match; compare its
+   name to rule out names not in the archive. */
+
+#define GBFS_EXT_HASH_INDEX "MPHI"
+
+/* map a hash onto 0..n-1 with a multiply instead of a divide */
+#define gbfs_hash_range(h, n) \
+  ((unsigned int)(((uint64_t)(h) * (uint32_t)(n)) >> 32))
+
+/* Stores name in a 24-byte directory name field: nul-padded, and
+   not terminated when it fills the field. */
+void gbfs_put_name(char *field, const char *name);
+
+uint32_t gbfs_name_hash(const char *name, uint32_t seed);
+unsigned int gbfs_hash_bucket(uint32_t h, unsigned int n_buckets);
+unsigned int gbfs_hash_start(uint32_t h, unsigned int n_slots);
+long gbfs_hash_lookup(const void *index, size_t index_len,
+                      const void *dir, size_t dir_nmemb, const char *name);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
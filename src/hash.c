@@ -0,0 +1,270 @@
+/* hash.c
+   hash functions for archive contents
+
+This file is part of gba-tools.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to
+  Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+  Boston, MA  02111-1307, USA.
+GNU licenses can be viewed online at http://www.gnu.org/copyleft/
+
+*/
+
+#include <pthread.h>
+#include <string.h>
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <nmmintrin.h>
+#define HAVE_X86_CRC32C 1
+#endif
+#if defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+#include "hash.h"
+
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+#define ROTL64(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+
+/* read_le32(), read_le64() ************
+   unaligned little-endian loads
+*/
+static uint32_t read_le32(const unsigned char *p)
+{
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8)
+       | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t read_le64(const unsigned char *p)
+{
+  return (uint64_t)read_le32(p) | ((uint64_t)read_le32(p + 4) << 32);
+}
+
+
+static uint64_t xxh64_round(uint64_t acc, uint64_t input)
+{
+  acc += input * PRIME64_2;
+  acc = ROTL64(acc, 31);
+  return acc * PRIME64_1;
+}
+
+static uint64_t xxh64_merge(uint64_t acc, uint64_t val)
+{
+  acc ^= xxh64_round(0, val);
+  return acc * PRIME64_1 + PRIME64_4;
+}
+
+
+/* hash_xxh64() ************************
+   64-bit hash of a block of memory
+*/
+uint64_t hash_xxh64(const void *data, size_t len, uint64_t seed)
+{
+  const unsigned char *p = data;
+  const unsigned char *end = p + len;
+  uint64_t h;
+
+  if(len >= 32)
+  {
+    const unsigned char *limit = end - 32;
+    uint64_t v1 = seed + PRIME64_1 + PRIME64_2;
+    uint64_t v2 = seed + PRIME64_2;
+    uint64_t v3 = seed;
+    uint64_t v4 = seed - PRIME64_1;
+
+    do
+    {
+      v1 = xxh64_round(v1, read_le64(p));
+      v2 = xxh64_round(v2, read_le64(p + 8));
+      v3 = xxh64_round(v3, read_le64(p + 16));
+      v4 = xxh64_round(v4, read_le64(p + 24));
+      p += 32;
+    } while(p <= limit);
+
+    h = ROTL64(v1, 1) + ROTL64(v2, 7) + ROTL64(v3, 12) + ROTL64(v4, 18);
+    h = xxh64_merge(h, v1);
+    h = xxh64_merge(h, v2);
+    h = xxh64_merge(h, v3);
+    h = xxh64_merge(h, v4);
+  }
+  else
+    h = seed + PRIME64_5;
+
+  h += len;
+
+  while(p + 8 <= end)
+  {
+    h ^= xxh64_round(0, read_le64(p));
+    h = ROTL64(h, 27) * PRIME64_1 + PRIME64_4;
+    p += 8;
+  }
+
+  if(p + 4 <= end)
+  {
+    h ^= (uint64_t)read_le32(p) * PRIME64_1;
+    h = ROTL64(h, 23) * PRIME64_2 + PRIME64_3;
+    p += 4;
+  }
+
+  while(p < end)
+  {
+    h ^= *p++ * PRIME64_5;
+    h = ROTL64(h, 11) * PRIME64_1;
+  }
+
+  h ^= h >> 33;
+  h *= PRIME64_2;
+  h ^= h >> 29;
+  h *= PRIME64_3;
+  h ^= h >> 32;
+  return h;
+}
+
+
+#ifndef __ARM_FEATURE_CRC32
+/* CRC lookup tables for slicing by 8: crc_table[k][b] is the CRC of
+   byte b followed by k zero bytes */
+static uint32_t crc32_table[8][256], crc32c_table[8][256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+
+/* make_crc_table() ********************
+   fill a slicing-by-8 table for a reflected polynomial
+*/
+static void make_crc_table(uint32_t table[8][256], uint32_t poly)
+{
+  unsigned int i, k;
+
+  for(i = 0; i < 256; i++)
+  {
+    uint32_t c = i;
+
+    for(k = 0; k < 8; k++)
+      c = (c >> 1) ^ (c & 1 ? poly : 0);
+    table[0][i] = c;
+  }
+
+  for(k = 1; k < 8; k++)
+    for(i = 0; i < 256; i++)
+      table[k][i] = (table[k - 1][i] >> 8) ^ table[0][table[k - 1][i] & 0xff];
+}
+
+
+static void make_crc_tables(void)
+{
+  make_crc_table(crc32_table, 0xEDB88320);
+  make_crc_table(crc32c_table, 0x82F63B78);
+}
+
+
+/* crc_slice8() ************************
+   table-driven CRC, eight bytes per step
+*/
+static uint32_t crc_slice8(uint32_t table[8][256], uint32_t crc,
+                           const unsigned char *p, size_t len)
+{
+  crc = ~crc;
+
+  for(; len >= 8; len -= 8, p += 8)
+  {
+    uint32_t lo = crc ^ read_le32(p), hi = read_le32(p + 4);
+
+    crc = table[7][lo & 0xff] ^ table[6][(lo >> 8) & 0xff]
+        ^ table[5][(lo >> 16) & 0xff] ^ table[4][lo >> 24]
+        ^ table[3][hi & 0xff] ^ table[2][(hi >> 8) & 0xff]
+        ^ table[1][(hi >> 16) & 0xff] ^ table[0][hi >> 24];
+  }
+
+  while(len--)
+    crc = (crc >> 8) ^ table[0][(crc ^ *p++) & 0xff];
+
+  return ~crc;
+}
+#endif
+
+
+#ifdef HAVE_X86_CRC32C
+/* crc32c_sse42() **********************
+   CRC-32C with the SSE4.2 crc32 instruction
+*/
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const unsigned char *p, size_t len)
+{
+  uint64_t c = ~crc;
+
+  for(; len >= 8; len -= 8, p += 8)
+  {
+    uint64_t v;
+
+    memcpy(&v, p, 8);
+    c = _mm_crc32_u64(c, v);
+  }
+
+  while(len--)
+    c = _mm_crc32_u8(c, *p++);
+
+  return ~(uint32_t)c;
+}
+#endif
+
+
+/* hash_crc32() ************************
+   CRC-32 of a block of memory
+*/
+uint32_t hash_crc32(uint32_t crc, const void *data, size_t len)
+{
+  const unsigned char *p = data;
+
+#if defined(__ARM_FEATURE_CRC32)
+  crc = ~crc;
+  for(; len >= 8; len -= 8, p += 8)
+    crc = __crc32d(crc, read_le64(p));
+  while(len--)
+    crc = __crc32b(crc, *p++);
+  return ~crc;
+#else
+  pthread_once(&crc_once, make_crc_tables);
+  return crc_slice8(crc32_table, crc, p, len);
+#endif
+}
+
+
+/* hash_crc32c() ***********************
+   CRC-32C of a block of memory
+*/
+uint32_t hash_crc32c(uint32_t crc, const void *data, size_t len)
+{
+  const unsigned char *p = data;
+
+#if defined(__ARM_FEATURE_CRC32)
+  crc = ~crc;
+  for(; len >= 8; len -= 8, p += 8)
+    crc = __crc32cd(crc, read_le64(p));
+  while(len--)
+    crc = __crc32cb(crc, *p++);
+  return ~crc;
+#else
+#ifdef HAVE_X86_CRC32C
+  if(__builtin_cpu_supports("sse4.2"))
+    return crc32c_sse42(crc, p, len);
+#endif
+  pthread_once(&crc_once, make_crc_tables);
+  return crc_slice8(crc32c_table, crc, p, len);
+#endif
+}
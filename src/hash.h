@@ -0,0 +1,45 @@
+/* hash.h
+   hash functions for archive contents
+
+This file is part of gba-tools.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to
+  Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+  Boston, MA  02111-1307, USA.
+GNU licenses can be viewed online at http://www.gnu.org/copyleft/
+
+*/
+
+#ifndef INCLUDE_HASH_H
+#define INCLUDE_HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* XXH64 from the xxHash family by Yann Collet */
+uint64_t hash_xxh64(const void *data, size_t len, uint64_t seed);
+
+/* CRC-32 as in zlib and PNG, and CRC-32C (Castagnoli) as in iSCSI
+   and ext4.  Pass 0 to start, or a previous result to continue. */
+uint32_t hash_crc32(uint32_t crc, const void *data, size_t len);
+uint32_t hash_crc32c(uint32_t crc, const void *data, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
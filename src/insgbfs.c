@@ -34,174 +34,651 @@ Visit http://www.pineight.com/ for more information.
 
 */
 
+#include <errno.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
-
-#define SIG_LEN 18
-
-const char sig[SIG_LEN] = "PinEightGBFSSpace-";
+#include "fileio.h"
+#include "hash.h"
+#include "mapfile.h"
+#include "romspace.h"
 
 static const char help_text[] =
 "Inserts a GBFS file (or any other file) into a GBFS_SPACE (identified by\n"
 "symbol name) in a ROM.\n\n"
-"usage: insgbfs SOURCEFILE ROMFILE SYMNAME\n"
-"example: insgbfs samples.gbfs marco.gba samples\n";
+"usage: insgbfs [OPTIONS] SOURCEFILE ROMFILE SYMNAME\n"
+"       insgbfs [OPTIONS] -b ROMFILE SOURCEFILE:SYMNAME...\n"
+"example: insgbfs samples.gbfs marco.gba samples\n"
+"  -b, --batch     fill several spaces in ROMFILE at once; if any source\n"
+"                  doesn't fit, or any write fails, ROMFILE is left as it was\n"
+"  -e, --elf=FILE  take the space's place and size from the symbol table\n"
+"                  of FILE, the program ROMFILE was made from\n"
+"  -i, --index=FILE  remember where the spaces in ROMFILE are in FILE, and\n"
+"                  skip searching ROMFILE while FILE is still up to date\n";
+
+static const struct option long_options[] = {
+  { "batch", no_argument,       NULL, 'b' },
+  { "elf",   required_argument, NULL, 'e' },
+  { "index", required_argument, NULL, 'i' },
+  { "help",  no_argument,       NULL, 'h' },
+  { NULL,    0,                 NULL,  0  },
+};
+
+typedef struct INSERTION
+{
+  const char *src_path;
+  const char *name;     /* of the space */
+  MAPPED_FILE src;
+  ROM_SPACE space;
+  unsigned char *old;   /* the ROM bytes src replaces, to undo it */
+} INSERTION;
+
+/* Where the spaces in a ROM are, as of the ROM's size and mtime and
+   the first bytes of each space: its signature until it is filled,
+   then what insgbfs put there.  Comparing those bytes costs a few
+   small reads instead of a scan of the whole ROM. */
+typedef struct SPACE_INDEX
+{
+  uintmax_t rom_size;
+  intmax_t rom_mtime;
+  uint64_t heads_hash;
+  ROM_SPACE *spaces;
+  size_t n;
+} SPACE_INDEX;
+
+#define INDEX_MAGIC "insgbfs space index 1"
+
+
+/* print_space() ***********************
+   report where a space was found
+*/
+static void print_space(const INSERTION *ins, size_t n, const char *how,
+                        size_t size)
+{
+  if(n > 1)
+    fprintf(stderr, "%s: ", ins->name);
+  fprintf(stderr, "%s at %lu, size %lu\n",
+                  how, (unsigned long)ins->space.offset, (unsigned long)size);
+}
 
 
-unsigned long fcopy(FILE *dst, FILE *src)
+/* elf_spaces() ************************
+   Looks up each insertion's GBFS_SPACE in the ELF at elf_path and
+   checks that the ROM at path holds it there.  Returns 0 for success
+   or nonzero for failure.
+*/
+static int elf_spaces(const char *path, const char *elf_path,
+                      INSERTION *ins, size_t n)
 {
-  char buf[16384];
-  unsigned long sz = 0, this_sz;
+  MAPPED_FILE elf;
+  unsigned char sig[ROM_SPACE_SIG_LEN + ROM_SPACE_NAME_MAX + 1];
+  struct stat st;
+  size_t i;
+  int fd, err = 0;
 
-  do {
-    this_sz = fread(buf, 1, sizeof(buf), src);
-    if(this_sz)
+  if(map_file(&elf, elf_path))
+  {
+    fputs("insgbfs could not open ", stderr);
+    perror(elf_path);
+    return -1;
+  }
+
+  for(i = 0; i < n && !err; i++)
+  {
+    const char *name = ins[i].name;
+
+    err = rom_space_from_elf(elf.data, elf.len, name, &ins[i].space);
+    switch(err)
     {
-      fwrite(buf, 1, this_sz, dst);  /* FIXME: need error checking */
-      sz += this_sz;
+    case ROM_SPACE_BAD_ELF:
+      fprintf(stderr, "insgbfs: '%s' is not a 32-bit little-endian ELF program\n",
+                      elf_path);
+      break;
+    case ROM_SPACE_NOT_FOUND:
+      fprintf(stderr, "insgbfs could not find symbol '%s' in file '%s'\n",
+                      name, elf_path);
+      break;
+    case ROM_SPACE_BAD_SIZE:
+      fprintf(stderr, "insgbfs: symbol '%s' in file '%s' has no size\n",
+                      name, elf_path);
+      break;
+    case ROM_SPACE_NOT_IN_ROM:
+      fprintf(stderr, "insgbfs: symbol '%s' in file '%s' is not in ROM\n",
+                      name, elf_path);
+      break;
     }
-  } while(this_sz != 0);
+  }
+  unmap_file(&elf);
+  if(err)
+    return -1;
+
+  fd = open(path, O_RDONLY | O_BINARY);
+  if(fd < 0 || fstat(fd, &st))
+  {
+    fputs("insgbfs could not open ", stderr);
+    perror(path);
+    if(fd >= 0)
+      close(fd);
+    return -1;
+  }
+
+  for(i = 0; i < n; i++)
+  {
+    const ROM_SPACE *space = &ins[i].space;
+    size_t sig_len = ROM_SPACE_SIG_LEN + strlen(ins[i].name) + 1;
+
+    if((uintmax_t)st.st_size < space->offset
+       || (uintmax_t)st.st_size - space->offset < space->size
+       || pread_full(fd, sig, sig_len, space->offset)
+       || rom_space_check(sig, sig_len, ins[i].name))
+    {
+      fprintf(stderr, "insgbfs: '%s' doesn't hold space '%s' at %lu where '%s' puts it\n",
+                      path, ins[i].name, (unsigned long)space->offset, elf_path);
+      close(fd);
+      return -1;
+    }
+    print_space(&ins[i], n, "symbol", space->size / 1024);
+  }
+
+  close(fd);
+  return 0;
+}
+
+
+/* head_len() **************************
+   length of the signature that starts a space
+*/
+static size_t head_len(const ROM_SPACE *space)
+{
+  unsigned long kbytes = space->size / 1024;
+  size_t len = ROM_SPACE_SIG_LEN + strlen(space->name) + 3;
 
-  return sz;
+  while(kbytes >= 10)
+  {
+    kbytes /= 10;
+    len++;
+  }
+  return len;
+}
+
+
+/* hash_heads() ************************
+   Hashes the bytes where each space's signature was in the ROM open
+   as fd.  Returns 0 for success or nonzero if they can't be read.
+*/
+static int hash_heads(int fd, const ROM_SPACE *spaces, size_t n,
+                      uint64_t *out)
+{
+  unsigned char buf[ROM_SPACE_SIG_LEN + ROM_SPACE_NAME_MAX + 16];
+  uint64_t h = 0;
+  size_t i;
+
+  for(i = 0; i < n; i++)
+  {
+    size_t len = head_len(&spaces[i]);
+
+    if(pread_full(fd, buf, len, spaces[i].offset))
+      return -1;
+    h = hash_xxh64(buf, len, h);
+  }
+
+  *out = h;
+  return 0;
 }
 
 
+/* read_index() ************************
+   Reads the index at path.  Returns 0 for success or nonzero if
+   it's missing or malformed.
+*/
+static int read_index(const char *path, SPACE_INDEX *idx)
+{
+  char line[ROM_SPACE_NAME_MAX + 64];
+  unsigned long long hash;
+  FILE *fp = fopen(path, "r");
+
+  idx->spaces = NULL;
+  idx->n = 0;
+  if(!fp)
+    return -1;
+
+  if(!fgets(line, sizeof(line), fp)
+     || strcmp(line, INDEX_MAGIC "\n")
+     || !fgets(line, sizeof(line), fp)
+     || sscanf(line, "rom %ju %jd %llx", &idx->rom_size, &idx->rom_mtime,
+               &hash) != 3)
+  {
+    fclose(fp);
+    return -1;
+  }
+  idx->heads_hash = hash;
+
+  while(fgets(line, sizeof(line), fp))
+  {
+    unsigned long offset, size;
+    char name[ROM_SPACE_NAME_MAX + 1];
+    ROM_SPACE *grown;
+
+    if(sscanf(line, "%lu %lu %255s", &offset, &size, name) != 3)
+      break;
+    grown = realloc(idx->spaces, (idx->n + 1) * sizeof(*grown));
+    if(!grown)
+      break;
+    idx->spaces = grown;
+    grown[idx->n].offset = offset;
+    grown[idx->n].size = size;
+    strcpy(grown[idx->n].name, name);
+    idx->n++;
+  }
+
+  if(!feof(fp))
+  {
+    fclose(fp);
+    free(idx->spaces);
+    idx->spaces = NULL;
+    idx->n = 0;
+    return -1;
+  }
+
+  fclose(fp);
+  return 0;
+}
+
+
+/* index_is_current() ******************
+   Returns nonzero if the index still describes the ROM at path.
+*/
+static int index_is_current(const char *path, const SPACE_INDEX *idx)
+{
+  struct stat st;
+  uint64_t h;
+  int fd = open(path, O_RDONLY | O_BINARY), current;
+
+  if(fd < 0)
+    return 0;
+
+  current = !fstat(fd, &st)
+            && (uintmax_t)st.st_size == idx->rom_size
+            && (intmax_t)st.st_mtime == idx->rom_mtime
+            && !hash_heads(fd, idx->spaces, idx->n, &h)
+            && h == idx->heads_hash;
+  close(fd);
+  return current;
+}
+
+
+/* write_index() ***********************
+   Records the spaces in idx, and the ROM at path as it is now, in
+   the index at index_path.  Returns 0 for success or nonzero for
+   failure.
+*/
+static int write_index(const char *path, const char *index_path,
+                       SPACE_INDEX *idx)
+{
+  struct stat st;
+  FILE *fp;
+  size_t i;
+  int fd = open(path, O_RDONLY | O_BINARY), err;
+
+  if(fd < 0)
+    return -1;
+  err = fstat(fd, &st) || hash_heads(fd, idx->spaces, idx->n, &idx->heads_hash);
+  close(fd);
+  if(err)
+    return -1;
+
+  fp = fopen(index_path, "w");
+  if(!fp)
+    return -1;
+
+  fprintf(fp, INDEX_MAGIC "\nrom %ju %jd %016llx\n",
+              (uintmax_t)st.st_size, (intmax_t)st.st_mtime,
+              (unsigned long long)idx->heads_hash);
+  for(i = 0; i < idx->n; i++)
+    fprintf(fp, "%lu %lu %s\n", (unsigned long)idx->spaces[i].offset,
+                (unsigned long)idx->spaces[i].size, idx->spaces[i].name);
+
+  return fclose(fp) ? -1 : 0;
+}
+
 
-/* find_signature() ********************
-   Finds the next GBFS_SPACE signature and places the file pointer
-   at its end.  Returns 0 for success or nonzero for failure.
+/* lookup_spaces() *********************
+   Fills in each insertion's space from the first of the same name
+   in spaces.  Returns nonzero if any is missing.
 */
-int find_signature(FILE *fp)
+static int lookup_spaces(INSERTION *ins, size_t n, const ROM_SPACE *spaces,
+                         size_t n_spaces)
 {
-  size_t src_offset = 0;
+  size_t i, j;
+
+  for(i = 0; i < n; i++)
+  {
+    for(j = 0; j < n_spaces && strcmp(spaces[j].name, ins[i].name); j++)
+      ;
+    if(j == n_spaces)
+      return -1;
+    ins[i].space = spaces[j];
+  }
+
+  return 0;
+}
+
 
-  while(src_offset < SIG_LEN)
+/* find_spaces() ***********************
+   Finds each insertion's GBFS_SPACE in the ROM at path, in one pass
+   over it.  Returns 0 for success or nonzero for failure.
+*/
+static int find_spaces(const char *path, INSERTION *ins, size_t n)
+{
+  MAPPED_FILE rom;
+  const char **names = malloc(n * sizeof(*names));
+  ROM_SPACE *spaces = malloc(n * sizeof(*spaces));
+  int *results = malloc(n * sizeof(*results));
+  size_t i;
+  int err = 0;
+
+  if(!names || !spaces || !results)
   {
-    int c = fgetc(fp);
+    fputs("insgbfs: out of memory\n", stderr);
+    err = -1;
+  }
+  else if(map_file(&rom, path))
+  {
+    fputs("insgbfs could not open ", stderr);
+    perror(path);
+    err = -1;
+  }
+  else
+  {
+    for(i = 0; i < n; i++)
+      names[i] = ins[i].name;
+    rom_space_find_many(rom.data, rom.len, names, n, spaces, results);
+    unmap_file(&rom);
 
-    if(c == EOF)
-      return EOF;
-    else if(c == sig[src_offset])
+    for(i = 0; i < n; i++)
     {
-      src_offset++;
+      if(results[i] == ROM_SPACE_NOT_FOUND)
+        fprintf(stderr, "insgbfs could not find symbol '%s' in file '%s'\n",
+                        names[i], path);
+      else if(results[i] == ROM_SPACE_BAD_SIZE)
+        fprintf(stderr, "insgbfs: the size of space '%s' in file '%s' is not a number of KB that fits the file\n",
+                        names[i], path);
+      else
+      {
+        ins[i].space = spaces[i];
+        print_space(&ins[i], n, "match", spaces[i].size / 1024);
+        continue;
+      }
+      err = -1;
     }
   }
 
-  return 0;
+  free(names);
+  free(spaces);
+  free(results);
+  return err;
 }
 
 
-/* find_signature_named() **************
-   Finds a signature of the format
-   PinEightGBFSSpace-sym-123
-   where sym matches name.
-   Positions the file pointer at the beginning of the sig.
-   Returns the number after the sig, or <0 for not found.
+/* indexed_spaces() ********************
+   Finds each insertion's GBFS_SPACE from the index at index_path if
+   it still describes the ROM at path, or else by listing every
+   space in the ROM into idx so the index can be rewritten.  Returns
+   0 for success or nonzero for failure.
 */
-int find_signature_named(const char *name, FILE *fp)
+static int indexed_spaces(const char *path, const char *index_path,
+                          INSERTION *ins, size_t n, SPACE_INDEX *idx)
 {
-  int is_eof, found = 0;
-  int got_k = -1;
+  MAPPED_FILE rom;
+  size_t i;
 
-  for(is_eof = find_signature(fp);
-      !found && !is_eof;
-      found || (is_eof = find_signature(fp)))
+  if(!read_index(index_path, idx) && index_is_current(path, idx)
+     && !lookup_spaces(ins, n, idx->spaces, idx->n))
   {
-    const char *name_chr = name;
-    size_t sig_offset = ftell(fp) - SIG_LEN;
+    for(i = 0; i < n; i++)
+      print_space(&ins[i], n, "indexed", ins[i].space.size / 1024);
+    return 0;
+  }
+  free(idx->spaces);
+  idx->spaces = NULL;
+  idx->n = 0;
 
-    /* search for the name */
-    while(*name_chr && *name_chr == fgetc(fp))
-      name_chr++;
+  if(map_file(&rom, path))
+  {
+    fputs("insgbfs could not open ", stderr);
+    perror(path);
+    return -1;
+  }
+  if(rom_space_list(rom.data, rom.len, &idx->spaces, &idx->n))
+  {
+    fputs("insgbfs: out of memory\n", stderr);
+    unmap_file(&rom);
+    return -1;
+  }
+  unmap_file(&rom);
+
+  /* let find_spaces() say what is wrong with a missing one */
+  if(lookup_spaces(ins, n, idx->spaces, idx->n))
+    return find_spaces(path, ins, n);
+
+  for(i = 0; i < n; i++)
+    print_space(&ins[i], n, "match", ins[i].space.size / 1024);
+  return 0;
+}
 
-    if(*name_chr)  /* if it didn't make it all the way through */
+
+/* check_fit() *************************
+   Maps each source and checks that it fits its space and that no
+   two insertions share a space.  Returns 0 for success or nonzero
+   for failure.
+*/
+static int check_fit(const char *path, INSERTION *ins, size_t n)
+{
+  size_t i, j;
+
+  for(i = 0; i < n; i++)
+  {
+    if(map_file(&ins[i].src, ins[i].src_path))
     {
-      fprintf(stderr, "didn't match at %lu\n", (unsigned long)sig_offset);
-      continue;
+      fputs("insgbfs could not open ", stderr);
+      perror(ins[i].src_path);
+      return -1;
     }
 
-    /* if the name doesn't end there */
-    if(fgetc(fp) != '-')
+    if(ins[i].src.len > ins[i].space.size)
     {
-      fprintf(stderr, "too long at %lu\n", (unsigned long)sig_offset);
-      continue;
+      fprintf(stderr, "insgbfs could not insert '%s' of %lu KB into a %lu KB space in file '%s'\n",
+                      ins[i].src_path,
+                      (unsigned long)((ins[i].src.len - 1) / 1024 + 1),
+                      (unsigned long)(ins[i].space.size / 1024),
+                      path);
+      return -1;
     }
 
-    found = 1;
+    for(j = 0; j < i; j++)
     {
-      char buf[16];
-
-      fread(buf, 1, sizeof(buf), fp);
-      fseek(fp, sig_offset, SEEK_SET);
-      got_k = strtoul(buf, NULL, 10);
-      fprintf(stderr, "match at %lu, size %d\n",
-                      (unsigned long)sig_offset,
-                      got_k);
+      const ROM_SPACE *a = &ins[i].space, *b = &ins[j].space;
+
+      if(a->offset < b->offset + b->size && b->offset < a->offset + a->size)
+      {
+        fprintf(stderr, "insgbfs: '%s' and '%s' both go into space '%s'\n",
+                        ins[j].src_path, ins[i].src_path, ins[i].name);
+        return -1;
+      }
     }
   }
 
-  return got_k;
+  return 0;
 }
 
 
+/* insert_all() ************************
+   Writes each source over its space in the ROM at path.  The bytes
+   each will replace are read first, so that if a write fails, those
+   already made can be undone.  Returns 0 for success or nonzero for
+   failure.
+*/
+static int insert_all(const char *path, INSERTION *ins, size_t n)
+{
+  size_t i, done;
+  int fd = open(path, O_RDWR | O_BINARY);
+
+  if(fd < 0)
+  {
+    fputs("insgbfs could not open ", stderr);
+    perror(path);
+    return -1;
+  }
+
+  for(i = 0; i < n; i++)
+  {
+    ins[i].old = malloc(ins[i].src.len ? ins[i].src.len : 1);
+    if(!ins[i].old
+       || pread_full(fd, ins[i].old, ins[i].src.len, ins[i].space.offset))
+    {
+      fputs("insgbfs could not read ", stderr);
+      perror(path);
+      close(fd);
+      return -1;
+    }
+  }
+
+  for(done = 0; done < n; done++)
+    if(pwrite_full(fd, ins[done].src.data, ins[done].src.len,
+                   ins[done].space.offset))
+      break;
+
+  if(done < n)
+  {
+    fputs("insgbfs could not write ", stderr);
+    perror(path);
+
+    /* the failed write may have gone partway, so undo it too */
+    for(i = done + 1; i-- > 0; )
+      if(pwrite_full(fd, ins[i].old, ins[i].src.len, ins[i].space.offset))
+        fprintf(stderr, "insgbfs could not restore space '%s' in file '%s'\n",
+                        ins[i].name, path);
+    close(fd);
+    return -1;
+  }
+
+  if(close(fd))
+  {
+    fputs("insgbfs could not write ", stderr);
+    perror(path);
+    return -1;
+  }
+  return 0;
+}
 
-int main(int argc, const char **argv)
+
+int main(int argc, char **argv)
 {
-  int found;
-  FILE *infile, *romfile;
-  size_t infile_size;
+  INSERTION *ins;
+  const char *elf_path = NULL, *index_path = NULL, *rom_path;
+  SPACE_INDEX idx;
+  int batch = 0, c, err;
+  size_t n, i;
 
-  if(argc < 4)
+  while((c = getopt_long(argc, argv, "hbe:i:", long_options, NULL)) != -1)
+  {
+    switch(c)
+    {
+    case 'b':
+      batch = 1;
+      break;
+    case 'e':
+      elf_path = optarg;
+      break;
+    case 'i':
+      index_path = optarg;
+      break;
+    default:
+      fputs(help_text, stderr);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if(argc - optind < (batch ? 2 : 3))
   {
     fputs(help_text, stderr);
     return EXIT_FAILURE;
   }
+  argv += optind;
+  argc -= optind;
 
-  romfile = fopen(argv[2], "rb+");
-  if(!romfile)
+  if(elf_path && index_path)
   {
-    fputs("insgbfs could not open ", stderr);
-    perror(argv[2]);
+    fputs("insgbfs: --elf already skips the search; --index can't be used with it\n",
+          stderr);
     return EXIT_FAILURE;
   }
 
-  found = find_signature_named(argv[3], romfile);
-  if(found < 0)
+  n = batch ? (size_t)argc - 1 : 1;
+  ins = calloc(n, sizeof(*ins));
+  if(!ins)
   {
-    fprintf(stderr, "insgbfs could not find symbol '%s' in file '%s'\n",
-                    argv[3], argv[2]);
-    fclose(romfile);
+    fputs("insgbfs: out of memory\n", stderr);
     return EXIT_FAILURE;
   }
 
-  infile = fopen(argv[1], "rb");
-  if(!infile)
+  if(batch)
   {
-    fputs("insgbfs could not open ", stderr);
-    perror(argv[1]);
-    fclose(romfile);
-    return EXIT_FAILURE;
+    rom_path = argv[0];
+    for(i = 0; i < n; i++)
+    {
+      /* symbol names have no colon; a path might */
+      char *colon = strrchr(argv[i + 1], ':');
+
+      if(!colon || colon == argv[i + 1] || !colon[1])
+      {
+        fprintf(stderr, "insgbfs: '%s' is not SOURCEFILE:SYMNAME\n",
+                        argv[i + 1]);
+        free(ins);
+        return EXIT_FAILURE;
+      }
+      *colon = 0;
+      ins[i].src_path = argv[i + 1];
+      ins[i].name = colon + 1;
+    }
+  }
+  else
+  {
+    ins[0].src_path = argv[0];
+    rom_path = argv[1];
+    ins[0].name = argv[2];
   }
 
-  fseek(infile, 0, SEEK_END);
-  infile_size = ftell(infile);
-  rewind(infile);
-  if(infile_size > found * 1024)
+  idx.spaces = NULL;
+  if(elf_path)
+    err = elf_spaces(rom_path, elf_path, ins, n);
+  else if(index_path)
+    err = indexed_spaces(rom_path, index_path, ins, n, &idx);
+  else
+    err = find_spaces(rom_path, ins, n);
+  if(!err)
+    err = check_fit(rom_path, ins, n);
+  if(!err)
+    err = insert_all(rom_path, ins, n);
+
+  /* the filled spaces stay in the index, so they can be refilled */
+  if(!err && index_path && write_index(rom_path, index_path, &idx))
   {
-    fprintf(stderr, "insgbfs could not insert '%s' of %lu KB into a %d KB space in file '%s'\n",
-                    argv[1],
-                    (unsigned long)((infile_size - 1) / 1024 + 1),
-                    found,
-                    argv[2]);
-    fclose(infile);
-    fclose(romfile);
-    return EXIT_FAILURE;
+    fputs("insgbfs could not write index ", stderr);
+    perror(index_path);
   }
+  free(idx.spaces);
 
-  fcopy(romfile, infile);
-  fclose(romfile);
-  return EXIT_SUCCESS;
+  for(i = 0; i < n; i++)
+  {
+    unmap_file(&ins[i].src);
+    free(ins[i].old);
+  }
+  free(ins);
+  return err ? EXIT_FAILURE : EXIT_SUCCESS;
 }
-
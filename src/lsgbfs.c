@@ -34,77 +34,557 @@ Visit http://www.pineight.com/ for more information.
 
 */
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <getopt.h>
 
-#define strequ(a,b) (!strcmp(a,b))
+#include "gbfs_host.h"
+#include "gbfshash.h"
+#include "hash.h"
+#include "parallel.h"
 
-typedef unsigned short u16;
-typedef unsigned long u32;
+static const char help_text[] =
+"lists the objects in a gbfs file\n"
+"syntax: lsgbfs [OPTIONS] FILE\n"
+"  FILE                a gbfs file, or a ROM with archives in it\n"
+"  --verify            check that every object lies within the archive\n"
+"                      and that no two overlap\n"
+"  --manifest[=FORMAT] list name, offset, length, alignment and hash of\n"
+"                      each object as csv (default) or json\n"
+"  --hash=TYPE         hash for the manifest: crc32 (default), crc32c\n"
+"                      or xxh64\n"
+"  -j, --jobs=N        hash up to N objects at once (default: one per CPU)\n";
 
-#include "gbfs.h"
+static const struct option long_options[] = {
+  { "verify",   no_argument,       NULL, 'v' },
+  { "manifest", optional_argument, NULL, 'm' },
+  { "hash",     required_argument, NULL, 'H' },
+  { "jobs",     required_argument, NULL, 'j' },
+  { "help",     no_argument,       NULL, 'h' },
+  { NULL,       0,                 NULL,  0  },
+};
 
+enum { HASH_CRC32, HASH_CRC32C, HASH_XXH64 };
 
-/* fgeti16() ***************************
-   read a 16-bit integer in intel format from a file
+static const char *const hash_names[] = { "crc32", "crc32c", "xxh64" };
+
+typedef struct HASH_CTX
+{
+  const GBFS_FILE *file;
+  int type;
+  uint64_t *hashes;
+} HASH_CTX;
+
+/* a range of bytes in the archive, for the overlap check */
+typedef struct SPAN
+{
+  u32 start, len;
+  size_t obj;  /* directory index, or (size_t)-1 for other data */
+} SPAN;
+
+
+/* type_name() *************************
+   names a compression table type byte
 */
-u32 fgeti16(FILE *fp)
+const char *type_name(unsigned int type)
 {
-  return ((fgetc(fp) & 0x000000ff)      ) |
-         ((fgetc(fp) & 0x000000ff) <<  8);
+  switch(type)
+  {
+  case 0x10:
+    return "lz10";
+  case 0x11:
+    return "lz11";
+  case 0x70:
+    return "fast";
+  }
+  return "unknown";
 }
 
 
-/* fgeti32() ***************************
-   read a 32-bit integer in intel format from a file
+/* hash_obj() **************************
+   hash the nth object.
+   runs on the thread pool.
 */
-u32 fgeti32(FILE *fp)
+static int hash_obj(void *ctx, size_t i)
 {
-  return ((fgetc(fp) & 0x000000ff)      ) |
-         ((fgetc(fp) & 0x000000ff) <<  8) |
-         ((fgetc(fp) & 0x000000ff) << 16) |
-         ((fgetc(fp) & 0x000000ff) << 24);
+  HASH_CTX *hc = ctx;
+  u32 len;
+  const void *data = gbfs_get_nth_obj(hc->file, i, NULL, &len);
+
+  switch(hc->type)
+  {
+  case HASH_CRC32:
+    hc->hashes[i] = hash_crc32(0, data, len);
+    break;
+  case HASH_CRC32C:
+    hc->hashes[i] = hash_crc32c(0, data, len);
+    break;
+  default:
+    hc->hashes[i] = hash_xxh64(data, len, 0);
+    break;
+  }
+
+  return 0;
+}
+
+
+/* spancmp() ***************************
+   orders spans by start, then length
+*/
+static int spancmp(const void *a, const void *b)
+{
+  const SPAN *pa = a, *pb = b;
+
+  if(pa->start != pb->start)
+    return pa->start < pb->start ? -1 : 1;
+  if(pa->len != pb->len)
+    return pa->len < pb->len ? -1 : 1;
+  return 0;
+}
+
+
+/* span_name() *************************
+   describes what a span holds, for error messages
+*/
+static const char *span_name(const GBFS_FILE *file, const SPAN *s, char *buf)
+{
+  if(s->obj == (size_t)-1)
+    return "the header, directory or an extension block";
+
+  gbfs_get_nth_obj(file, s->obj, buf, NULL);
+  return buf;
+}
+
+
+/* verify_archive() ********************
+   Checks that the directory is sorted and that every object lies
+   within total_len without overlapping the directory, the extension
+   blocks or any other object.  Objects sharing exactly the same data
+   (as gbfs --dedup makes them) are fine.  Returns the number of
+   problems found.
+*/
+static unsigned long verify_archive(const char *path, const GBFS_FILE *file)
+{
+  static const char *const ext_tags[] = {
+    GBFS_EXT_COMPRESSION, GBFS_EXT_HASH_INDEX, GBFS_EXT_DIR2
+  };
+  const unsigned char *base = (const unsigned char *)file;
+  size_t n, n_spans = 0, i;
+  const unsigned char *dir = gbfs_get_dir(file, &n);
+  unsigned long problems = 0;
+  char name[25], prev[25] = {0};
+  SPAN *spans = malloc((n + 5) * sizeof(*spans));
+
+  if(!spans)
+  {
+    perror("could not allocate memory for verification");
+    return 1;
+  }
+
+  spans[n_spans].start = 0;
+  spans[n_spans].len = 32;
+  spans[n_spans++].obj = (size_t)-1;
+
+  if(n)
+  {
+    spans[n_spans].start = dir - base;
+    spans[n_spans].len = 32 * (u32)n;
+    spans[n_spans++].obj = (size_t)-1;
+  }
+
+  for(i = 0; i < sizeof(ext_tags) / sizeof(ext_tags[0]); i++)
+  {
+    u32 len;
+    const unsigned char *ext = gbfs_get_ext(file, ext_tags[i], &len);
+
+    if(ext)
+    {
+      spans[n_spans].start = ext - base - 12;
+      spans[n_spans].len = len + 12;
+      spans[n_spans++].obj = (size_t)-1;
+    }
+  }
+
+  for(i = 0; i < n; i++)
+  {
+    const unsigned char *e = dir + 32 * i;
+    u32 len, off = e[28] | (e[29] << 8) | (e[30] << 16) | ((u32)e[31] << 24);
+
+    if(!gbfs_get_nth_obj(file, i, name, &len))
+    {
+      fprintf(stderr, "%s: %s lies outside the archive (total_len %lu)\n",
+              path, name, (unsigned long)gbfs_total_len(file));
+      problems++;
+      continue;
+    }
+
+    if(i > 0 && memcmp(prev, name, 24) > 0)
+    {
+      fprintf(stderr, "%s: directory is out of order at %s\n", path, name);
+      problems++;
+    }
+    memcpy(prev, name, sizeof(prev));
+
+    if(len)
+    {
+      spans[n_spans].start = off;
+      spans[n_spans].len = len;
+      spans[n_spans++].obj = i;
+    }
+  }
+
+  /* after sorting, any overlap is between neighbours or hidden behind
+     a longer span, so track the furthest end seen so far */
+  qsort(spans, n_spans, sizeof(*spans), spancmp);
+  {
+    size_t last = 0;
+    char a[25], b[25];
+
+    for(i = 1; i < n_spans; i++)
+    {
+      const SPAN *p = &spans[last], *s = &spans[i];
+
+      if(s->start >= p->start + p->len)
+      {
+        last = i;
+        continue;
+      }
+
+      if(s->start == p->start && s->len == p->len
+         && s->obj != (size_t)-1 && p->obj != (size_t)-1)
+        continue;
+
+      fprintf(stderr, "%s: %s overlaps %s\n", path,
+              span_name(file, s, a), span_name(file, p, b));
+      problems++;
+
+      if(s->start + s->len > p->start + p->len)
+        last = i;
+    }
+  }
+
+  free(spans);
+  return problems;
+}
+
+
+/* put_csv_name() **********************
+   write a name as a CSV field, quoted if it needs to be
+*/
+static void put_csv_name(const char *name)
+{
+  if(!strpbrk(name, ",\"\r\n"))
+  {
+    fputs(name, stdout);
+    return;
+  }
+
+  putchar('"');
+  for(; *name; name++)
+  {
+    if(*name == '"')
+      putchar('"');
+    putchar(*name);
+  }
+  putchar('"');
+}
+
+
+/* put_json_name() *********************
+   write a name as a JSON string
+*/
+static void put_json_name(const char *name)
+{
+  putchar('"');
+  for(; *name; name++)
+  {
+    unsigned char c = *name;
+
+    if(c == '"' || c == '\\')
+      printf("\\%c", c);
+    else if(c < 0x20 || c >= 0x7f)
+      printf("\\u%04x", c);
+    else
+      putchar(c);
+  }
+  putchar('"');
+}
+
+
+/* write_manifest() ********************
+   list every object with its hash.  Offsets are from base, the start
+   of the file; *n_written counts the records written so far, so that
+   several archives make one manifest.
+*/
+static void write_manifest(const GBFS_FILE *file, const unsigned char *base,
+                           const uint64_t *hashes, int hash_type, int json,
+                           size_t *n_written)
+{
+  const char *hash_name = hash_names[hash_type];
+  int digits = hash_type == HASH_XXH64 ? 16 : 8;
+  size_t n = gbfs_count_objs(file), i;
+
+  for(i = 0; i < n; i++)
+  {
+    char name[25];
+    u32 len;
+    const unsigned char *data = gbfs_get_nth_obj(file, i, name, &len);
+    unsigned long off = data - base, align;
+
+    /* the largest power of two dividing the offset, up to 256 */
+    for(align = 1; align < 256 && !(off & align); align <<= 1)
+      ;
+
+    if(json)
+    {
+      fputs(*n_written ? ",\n  {\"name\": " : "  {\"name\": ", stdout);
+      put_json_name(name);
+      printf(", \"offset\": %lu, \"length\": %lu, \"alignment\": %lu, "
+             "\"%s\": \"%0*llx\"}",
+             off, (unsigned long)len, align, hash_name,
+             digits, (unsigned long long)hashes[i]);
+    }
+    else
+    {
+      put_csv_name(name);
+      printf(",%lu,%lu,%lu,%0*llx\n", off, (unsigned long)len, align,
+             digits, (unsigned long long)hashes[i]);
+    }
+    ++*n_written;
+  }
+}
+
+
+/* manifest_archive() ******************
+   hash every object in an archive and add them to the manifest.
+   Returns 0 for success or nonzero for failure.
+*/
+static int manifest_archive(const char *label, const GBFS_FILE *file,
+                            const unsigned char *base, int hash_type,
+                            int json, unsigned int jobs, size_t *n_written)
+{
+  size_t n = gbfs_count_objs(file), i;
+  HASH_CTX hc;
+
+  /* a manifest needs every object in bounds */
+  for(i = 0; i < n; i++)
+    if(!gbfs_get_nth_obj(file, i, NULL, NULL))
+    {
+      fprintf(stderr, "%s: object %lu lies outside the archive\n",
+              label, (unsigned long)i);
+      return -1;
+    }
+
+  hc.file = file;
+  hc.type = hash_type;
+  hc.hashes = malloc((n ? n : 1) * sizeof(*hc.hashes));
+  if(!hc.hashes)
+  {
+    perror("could not allocate memory for hashes");
+    return -1;
+  }
+
+  parallel_for(n, jobs, hash_obj, &hc);
+  write_manifest(file, base, hc.hashes, hash_type, json, n_written);
+  free(hc.hashes);
+  return 0;
+}
+
+
+/* list_archive() **********************
+   print the length and name of each object in an archive.
+   Returns 0 for success or nonzero if an object is out of bounds.
+*/
+static int list_archive(const char *label, const GBFS_FILE *file)
+{
+  size_t n = gbfs_count_objs(file), i;
+  u32 types_len;
+  const unsigned char *types = gbfs_get_ext(file, GBFS_EXT_COMPRESSION,
+                                            &types_len);
+
+  if(types && types_len < n)
+    types = NULL;
+
+  for(i = 0; i < n; i++)
+  {
+    char filename[25];
+    u32 len;
+    const unsigned char *data = gbfs_get_nth_obj(file, i, filename, &len);
+
+    if(!data)
+    {
+      fprintf(stderr, "%s: object %lu lies outside the archive\n",
+              label, (unsigned long)i);
+      return -1;
+    }
+
+    /* the unpacked size is in the data's 24-bit header */
+    if(types && types[i] && len >= 4)
+      printf("%10lu %s (%s, %lu unpacked)\n", (unsigned long)len, filename,
+             type_name(types[i]),
+             (unsigned long)data[1] | ((unsigned long)data[2] << 8)
+             | ((unsigned long)data[3] << 16));
+    else
+      printf("%10lu %s\n", (unsigned long)len, filename);
+  }
+
+  return 0;
+}
+
+
+/* make_label() ************************
+   name an archive in messages: just the path, or the path and the
+   offset of the archive when the file holds more than one
+*/
+static void make_label(char *label, const char *path, const GBFS_FILE *file,
+                       const unsigned char *base)
+{
+  if(file)
+    sprintf(label, "%s@0x%lx", path,
+            (unsigned long)((const unsigned char *)file - base));
+  else
+    strcpy(label, path);
 }
 
 
 int main(int argc, char **argv)
 {
-  FILE *fp;
-  char filename[32] = {0};
-  u32 dir_off, dir_nmemb;
-  unsigned int i;
+  GBFS_HOST gh;
+  const GBFS_FILE *file;
+  size_t n_written = 0;
+  unsigned long problems = 0;
+  char *label;
+  const char *path;
+  int verify = 0, manifest = 0, json = 0, hash_type = HASH_CRC32, c;
+  int several, failed = 0;
+  unsigned int jobs = parallel_default_jobs();
 
-  if(argc != 2 || strequ("-h", argv[1]) || strequ("--help", argv[1]))
+  while((c = getopt_long(argc, argv, "hj:", long_options, NULL)) != -1)
   {
-    fputs("lists the objects in a gbfs file\n"
-          "syntax: lsgbfs FILE\n", stderr);
+    switch(c)
+    {
+    case 'v':
+      verify = 1;
+      break;
+    case 'm':
+      manifest = 1;
+      if(!optarg || !strcmp(optarg, "csv"))
+        json = 0;
+      else if(!strcmp(optarg, "json"))
+        json = 1;
+      else
+      {
+        fprintf(stderr, "unknown manifest format %s\n", optarg);
+        return 1;
+      }
+      break;
+    case 'H':
+      for(hash_type = 0; hash_type <= HASH_XXH64; hash_type++)
+        if(!strcmp(optarg, hash_names[hash_type]))
+          break;
+      if(hash_type > HASH_XXH64)
+      {
+        fprintf(stderr, "unknown hash %s\n", optarg);
+        return 1;
+      }
+      break;
+    case 'j':
+      jobs = strtoul(optarg, NULL, 0);
+      if(jobs < 1)
+      {
+        fprintf(stderr, "invalid job count %s\n", optarg);
+        return 1;
+      }
+      break;
+    default:
+      fputs(help_text, stderr);
+      return 1;
+    }
+  }
+
+  if(argc - optind != 1)
+  {
+    fputs(help_text, stderr);
     return 1;
   }
+  path = argv[optind];
 
-  fp = fopen(argv[1], "rb");
-  if(!fp)
+  switch(gbfs_host_open(&gh, path))
   {
+  case GBFS_HOST_IO_ERROR:
     fputs("could not open ", stderr);
-    perror(argv[1]);
+    perror(path);
+    return 1;
+  case GBFS_HOST_NOT_GBFS:
+    fprintf(stderr, "%s: not a GBFS file\n", path);
+    return 1;
+  }
+
+  /* a ROM may hold several archives: name each by its offset */
+  several = (const unsigned char *)gh.file != gh.map.data
+            || find_first_gbfs_file(skip_gbfs_file(gh.file));
+  label = malloc(strlen(path) + 24);
+  if(!label)
+  {
+    perror("could not allocate memory");
+    gbfs_host_close(&gh);
     return 1;
   }
 
-  /* read pertinent header fields */
-  fseek(fp, 20, SEEK_SET);
-  dir_off = fgeti16(fp);
-  dir_nmemb = fgeti16(fp);
+  if(verify)
+  {
+    for(file = gh.file; file;
+        file = find_first_gbfs_file(skip_gbfs_file(file)))
+    {
+      unsigned long found;
+
+      make_label(label, path, several ? file : NULL, gh.map.data);
+      found = verify_archive(label, file);
+      if(found)
+        fprintf(stderr, "%s: %lu problems found\n", label, found);
+      else if(!manifest)
+        printf("%s: %lu objects OK\n", label,
+               (unsigned long)gbfs_count_objs(file));
+      problems += found;
+    }
+
+    if(problems || !manifest)
+    {
+      free(label);
+      gbfs_host_close(&gh);
+      return problems ? 1 : 0;
+    }
+  }
 
-  for(i = 0; i < dir_nmemb; i++)
+  if(manifest)
   {
-    unsigned long len;
+    if(json)
+      puts("[");
+    else
+      printf("name,offset,length,alignment,%s\n", hash_names[hash_type]);
+  }
 
-    fseek(fp, dir_off + 32 * i, SEEK_SET);
-    fread(filename, 24, 1, fp);
-    len = fgeti32(fp);
-    printf("%10lu %s\n", (unsigned long)len, filename);
+  for(file = gh.file; file && !failed;
+      file = find_first_gbfs_file(skip_gbfs_file(file)))
+  {
+    make_label(label, path, several ? file : NULL, gh.map.data);
+    if(manifest)
+      failed = manifest_archive(label, file, gh.map.data, hash_type, json,
+                                jobs, &n_written);
+    else
+    {
+      if(several)
+        printf("%s%s:\n", file == gh.file ? "" : "\n", label);
+      failed = list_archive(label, file);
+    }
   }
 
-  fclose(fp);
-  return 0;
+  if(manifest && json)
+    fputs(n_written ? "\n]\n" : "]\n", stdout);
+
+  free(label);
+  gbfs_host_close(&gh);
+  return failed ? 1 : 0;
 }
@@ -0,0 +1,131 @@
+/*------------------------------------------------------------------------------
+ * This file is part of gba-tools.
+ *
+ * gba-tools is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * gba-tools is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with gba-tools.  If not, see <http://www.gnu.org/licenses/>.
+ *----------------------------------------------------------------------------*/
+/** @file lzfast.c
+ *  @brief Fast-decode LZ reference decoder
+ *
+ *  Portable C with full bounds checking.  It is used by gbalzss on the host
+ *  and can be built for the GBA as-is; lzfast_arm.s is the unchecked IWRAM
+ *  version of the same loop.
+ */
+#include "lzfast.h"
+
+/** @brief Read an LZ4-style length extension
+ *  @param[in,out] src Stream position
+ *  @param[in]     end End of stream
+ *  @param[in,out] len Length to extend
+ *  @returns 0 on success
+ *  @retval -1 if the stream ends inside the extension
+ */
+static int
+read_ext(const unsigned char **src, const unsigned char *end, size_t *len)
+{
+  unsigned char c;
+
+  do
+  {
+    if(*src >= end)
+      return -1;
+
+    c = *(*src)++;
+    *len += c;
+  } while(c == 255);
+
+  return 0;
+}
+
+long
+lzfast_decoded_size(const void *src, size_t src_len)
+{
+  const unsigned char *p = (const unsigned char*)src;
+
+  if(src_len < 4 || p[0] != LZFAST_TYPE)
+    return -1;
+
+  return p[1] | (p[2] << 8) | ((long)p[3] << 16);
+}
+
+int
+lzfast_decode(const void *src, size_t src_len, void *dst, size_t dst_len)
+{
+  const unsigned char *base = (const unsigned char*)src;
+  const unsigned char *in   = base + 4;
+  const unsigned char *end  = base + src_len;
+  unsigned char       *out  = (unsigned char*)dst;
+  unsigned char       *out_end;
+  long                size  = lzfast_decoded_size(src, src_len);
+
+  if(size < 0 || (size_t)size > dst_len)
+    return -1;
+
+  out_end = out + size;
+
+  while(out < out_end)
+  {
+    unsigned char token;
+    size_t        len, disp;
+
+    if(in >= end)
+      return -1;
+
+    token = *in++;
+
+    // literal run
+    len = token >> 4;
+    if(len == 15 && read_ext(&in, end, &len) != 0)
+      return -1;
+
+    if(len)
+    {
+      // literals start on a word boundary
+      in = base + (((in - base) + 3) & ~3);
+
+      if(len > (size_t)(end - in) || len > (size_t)(out_end - out))
+        return -1;
+
+      while(len--)
+        *out++ = *in++;
+    }
+
+    if(out >= out_end)
+      break;
+
+    // match
+    if(end - in < 2)
+      return -1;
+
+    disp  = in[0] | (in[1] << 8);
+    disp += 1;
+    in   += 2;
+
+    len = token & 0x0F;
+    if(len == 15 && read_ext(&in, end, &len) != 0)
+      return -1;
+    len += LZFAST_MIN_LEN;
+
+    if(disp > (size_t)(out - (unsigned char*)dst)
+    || len > (size_t)(out_end - out))
+      return -1;
+
+    while(len--)
+    {
+      *out = *(out - disp);
+      ++out;
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,80 @@
+/*------------------------------------------------------------------------------
+ * This file is part of gba-tools.
+ *
+ * gba-tools is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * gba-tools is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with gba-tools.  If not, see <http://www.gnu.org/licenses/>.
+ *----------------------------------------------------------------------------*/
+/** @file lzfast.h
+ *  @brief Fast-decode LZ format
+ *
+ *  The stream begins with a GBA-style header: one type byte (LZFAST_TYPE)
+ *  followed by the 24-bit little-endian decompressed size.  The rest of the
+ *  stream is a sequence of byte-aligned tokens; there are no flag bits.
+ *
+ *  Each sequence is encoded as:
+ *
+ *    token          LLLLMMMM
+ *    [lit ext]      if L == 15, bytes added to L until a byte != 255
+ *    [pad]          if L != 0, zero bytes up to a 4-byte stream offset
+ *    literals       L bytes, copied verbatim
+ *    disp           16-bit little-endian displacement minus one
+ *    [match ext]    if M == 15, bytes added to M until a byte != 255
+ *
+ *  and copies M + LZFAST_MIN_LEN bytes from disp + 1 bytes back in the
+ *  output.  Decoding stops as soon as the output reaches the size given in
+ *  the header, either after the literals or after the match.
+ *
+ *  Literal runs always start on a word boundary in the stream, so a decoder
+ *  writing to a word-aligned destination can copy them with word loads and
+ *  stores.  The output must go to byte-writable memory (EWRAM or IWRAM).
+ */
+#ifndef LZFAST_H
+#define LZFAST_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief Fast LZ header type byte */
+#define LZFAST_TYPE    0x70
+
+/** @brief Fast LZ minimum match length */
+#define LZFAST_MIN_LEN 4
+
+/** @brief Fast LZ maximum encodable displacement */
+#define LZFAST_MAX_DISP 65536
+
+/** @brief Get the decompressed size of a fast LZ stream
+ *  @param[in] src     Compressed stream
+ *  @param[in] src_len Length of compressed stream
+ *  @returns Decompressed size
+ *  @retval -1 for an invalid header
+ */
+long lzfast_decoded_size(const void *src, size_t src_len);
+
+/** @brief Decompress a fast LZ stream
+ *  @param[in]  src     Compressed stream
+ *  @param[in]  src_len Length of compressed stream
+ *  @param[out] dst     Output buffer
+ *  @param[in]  dst_len Size of output buffer
+ *  @returns 0 on success
+ *  @retval -1 if the stream is malformed or does not fit in dst
+ */
+int lzfast_decode(const void *src, size_t src_len, void *dst, size_t dst_len);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
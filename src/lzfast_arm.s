@@ -0,0 +1,138 @@
+@------------------------------------------------------------------------------
+@ This file is part of gba-tools.
+@
+@ gba-tools is free software: you can redistribute it and/or modify
+@ it under the terms of the GNU General Public License as published by
+@ the Free Software Foundation, either version 3 of the License, or
+@ (at your option) any later version.
+@
+@ gba-tools is distributed in the hope that it will be useful,
+@ but WITHOUT ANY WARRANTY; without even the implied warranty of
+@ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+@ GNU General Public License for more details.
+@
+@ You should have received a copy of the GNU General Public License
+@ along with gba-tools.  If not, see <http://www.gnu.org/licenses/>.
+@------------------------------------------------------------------------------
+@ lzfast_arm.s
+@ Fast LZ decoder for the GBA (see lzfast.h for the stream format)
+@
+@ void lzfast_decode_arm(const void *src, void *dst);
+@
+@ src must be word aligned.  dst must be byte-writable (EWRAM or IWRAM);
+@ decompress to WRAM and DMA the result if it is meant for VRAM.  No bounds
+@ checking is done, so only feed it streams produced by gbalzss --fast.
+@
+@ The routine is ARM code placed in IWRAM and may be called from Thumb.
+@------------------------------------------------------------------------------
+
+	.syntax	unified
+
+	.section .iwram, "ax", %progbits
+	.align	2
+	.arm
+	.global	lzfast_decode_arm
+	.type	lzfast_decode_arm, %function
+
+lzfast_decode_arm:
+	stmfd	sp!, {r4-r6, lr}
+
+	ldr	r2, [r0], #4		@ r2 = header
+	add	r2, r1, r2, lsr #8	@ r2 = end of output
+	cmp	r1, r2
+	beq	.Ldone
+
+.Ltoken:
+	ldrb	r3, [r0], #1		@ r3 = token
+	movs	r4, r3, lsr #4		@ r4 = literal count
+	beq	.Lmatch
+
+	cmp	r4, #15
+	bne	.Llit_align
+.Llit_ext:
+	ldrb	r5, [r0], #1
+	add	r4, r4, r5
+	cmp	r5, #255
+	beq	.Llit_ext
+
+.Llit_align:
+	add	r0, r0, #3		@ literals start on a word boundary
+	bic	r0, r0, #3
+
+	tst	r1, #3			@ byte copy if dst is unaligned
+	bne	.Llit_bytes
+
+	subs	r4, r4, #8
+	bcc	.Llit_word
+.Llit_dwords:
+	ldmia	r0!, {r5, r6}
+	stmia	r1!, {r5, r6}
+	subs	r4, r4, #8
+	bcs	.Llit_dwords
+.Llit_word:
+	adds	r4, r4, #4		@ at most one word left
+	ldrpl	r5, [r0], #4
+	strpl	r5, [r1], #4
+	subpl	r4, r4, #4
+	adds	r4, r4, #4		@ 0-3 bytes left
+	beq	.Llit_done
+
+.Llit_bytes:
+	ldrb	r5, [r0], #1
+	strb	r5, [r1], #1
+	subs	r4, r4, #1
+	bne	.Llit_bytes
+
+.Llit_done:
+	cmp	r1, r2
+	bhs	.Ldone
+
+.Lmatch:
+	ldrb	r5, [r0], #1		@ r5 = displacement
+	ldrb	r6, [r0], #1
+	orr	r5, r5, r6, lsl #8
+	add	r5, r5, #1
+	sub	r5, r1, r5		@ r5 = match source
+
+	and	r4, r3, #15		@ r4 = match length
+	cmp	r4, #15
+	bne	.Lmatch_copy
+.Lmatch_ext:
+	ldrb	r6, [r0], #1
+	add	r4, r4, r6
+	cmp	r6, #255
+	beq	.Lmatch_ext
+
+.Lmatch_copy:
+	@ length is at least 4: copy the minimum, then pairs of bytes
+	ldrb	r6, [r5], #1
+	strb	r6, [r1], #1
+	ldrb	r6, [r5], #1
+	strb	r6, [r1], #1
+	ldrb	r6, [r5], #1
+	strb	r6, [r1], #1
+	ldrb	r6, [r5], #1
+	strb	r6, [r1], #1
+
+	tst	r4, #1
+	ldrbne	r6, [r5], #1
+	strbne	r6, [r1], #1
+	movs	r4, r4, lsr #1
+	beq	.Lmatch_done
+.Lmatch_pairs:
+	ldrb	r6, [r5], #1
+	strb	r6, [r1], #1
+	ldrb	r6, [r5], #1
+	strb	r6, [r1], #1
+	subs	r4, r4, #1
+	bne	.Lmatch_pairs
+
+.Lmatch_done:
+	cmp	r1, r2
+	blo	.Ltoken
+
+.Ldone:
+	ldmfd	sp!, {r4-r6, lr}
+	bx	lr
+
+	.size	lzfast_decode_arm, . - lzfast_decode_arm
@@ -0,0 +1,1362 @@
+/*------------------------------------------------------------------------------
+ * Copyright (c) 2017
+ *     Michael Theall (mtheall)
+ *
+ * This file is part of gba-tools.
+ *
+ * gbalzss is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * gbalzss is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with gbalzss.  If not, see <http://www.gnu.org/licenses/>.
+ *----------------------------------------------------------------------------*/
+/** @file lzss.cpp
+ *  @brief GBA LZSS Encoder/Decoder
+ */
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "lzss.h"
+
+namespace
+{
+
+/** @brief LZ10 maximum match length */
+#define LZ10_MAX_LEN  18
+
+/** @brief LZ10 maximum displacement */
+#define LZ10_MAX_DISP 4096
+
+/** @brief LZ11 maximum match length */
+#define LZ11_MAX_LEN  65808
+
+/** @brief LZ11 maximum displacement */
+#define LZ11_MAX_DISP 4096
+
+/** @brief Fast LZ maximum match length searched by the encoder */
+#define LZFAST_MAX_LEN  65536
+
+/** @brief Fast LZ displacement searched by the encoder */
+#define LZFAST_WINDOW   4096
+
+/** @brief Pre-scan hash table size (log2) */
+#define PRESCAN_HASH_BITS 12
+
+/** @brief Order-0 entropy (bits per byte) above which data looks like noise */
+#define PRESCAN_MAX_ENTROPY 7.0
+
+/** @brief Fraction of repeated positions below which LZ cannot pay for its
+ *  flag and token overhead
+ */
+#define PRESCAN_MIN_REPEATS 0.10
+
+/** @brief Find last instance of a byte in a buffer
+ *  @param[in] first Beginning of buffer
+ *  @param[in] last  End of buffer
+ *  @param[in] val   Byte to find
+ *
+ *  @returns iterator to found byte
+ *  @retval last if no match found
+ */
+Buffer::const_iterator
+rfind(Buffer::const_iterator first, Buffer::const_iterator last,
+      const uint8_t &val)
+{
+  assert(last >= first);
+
+  auto it = last;
+  while(--it >= first)
+  {
+    if(*it == val)
+      return it;
+  }
+
+  return last;
+}
+
+/** @brief Find best buffer match
+ *  @param[in]  source   Source buffer
+ *  @param[in]  it       Position in source buffer
+ *  @param[in]  len      Maximum length to match
+ *  @param[in]  max_disp Maximum displacement
+ *  @param[in]  vram     VRAM-safe
+ *  @param[out] outlen   Length of match
+ *  @returns Iterator to best match
+ *  @retval source.cend() for no match
+ */
+Buffer::const_iterator
+find_best_match(const Buffer &source, Buffer::const_iterator it, size_t len,
+                size_t max_disp, bool vram, size_t &outlen)
+{
+  auto begin = source.cbegin();
+  auto end   = source.cend();
+
+  assert(it > source.cbegin());
+  assert(it < source.cend());
+
+  // clamp start to maximum displacement from buffer
+  if(it - begin > static_cast<ptrdiff_t>(max_disp))
+    begin = it - max_disp;
+
+  // clamp len to end of buffer
+  if(end - it < static_cast<ptrdiff_t>(len))
+    len = end - it;
+
+  auto   best_start = it;
+  size_t best_len = 0;
+
+  // find nearest matching start byte
+  auto last_p = it;
+  auto p = rfind(begin, last_p, *it);
+  while(p != last_p)
+  {
+    // find length of match
+    size_t test_len = 1;
+    for(size_t i = 1; i < len; ++i)
+    {
+      if(*(p+i) == *(it+i))
+        ++test_len;
+      else
+        break;
+    }
+
+    // vram requires displacement != 1
+    if(vram && (it - p) == 1)
+      test_len = 0;
+
+    if(test_len >= best_len)
+    {
+      // this match is the best so far, so save it
+      best_start = p;
+      best_len   = test_len;
+    }
+
+    // if we maximized the match, stop here
+    if(best_len == len)
+      break;
+
+    // find next nearest matching byte and try again
+    last_p = p;
+    p = rfind(begin, last_p, *it);
+  }
+
+  if(best_len)
+  {
+    // we found a match, so return it
+    outlen = best_len;
+    return best_start;
+  }
+
+  // no match found
+  outlen = 0;
+  return source.cend();
+}
+
+/** @brief Output a GBA-style compression header
+ *  @param[out] header Output header
+ *  @param[in]  type   Compression type
+ *  @param[in]  size   Uncompressed data size
+ */
+void
+header(Buffer &buffer, uint8_t type, size_t size)
+{
+  buffer.push_back(type);
+  buffer.push_back(size >>  0);
+  buffer.push_back(size >>  8);
+  buffer.push_back(size >> 16);
+}
+
+/** @brief LZ token */
+struct Token
+{
+  size_t len;  ///< Number of bytes produced (1 for a literal)
+  size_t disp; ///< Match displacement (0 for a literal)
+};
+
+/** @brief Sequence of tokens covering a buffer */
+typedef std::vector<Token> Parse;
+
+/** @brief LZ10/LZ11 parse
+ *
+ *  Parses source[begin, end).  Matches may refer to any data before them but
+ *  never extend past end, so the result can be spliced into a larger parse.
+ *
+ *  @param[in] source Source buffer
+ *  @param[in] begin  Offset of first byte to parse
+ *  @param[in] end    Offset past last byte to parse
+ *  @param[in] mode   LZ mode
+ *  @param[in] vram   VRAM-safe
+ *  @returns Parsed tokens
+ */
+Parse
+lzss_parse(const Buffer &source, size_t begin, size_t end, LZSS_t mode,
+           bool vram)
+{
+  // get maximum match length
+  const size_t max_len  = mode == LZ10 ? LZ10_MAX_LEN  : LZ11_MAX_LEN;
+
+  // get maximum displacement
+  const size_t max_disp = mode == LZ10 ? LZ10_MAX_DISP : LZ11_MAX_DISP;
+
+  assert(mode == LZ10 || mode == LZ11);
+  assert(begin <= end && end <= source.size());
+
+  Parse parse;
+
+  // encode every byte
+  auto it = source.cbegin() + begin;
+  auto last = source.cbegin() + end;
+  while(it < last)
+  {
+    const size_t len = last - it;
+    auto         tmp = source.cend();
+    size_t       tmplen = 0;
+
+    if(it == source.cbegin())
+    {
+      // beginning of stream must be primed with at least one value
+      tmplen = 1;
+    }
+    else
+    {
+      // find best match
+      tmp = find_best_match(source, it, std::min(len, max_len), max_disp, vram,
+                            tmplen);
+      if(tmp != source.cend())
+      {
+        assert(!vram || tmp - it != 1);
+        assert(tmp >= source.cbegin());
+        assert(tmp < it);
+        assert(it - tmp <= static_cast<ptrdiff_t>(max_disp));
+        assert(tmplen <= max_len);
+        assert(tmplen <= len);
+        assert(std::equal(it, it+tmplen, tmp));
+      }
+    }
+
+    if(tmplen > 2 && tmplen < len)
+    {
+      // this match is long enough to be compressed; let's check if it's
+      // cheaper to encode this byte as a copy and start compression at the
+      // next byte
+      size_t skip_len, next_len;
+
+      // get best match starting at the next byte
+      find_best_match(source, it+1, std::min(len-1, max_len), max_disp, vram,
+                      skip_len);
+
+      // check if the match is too small to compress
+      if(skip_len < 3)
+        skip_len = 1;
+
+      // get best match for data following the current compressed chunk
+      find_best_match(source, it+tmplen, std::min(len-tmplen, max_len),
+                      max_disp, vram, next_len);
+
+      // check if the match is too small to compress
+      if(next_len < 3)
+        next_len = 1;
+
+      // if compressing this chunk and the next chunk is less valuable than
+      // skipping this byte and starting compression at the next byte, mark
+      // this byte as being needed to copy
+      if(tmplen + next_len <= skip_len + 1)
+        tmplen = 1;
+    }
+
+    if(tmplen < 3)
+    {
+      // this is a copy chunk; only one byte is copied
+      parse.push_back({1, 0});
+      tmplen = 1;
+    }
+    else
+    {
+      // this chunk is compressed
+      parse.push_back({tmplen, static_cast<size_t>(it - tmp)});
+    }
+
+    // advance input buffer
+    it += tmplen;
+  }
+
+  return parse;
+}
+
+/** @brief LZ10/LZ11 stream output
+ *  @param[in] source Source buffer
+ *  @param[in] parse  Tokens covering the whole source buffer
+ *  @param[in] mode   LZ mode
+ *  @returns Compressed buffer
+ */
+Buffer
+lzss_serialize(const Buffer &source, const Parse &parse, LZSS_t mode)
+{
+  assert(mode == LZ10 || mode == LZ11);
+
+  // create output buffer
+  Buffer result;
+
+  // append compression header
+  header(result, mode, source.size());
+
+  // reserve an encode byte in output buffer
+  size_t code_pos = result.size();
+  result.push_back(0);
+
+  // initialize shift
+  size_t shift = 8;
+
+  auto it = source.cbegin();
+  for(const Token &token : parse)
+  {
+    const size_t tmplen = token.len;
+
+    if(shift == 0)
+    {
+      // we need to encode more data, so add a new code byte
+      shift = 8;
+      code_pos = result.size();
+      result.push_back(0);
+    }
+
+    // advance code byte bit position
+    if(shift != 0)
+      --shift;
+
+    if(token.disp == 0)
+    {
+      // this is a copy chunk; append this byte to the output buffer
+      assert(tmplen == 1);
+      result.push_back(*it);
+    }
+    else if(mode == LZ10)
+    {
+      // mark this chunk as compressed
+      assert(code_pos < result.size());
+      result[code_pos] |= (1 << shift);
+
+      // encode the displacement and length
+      size_t disp = token.disp - 1;
+      assert(tmplen-3 <= 0xF);
+      assert(disp <= 0xFFF);
+      result.push_back(((tmplen-3) << 4) | (disp >> 8));
+      result.push_back(disp);
+    }
+    else if(tmplen <= 0x10)
+    {
+      // mark this chunk as compressed
+      assert(code_pos < result.size());
+      result[code_pos] |= (1 << shift);
+
+      // encode the displacement and length
+      size_t disp = token.disp - 1;
+      assert(tmplen > 2);
+      assert(tmplen-1 <= 0xF);
+      assert(disp <= 0xFFF);
+      result.push_back(((tmplen-1) << 4) | (disp >> 8));
+      result.push_back(disp);
+    }
+    else if(tmplen <= 0x110)
+    {
+      // mark this chunk as compressed
+      assert(code_pos < result.size());
+      result[code_pos] |= (1 << shift);
+
+      // encode the displacement and length
+      size_t disp = token.disp - 1;
+      assert(tmplen >= 0x11);
+      assert(tmplen-0x11 <= 0xFF);
+      assert(disp <= 0xFFF);
+      result.push_back((tmplen-0x11) >> 4);
+      result.push_back(((tmplen-0x11) << 4) | (disp >> 8));
+      result.push_back(disp);
+    }
+    else
+    {
+      // mark this chunk as compressed
+      assert(code_pos < result.size());
+      result[code_pos] |= (1 << shift);
+
+      // encode the displacement and length
+      size_t disp = token.disp - 1;
+      assert(tmplen >= 0x111);
+      assert(tmplen-0x111 <= 0xFFFF);
+      assert(disp <= 0xFFF);
+      result.push_back((1 << 4) | (tmplen-0x111) >> 12);
+      result.push_back(((tmplen-0x111) >> 4));
+      result.push_back(((tmplen-0x111) << 4) | (disp >> 8));
+      result.push_back(disp);
+    }
+
+    // advance input buffer
+    it += tmplen;
+  }
+
+  assert(it == source.cend());
+
+  // pad the output buffer to 4 bytes
+  if(result.size() & 0x3)
+    result.resize((result.size()+3) & ~0x3);
+
+  // return the output data
+  return result;
+}
+
+/** @brief LZ10/LZ11 compression
+ *  @param[in] source Source buffer
+ *  @param[in] mode   LZ mode
+ *  @param[in] vram   VRAM-safe
+ *  @returns Compressed buffer
+ */
+Buffer
+lzss_encode(const Buffer &source, LZSS_t mode, bool vram)
+{
+  return lzss_serialize(source,
+                        lzss_parse(source, 0, source.size(), mode, vram),
+                        mode);
+}
+
+/** @brief Append a fast LZ length extension
+ *  @param[out] buffer Output buffer
+ *  @param[in]  len    Length remaining after the token nibble
+ */
+void
+fast_ext(Buffer &buffer, size_t len)
+{
+  while(len >= 255)
+  {
+    buffer.push_back(255);
+    len -= 255;
+  }
+
+  buffer.push_back(len);
+}
+
+/** @brief Append a fast LZ sequence
+ *  @param[out] buffer Output buffer
+ *  @param[in]  lit    Beginning of literal run
+ *  @param[in]  it     End of literal run
+ *  @param[in]  disp   Match displacement
+ *  @param[in]  len    Match length (0 for a final literal-only sequence)
+ */
+void
+fast_sequence(Buffer &buffer, Buffer::const_iterator lit,
+              Buffer::const_iterator it, size_t disp, size_t len)
+{
+  const size_t nlit = it - lit;
+  const size_t mlen = len ? len - LZFAST_MIN_LEN : 0;
+
+  assert(!len || len >= LZFAST_MIN_LEN);
+  assert(!len || (disp > 0 && disp <= LZFAST_MAX_DISP));
+
+  buffer.push_back((std::min<size_t>(nlit, 15) << 4)
+                  | std::min<size_t>(mlen, 15));
+
+  if(nlit >= 15)
+    fast_ext(buffer, nlit - 15);
+
+  if(nlit)
+  {
+    // literal runs start on a word boundary
+    buffer.resize((buffer.size()+3) & ~0x3);
+    buffer.insert(std::end(buffer), lit, it);
+  }
+
+  if(len)
+  {
+    buffer.push_back((disp-1) >> 0);
+    buffer.push_back((disp-1) >> 8);
+
+    if(mlen >= 15)
+      fast_ext(buffer, mlen - 15);
+  }
+}
+
+/** @brief Fast LZ parse
+ *
+ *  Parses source[begin, end) like lzss_parse.
+ *
+ *  @param[in] source Source buffer
+ *  @param[in] begin  Offset of first byte to parse
+ *  @param[in] end    Offset past last byte to parse
+ *  @returns Parsed tokens
+ */
+Parse
+fast_parse(const Buffer &source, size_t begin, size_t end)
+{
+  const size_t max_len  = LZFAST_MAX_LEN;
+  const size_t max_disp = LZFAST_WINDOW;
+
+  assert(begin <= end && end <= source.size());
+
+  Parse parse;
+
+  auto it   = source.cbegin() + begin;
+  auto last = source.cbegin() + end;
+  while(it < last)
+  {
+    const size_t len = last - it;
+    auto         tmp = source.cend();
+    size_t       tmplen = 0;
+
+    // beginning of stream must be primed with at least one literal
+    if(it != source.cbegin())
+      tmp = find_best_match(source, it, std::min(len, max_len), max_disp,
+                            false, tmplen);
+
+    if(tmplen >= LZFAST_MIN_LEN && tmplen < len)
+    {
+      // defer to a longer match starting at the next byte
+      size_t skip_len;
+      find_best_match(source, it+1, std::min(len-1, max_len), max_disp, false,
+                      skip_len);
+
+      if(skip_len > tmplen + 1)
+        tmplen = 0;
+    }
+
+    if(tmplen < LZFAST_MIN_LEN)
+    {
+      // extend the literal run
+      parse.push_back({1, 0});
+      ++it;
+      continue;
+    }
+
+    assert(std::equal(it, it+tmplen, tmp));
+    parse.push_back({tmplen, static_cast<size_t>(it - tmp)});
+
+    // advance input buffer
+    it += tmplen;
+  }
+
+  return parse;
+}
+
+/** @brief Fast LZ stream output
+ *  @param[in] source Source buffer
+ *  @param[in] parse  Tokens covering the whole source buffer
+ *  @returns Compressed buffer
+ */
+Buffer
+fast_serialize(const Buffer &source, const Parse &parse)
+{
+  // create output buffer
+  Buffer result;
+
+  // append compression header
+  header(result, LZFAST, source.size());
+
+  auto it  = source.cbegin();
+  auto lit = it;
+  for(const Token &token : parse)
+  {
+    if(token.disp != 0)
+    {
+      // a match closes the pending literal run
+      fast_sequence(result, lit, it, token.disp, token.len);
+      lit = it + token.len;
+    }
+
+    it += token.len;
+  }
+
+  assert(it == source.cend());
+
+  // flush trailing literals
+  if(lit < it)
+    fast_sequence(result, lit, it, 0, 0);
+
+  // pad the output buffer to 4 bytes
+  if(result.size() & 0x3)
+    result.resize((result.size()+3) & ~0x3);
+
+  return result;
+}
+
+/** @brief Recover the parse of an LZ stream
+ *
+ *  Walks the tokens of a stream without decompressing it, checking that every
+ *  token is well formed.
+ *
+ *  @param[in] source Compressed buffer
+ *  @param[in] mode   LZ mode
+ *  @returns Parsed tokens
+ */
+Parse
+read_parse(const Buffer &source, LZSS_t mode)
+{
+  if(source.size() < 4 || source[0] != mode)
+    throw std::runtime_error("Error: Invalid LZ header");
+
+  size_t size = source[1] | (source[2] << 8) | (source[3] << 16);
+  size_t pos  = 0;
+
+  auto src = source.cbegin() + 4;
+  auto end = source.cend();
+
+  // read the next stream byte
+  auto next = [&]() -> uint8_t
+  {
+    if(src >= end)
+      throw std::runtime_error("Error: Truncated LZ stream");
+    return *src++;
+  };
+
+  // read an LZ4-style length extension
+  auto ext = [&](size_t &len)
+  {
+    uint8_t c;
+    do
+    {
+      c = next();
+      len += c;
+    } while(c == 255);
+  };
+
+  Parse parse;
+
+  if(mode == LZFAST)
+  {
+    while(pos < size)
+    {
+      uint8_t token = next();
+
+      size_t nlit = token >> 4;
+      if(nlit == 15)
+        ext(nlit);
+
+      if(nlit)
+      {
+        // literals start on a word boundary
+        src = source.cbegin() + (((src - source.cbegin()) + 3) & ~0x3);
+        if(src > end || static_cast<size_t>(end - src) < nlit)
+          throw std::runtime_error("Error: Truncated LZ stream");
+
+        src += nlit;
+        parse.insert(std::end(parse), nlit, Token{1, 0});
+        pos += nlit;
+      }
+
+      if(pos >= size)
+        break;
+
+      size_t disp = next();
+      disp |= next() << 8;
+      ++disp;
+
+      size_t len = token & 0x0F;
+      if(len == 15)
+        ext(len);
+      len += LZFAST_MIN_LEN;
+
+      if(disp > pos)
+        throw std::runtime_error("Error: LZ displacement before start of "
+                                 "output");
+
+      parse.push_back({len, disp});
+      pos += len;
+    }
+  }
+  else
+  {
+    uint8_t flags = 0;
+    uint8_t mask  = 0;
+
+    while(pos < size)
+    {
+      if(mask == 0)
+      {
+        flags = next();
+        mask  = 0x80;
+      }
+
+      if(flags & mask)
+      {
+        uint8_t b = next();
+        size_t  len;
+
+        if(mode == LZ10)
+          len = (b >> 4) + 3;
+        else if((b >> 4) == 0)
+        {
+          len  = b << 4;
+          b    = next();
+          len |= b >> 4;
+          len += 0x11;
+        }
+        else if((b >> 4) == 1)
+        {
+          len  = (b & 0x0F) << 12;
+          len |= next() << 4;
+          b    = next();
+          len |= b >> 4;
+          len += 0x111;
+        }
+        else
+          len = (b >> 4) + 1;
+
+        size_t disp = ((b & 0x0F) << 8) | next();
+        ++disp;
+
+        if(disp > pos)
+          throw std::runtime_error("Error: LZ displacement before start of "
+                                   "output");
+
+        parse.push_back({len, disp});
+        pos += len;
+      }
+      else
+      {
+        next();
+        parse.push_back({1, 0});
+        ++pos;
+      }
+
+      mask >>= 1;
+    }
+  }
+
+  if(pos != size)
+    throw std::runtime_error("Error: LZ token exceeds output length");
+
+  return parse;
+}
+
+}
+
+/** @brief Estimate whether a buffer is worth compressing
+ *
+ *  Computes the order-0 entropy of the buffer and its repeat density: the
+ *  fraction of positions whose next three bytes also occur at the most recent
+ *  position with the same hash inside the 4 KB window.  Both take one linear
+ *  pass, which is far cheaper than the match search in lzss_encode.
+ *
+ *  @param[in] source Source buffer
+ *  @returns Whether the buffer is judged incompressible
+ */
+bool
+incompressible(const Buffer &source)
+{
+  const size_t size = source.size();
+  if(size < 3)
+    return false;
+
+  size_t              counts[256] = { 0 };
+  std::vector<size_t> last(1 << PRESCAN_HASH_BITS, size);
+  size_t              repeats = 0;
+
+  for(size_t i = 0; i < size; ++i)
+  {
+    ++counts[source[i]];
+
+    if(i + 3 > size)
+      continue;
+
+    // hash the next three bytes
+    uint32_t h = source[i] | (source[i+1] << 8) | (source[i+2] << 16);
+    h = (h * 2654435761U) >> (32 - PRESCAN_HASH_BITS);
+
+    size_t j = last[h];
+    last[h] = i;
+
+    if(j < i && i - j <= LZ10_MAX_DISP
+    && source[i] == source[j] && source[i+1] == source[j+1]
+    && source[i+2] == source[j+2])
+      ++repeats;
+  }
+
+  double entropy = 0.0;
+  for(size_t count : counts)
+  {
+    if(count)
+    {
+      double p = static_cast<double>(count) / size;
+      entropy -= p * std::log2(p);
+    }
+  }
+
+  return entropy > PRESCAN_MAX_ENTROPY
+      && repeats < PRESCAN_MIN_REPEATS * size;
+}
+
+/** @brief LZ10 compression
+ *  @param[in] source Source buffer
+ *  @param[in] vram   VRAM-safe
+ *  @returns Compressed buffer
+ */
+Buffer
+lz10_encode(const Buffer &source, bool vram)
+{
+  return lzss_encode(source, LZ10, vram);
+}
+
+/** @brief LZ11 compression
+ *  @param[in] source Source buffer
+ *  @param[in] vram   VRAM-safe
+ *  @returns Compressed buffer
+ */
+Buffer
+lz11_encode(const Buffer &source, bool vram)
+{
+  return lzss_encode(source, LZ11, vram);
+}
+
+/** @brief Check that a stream holds more input
+ *  @param[in] source Source buffer
+ *  @param[in] src    Read position in source
+ *  @param[in] n      Bytes about to be read
+ *  @param[in] what   Stream type, for the error
+ */
+static void
+need_input(const Buffer &source, Buffer::const_iterator src, size_t n,
+           const char *what)
+{
+  if(static_cast<size_t>(source.cend() - src) < n)
+    throw std::runtime_error(std::string("Error: Badly encoded ") + what
+                             + " stream; it ends before the output length "
+                             "specified by its header.");
+}
+
+/** @brief LZ10 Decompression
+ *  @param[in] source Source buffer
+ *  @param[in] vram   VRAM-safe
+ *  @returns Decompressed buffer
+ */
+Buffer
+lz10_decode(const Buffer &source, bool vram)
+{
+  if(source.size() < 4 || source[0] != LZ10)
+    throw std::runtime_error("Error: Invalid LZ10 header");
+
+  size_t size = source[1] | (source[2] << 8) | (source[3] << 16);
+
+  bool printed_error = false;
+  bool printed_vram_error = false;
+
+  auto    src   = source.cbegin() + 4;
+  uint8_t flags = 0;
+  uint8_t mask  = 0;
+
+  Buffer result;
+  result.reserve(size);
+
+  while(size > 0)
+  {
+    if(mask == 0)
+    {
+      // read in the flags data
+      // from bit 7 to bit 0:
+      //     0: raw byte
+      //     1: compressed block
+      need_input(source, src, 1, "LZ10");
+      flags = *src++;
+      mask  = 0x80;
+    }
+
+    if(flags & mask) // compressed block
+    {
+      need_input(source, src, 2, "LZ10");
+      size_t len  = (((*src) & 0xF0) >> 4) + 3;
+      size_t disp = ((*src++) & 0x0F) << 8;
+      disp |= *src++;
+      ++disp;
+
+      if(len > size)
+      {
+        if(!printed_error)
+        {
+          std::fprintf(stderr, "Warning: Badly encoded LZ10 stream; compressed "
+                       "block exceeds output length specified by header. "
+                       "Truncating output.\n");
+          printed_error = true;
+        }
+
+        // truncate output
+        len = size;
+      }
+
+      if(result.size() < disp)
+        throw std::runtime_error("Error: Badly encoded LZ10 stream; encoded "
+                                 "displacement causes read prior to start of "
+                                 "output buffer.");
+
+      if(vram && !printed_vram_error)
+      {
+        if(disp == 1)
+        {
+          std::fprintf(stderr, "Warning: LZ10 stream is not vram safe.\n");
+          printed_vram_error = true;
+        }
+      }
+      
+      size -= len;
+
+      // for len, copy data from the displacement
+      // to the current buffer position
+      while(len-- > 0)
+        result.push_back(*(std::end(result)-disp));
+    }
+    else // uncompressed block
+    {
+      // copy a raw byte from the input to the output
+      need_input(source, src, 1, "LZ10");
+      result.push_back(*src++);
+      --size;
+    }
+
+    mask >>= 1;
+  }
+
+  return result;
+}
+
+/** @brief LZ11 Decompression
+ *  @param[in] source Source buffer
+ *  @param[in] vram   VRAM-safe
+ *  @returns Decompressed buffer
+ */
+Buffer
+lz11_decode(const Buffer &source, bool vram)
+{
+  if(source.size() < 4 || source[0] != LZ11)
+    throw std::runtime_error("Error: Invalid LZ11 header");
+
+  size_t size = source[1] | (source[2] << 8) | (source[3] << 16);
+
+  bool printed_error = false;
+  bool printed_vram_error = false;
+
+  auto    src   = source.cbegin() + 4;
+  uint8_t flags = 0;
+  uint8_t mask  = 0;
+
+  Buffer result;
+  result.reserve(size);
+
+  while(size > 0)
+  {
+    if(mask == 0)
+    {
+      // read in the flags data
+      // from bit 7 to bit 0:
+      //     0: raw byte
+      //     1: compressed block
+      need_input(source, src, 1, "LZ11");
+      flags = *src++;
+      mask  = 0x80;
+    }
+
+    if(flags & mask) // compressed block
+    {
+      size_t len;
+      need_input(source, src, 1, "LZ11");
+      need_input(source, src, (*src) >> 4 == 0 ? 3 : (*src) >> 4 == 1 ? 4 : 2,
+                 "LZ11");
+      switch((*src) >> 4)
+      {
+        case 0: // extended block
+          len   = (*src++) << 4;
+          len  |= ((*src) >> 4);
+          len  += 0x11;
+          break;
+
+        case 1: // extra extended block
+          len   = ((*src++) & 0x0F) << 12;
+          len  |= (*src++) << 4;
+          len  |= ((*src) >> 4);
+          len  += 0x111;
+          break;
+
+        default: // normal block
+          len   = ((*src) >> 4) + 1;
+          break;
+      }
+
+      size_t disp = ((*src++) & 0x0F) << 8;
+      disp |= *src++;
+      ++disp;
+
+      if(len > size)
+      {
+        if(!printed_error)
+        {
+          std::fprintf(stderr, "Warning: Badly encoded LZ11 stream; compressed "
+                       "block exceeds output length specified by header. "
+                       "Truncating output.\n");
+          printed_error = true;
+        }
+
+        // truncate output
+        len = size;
+      }
+
+      if(result.size() < disp)
+        throw std::runtime_error("Error: Badly encoded LZ11 stream; encoded "
+                                 "displacement causes read prior to start of "
+                                 "output buffer.");
+
+      if(vram && !printed_vram_error)
+      {
+        if(disp == 1)
+        {
+          std::fprintf(stderr, "Warning: LZ10 stream is not vram safe.\n");
+          printed_vram_error = true;
+        }
+      }
+ 
+      size -= len;
+
+      // for len, copy data from the displacement
+      // to the current buffer position
+      while(len-- > 0)
+        result.push_back(*(std::end(result)-disp));
+    }
+    else // uncompressed block
+    {
+      // copy a raw byte from the input to the output
+      need_input(source, src, 1, "LZ11");
+      result.push_back(*src++);
+      --size;
+    }
+
+    mask >>= 1;
+  }
+
+  return result;
+}
+
+/** @brief Fast LZ Decompression
+ *  @param[in] source Source buffer
+ *  @returns Decompressed buffer
+ */
+Buffer
+fast_decode(const Buffer &source)
+{
+  long size = lzfast_decoded_size(source.data(), source.size());
+  if(size < 0)
+    throw std::runtime_error("Error: Invalid fast LZ header");
+
+  Buffer result(size);
+  if(lzfast_decode(source.data(), source.size(), result.data(), result.size()))
+    throw std::runtime_error("Error: Badly encoded fast LZ stream");
+
+  return result;
+}
+
+/** @brief Fast LZ compression
+ *
+ *  The output is checked against the reference decoder before it is
+ *  returned.
+ *
+ *  @param[in] source Source buffer
+ *  @returns Compressed buffer
+ */
+Buffer
+fast_encode(const Buffer &source)
+{
+  Buffer result = fast_serialize(source, fast_parse(source, 0, source.size()));
+
+  // verify against the reference decoder
+  if(fast_decode(result) != source)
+    throw std::runtime_error("Error: Fast LZ stream failed verification");
+
+  return result;
+}
+
+/** @brief Uncompressed LZ stream
+ *
+ *  Encodes every byte as a literal, skipping the match search entirely.
+ *
+ *  @param[in] source Source buffer
+ *  @param[in] mode   LZ mode
+ *  @returns Compressed buffer
+ */
+Buffer
+literal_encode(const Buffer &source, LZSS_t mode)
+{
+  Parse parse(source.size(), Token{1, 0});
+
+  if(mode == LZFAST)
+    return fast_serialize(source, parse);
+
+  return lzss_serialize(source, parse, mode);
+}
+
+/** @brief Incremental LZ compression
+ *
+ *  Compresses source by reusing the parse of a previous version of the same
+ *  data.  Tokens that lie entirely in the unchanged prefix are kept, as are
+ *  tokens in the unchanged suffix whose matches still hold in the new data;
+ *  that is everything except the edited region and the part of the window
+ *  that referred into it.  Only the gap between them is searched again.  The
+ *  spliced stream is decompressed and checked against source, falling back to
+ *  a full encode if the previous data cannot be used.
+ *
+ *  @param[in] source     Source buffer
+ *  @param[in] old_source Previous source buffer
+ *  @param[in] old_stream Compressed previous source buffer
+ *  @param[in] mode       LZ mode
+ *  @param[in] vram       VRAM-safe
+ *  @returns Compressed buffer
+ */
+Buffer
+incremental_encode(const Buffer &source, const Buffer &old_source,
+                   const Buffer &old_stream, LZSS_t mode, bool vram)
+{
+  auto full_encode = [&]()
+  {
+    if(mode == LZFAST)
+      return fast_encode(source);
+
+    return lzss_encode(source, mode, vram);
+  };
+
+  Parse old_parse;
+  try
+  {
+    old_parse = read_parse(old_stream, mode);
+  }
+  catch(const std::runtime_error &e)
+  {
+    std::fprintf(stderr, "Warning: Previous output unusable (%s); "
+                 "re-encoding in full\n", e.what());
+    return full_encode();
+  }
+
+  // the previous parse must reproduce the previous input
+  Buffer check;
+  for(const Token &token : old_parse)
+  {
+    if(vram && token.disp == 1)
+    {
+      std::fprintf(stderr, "Warning: Previous output is not VRAM-safe; "
+                   "re-encoding in full\n");
+      return full_encode();
+    }
+
+    if(check.size() + token.len > old_source.size())
+      break;
+
+    if(token.disp == 0)
+      check.push_back(old_source[check.size()]);
+    else
+    {
+      for(size_t i = 0; i < token.len; ++i)
+        check.push_back(*(std::end(check)-token.disp));
+    }
+  }
+
+  if(check != old_source)
+  {
+    std::fprintf(stderr, "Warning: Previous output does not match previous "
+                 "input; re-encoding in full\n");
+    return full_encode();
+  }
+
+  // find unchanged prefix and suffix
+  const size_t size     = source.size();
+  const size_t old_size = old_source.size();
+  const size_t limit    = std::min(size, old_size);
+
+  size_t prefix = std::mismatch(source.cbegin(), source.cbegin() + limit,
+                                old_source.cbegin()).first - source.cbegin();
+
+  size_t suffix = std::mismatch(source.crbegin(),
+                                source.crbegin() + (limit - prefix),
+                                old_source.crbegin()).first
+                - source.crbegin();
+
+  // keep tokens that end inside the prefix
+  Parse  parse;
+  size_t pos = 0;
+  auto   tok = old_parse.cbegin();
+  while(tok != old_parse.cend() && pos + tok->len <= prefix)
+  {
+    pos += tok->len;
+    parse.push_back(*tok++);
+  }
+
+  const size_t head = pos;
+
+  // find the token starting the run of suffix tokens that still hold
+  const size_t old_suffix = old_size - suffix;
+
+  size_t old_pos = old_size;
+  auto   rtok    = old_parse.cend();
+  while(rtok != tok)
+  {
+    const Token &t = *(rtok - 1);
+    if(old_pos - t.len < old_suffix)
+      break;
+
+    // position of this token in the new source
+    size_t p = old_pos - t.len - old_size + size;
+    if(t.disp != 0
+    && (t.disp > p
+     || !std::equal(source.cbegin() + p, source.cbegin() + p + t.len,
+                    source.cbegin() + p - t.disp)))
+      break;
+
+    old_pos -= t.len;
+    --rtok;
+  }
+
+  const size_t tail = old_pos + size - old_size;
+  assert(tail >= size - suffix);
+  assert(tail >= head);
+
+  // re-search the edited region
+  Parse middle = mode == LZFAST ? fast_parse(source, head, tail)
+                                : lzss_parse(source, head, tail, mode, vram);
+
+  parse.insert(std::end(parse), std::begin(middle), std::end(middle));
+  parse.insert(std::end(parse), rtok, old_parse.cend());
+
+  Buffer result = mode == LZFAST ? fast_serialize(source, parse)
+                                 : lzss_serialize(source, parse, mode);
+
+  // verify the spliced stream
+  Buffer decoded = mode == LZFAST ? fast_decode(result)
+                 : mode == LZ11   ? lz11_decode(result, vram)
+                                  : lz10_decode(result, vram);
+  if(decoded != source)
+    throw std::runtime_error("Error: Incremental stream failed verification");
+
+  return result;
+}
+
+/** @brief Copy a buffer to malloc'd memory for C callers
+ *  @param[in]  buffer  Buffer to copy
+ *  @param[out] out     Copy of buffer
+ *  @param[out] out_len Length of copy
+ *  @returns 0 on success
+ */
+static int
+c_result(const Buffer &buffer, unsigned char **out, size_t *out_len)
+{
+  *out = static_cast<unsigned char*>(std::malloc(buffer.size() ? buffer.size() : 1));
+  if(!*out)
+    return -1;
+
+  std::memcpy(*out, buffer.data(), buffer.size());
+  *out_len = buffer.size();
+  return 0;
+}
+
+/** @brief Estimate whether data is worth compressing
+ *  @param[in] src Source data
+ *  @param[in] len Length of source data
+ *  @returns Nonzero if the data is judged incompressible
+ */
+extern "C" int
+lzss_incompressible(const void *src, size_t len)
+{
+  const uint8_t *p = static_cast<const uint8_t*>(src);
+
+  try
+  {
+    return incompressible(Buffer(p, p + len));
+  }
+  catch(...)
+  {
+    return 0;
+  }
+}
+
+/** @brief Compress data
+ *  @param[in]  src     Source data
+ *  @param[in]  len     Length of source data
+ *  @param[in]  type    LZ10, LZ11 or LZFAST
+ *  @param[in]  vram    VRAM-safe (LZ10/LZ11 only)
+ *  @param[out] out     Compressed data; release with free()
+ *  @param[out] out_len Length of compressed data
+ *  @returns 0 on success
+ *  @retval -1 on failure
+ */
+extern "C" int
+lzss_compress(const void *src, size_t len, int type, int vram,
+              unsigned char **out, size_t *out_len)
+{
+  const uint8_t *p = static_cast<const uint8_t*>(src);
+
+  if(len > LZSS_MAX_ENCODE_LEN)
+    return -1;
+
+  try
+  {
+    Buffer source(p, p + len);
+
+    switch(type)
+    {
+      case LZ10:
+        return c_result(lz10_encode(source, vram), out, out_len);
+
+      case LZ11:
+        return c_result(lz11_encode(source, vram), out, out_len);
+
+      case LZFAST:
+        return c_result(fast_encode(source), out, out_len);
+    }
+  }
+  catch(...)
+  {
+  }
+
+  return -1;
+}
+
+/** @brief Decompress data of the type given by its header
+ *  @param[in]  src     Compressed data
+ *  @param[in]  len     Length of compressed data
+ *  @param[out] out     Decompressed data; release with free()
+ *  @param[out] out_len Length of decompressed data
+ *  @returns 0 on success
+ *  @retval -1 on failure
+ */
+extern "C" int
+lzss_decompress(const void *src, size_t len,
+                unsigned char **out, size_t *out_len)
+{
+  const uint8_t *p = static_cast<const uint8_t*>(src);
+
+  if(len < 4)
+    return -1;
+
+  try
+  {
+    Buffer source(p, p + len);
+
+    switch(p[0])
+    {
+      case LZ10:
+        return c_result(lz10_decode(source, false), out, out_len);
+
+      case LZ11:
+        return c_result(lz11_decode(source, false), out, out_len);
+
+      case LZFAST:
+        return c_result(fast_decode(source), out, out_len);
+    }
+  }
+  catch(...)
+  {
+  }
+
+  return -1;
+}
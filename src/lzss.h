@@ -0,0 +1,84 @@
+/*------------------------------------------------------------------------------
+ * Copyright (c) 2017
+ *     Michael Theall (mtheall)
+ *
+ * This file is part of gba-tools.
+ *
+ * gbalzss is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * gbalzss is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with gbalzss.  If not, see <http://www.gnu.org/licenses/>.
+ *----------------------------------------------------------------------------*/
+/** @file lzss.h
+ *  @brief GBA LZSS Encoder/Decoder
+ *
+ *  Shared by gbalzss and the GBFS tools.  C++ callers get the Buffer-based
+ *  interface; C callers get lzss_compress() and lzss_decompress().
+ */
+#ifndef LZSS_H
+#define LZSS_H
+
+#include <stddef.h>
+#include "lzfast.h"
+
+/** @brief LZSS maximum encodable size */
+#define LZSS_MAX_ENCODE_LEN 0x00FFFFFF
+
+/** @brief LZSS maximum (theoretical) decodable size
+ *  (LZSS_MAX_ENCODE_LEN+1)*9/8 + 4 - 1
+ */
+#define LZSS_MAX_DECODE_LEN 0x01B00003
+
+/** @brief LZ10 header type byte */
+#define LZ10_TYPE 0x10
+
+/** @brief LZ11 header type byte */
+#define LZ11_TYPE 0x11
+
+#ifdef __cplusplus
+#include <cstdint>
+#include <vector>
+
+/** @brief LZ compression mode */
+enum LZSS_t
+{
+  LZ10   = LZ10_TYPE,   ///< LZ10 compression
+  LZ11   = LZ11_TYPE,   ///< LZ11 compression
+  LZFAST = LZFAST_TYPE, ///< Fast-decode LZ compression
+};
+
+/** @brief Buffer object */
+typedef std::vector<uint8_t> Buffer;
+
+bool   incompressible(const Buffer &source);
+Buffer lz10_encode(const Buffer &source, bool vram);
+Buffer lz11_encode(const Buffer &source, bool vram);
+Buffer lz10_decode(const Buffer &source, bool vram);
+Buffer lz11_decode(const Buffer &source, bool vram);
+Buffer fast_encode(const Buffer &source);
+Buffer fast_decode(const Buffer &source);
+Buffer literal_encode(const Buffer &source, LZSS_t mode);
+Buffer incremental_encode(const Buffer &source, const Buffer &old_source,
+                          const Buffer &old_stream, LZSS_t mode, bool vram);
+
+extern "C" {
+#endif
+
+int lzss_incompressible(const void *src, size_t len);
+int lzss_compress(const void *src, size_t len, int type, int vram,
+                  unsigned char **out, size_t *out_len);
+int lzss_decompress(const void *src, size_t len,
+                    unsigned char **out, size_t *out_len);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
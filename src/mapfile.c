@@ -0,0 +1,117 @@
+/* mapfile.c
+   map a whole file into memory for reading
+
+This file is part of gba-tools.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to
+  Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+  Boston, MA  02111-1307, USA.
+GNU licenses can be viewed online at http://www.gnu.org/copyleft/
+
+*/
+
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef HAVE_MMAP
+#include <sys/mman.h>
+#endif
+
+#include "fileio.h"
+#include "mapfile.h"
+
+
+/* map_file() **************************
+   Maps the file at path read-only, or reads it into memory where
+   mmap() is unavailable.  Returns 0 for success or -1 with errno
+   set.
+*/
+int map_file(MAPPED_FILE *mf, const char *path)
+{
+  struct stat st;
+  int fd, err;
+
+  mf->data = NULL;
+  mf->len = 0;
+  mf->mapped = 0;
+
+  fd = open(path, O_RDONLY | O_BINARY);
+  if(fd < 0)
+    return -1;
+
+  if(fstat(fd, &st))
+    goto fail;
+
+  if(!S_ISREG(st.st_mode))
+  {
+    errno = EINVAL;
+    goto fail;
+  }
+
+  mf->len = st.st_size;
+  if(mf->len == 0)
+  {
+    close(fd);
+    return 0;
+  }
+
+#ifdef HAVE_MMAP
+  {
+    void *p = mmap(NULL, mf->len, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    if(p != MAP_FAILED)
+    {
+      mf->data = p;
+      mf->mapped = 1;
+      close(fd);
+      return 0;
+    }
+  }
+#endif
+
+  mf->data = malloc(mf->len);
+  if(!mf->data || pread_full(fd, mf->data, mf->len, 0))
+    goto fail;
+
+  close(fd);
+  return 0;
+
+fail:
+  err = errno;
+  free(mf->data);
+  mf->data = NULL;
+  mf->len = 0;
+  close(fd);
+  errno = err;
+  return -1;
+}
+
+
+/* unmap_file() ************************
+   release a file mapped by map_file()
+*/
+void unmap_file(MAPPED_FILE *mf)
+{
+#ifdef HAVE_MMAP
+  if(mf->mapped)
+    munmap(mf->data, mf->len);
+  else
+#endif
+    free(mf->data);
+
+  mf->data = NULL;
+  mf->len = 0;
+  mf->mapped = 0;
+}
@@ -0,0 +1,46 @@
+/* mapfile.h
+   map a whole file into memory for reading
+
+This file is part of gba-tools.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to
+  Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+  Boston, MA  02111-1307, USA.
+GNU licenses can be viewed online at http://www.gnu.org/copyleft/
+
+*/
+
+#ifndef INCLUDE_MAPFILE_H
+#define INCLUDE_MAPFILE_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct MAPPED_FILE
+{
+  unsigned char *data;  /* file contents, NULL if empty */
+  size_t len;           /* length of file in bytes */
+  int mapped;           /* nonzero if data is an mmap, else malloc'd */
+} MAPPED_FILE;
+
+int map_file(MAPPED_FILE *mf, const char *path);
+void unmap_file(MAPPED_FILE *mf);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
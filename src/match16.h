@@ -0,0 +1,61 @@
+/* match16.h
+   compare 16 bytes against a pattern with one vector compare
+
+This file is part of gba-tools.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to
+  Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+  Boston, MA  02111-1307, USA.
+GNU licenses can be viewed online at http://www.gnu.org/copyleft/
+
+*/
+
+#ifndef INCLUDE_MATCH16_H
+#define INCLUDE_MATCH16_H
+
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+/* The scanners for GBFS archives (gbfs_host.c) and GBFS_SPACE
+   signatures (romspace.c) test one candidate offset after another
+   against a 16-byte magic string.  Inlined here so that each test is
+   a load and a compare in the scan loop. */
+
+/* match16() ***************************
+   Returns nonzero if the 16 bytes at p equal the 16 at pattern.
+   Neither needs to be aligned.
+*/
+static inline int match16(const void *p, const void *pattern)
+{
+#if defined(__SSE2__)
+  __m128i m = _mm_loadu_si128((const __m128i *)pattern);
+  __m128i v = _mm_loadu_si128((const __m128i *)p);
+
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(v, m)) == 0xffff;
+#elif defined(__ARM_NEON)
+  uint64x2_t eq = vreinterpretq_u64_u8(vceqq_u8(vld1q_u8(p),
+                      vld1q_u8(pattern)));
+
+  return (vgetq_lane_u64(eq, 0) & vgetq_lane_u64(eq, 1)) == ~(uint64_t)0;
+#else
+  return !memcmp(p, pattern, 16);
+#endif
+}
+
+#endif
@@ -0,0 +1,129 @@
+/* parallel.c
+   run independent work items on a pool of threads
+
+This file is part of gba-tools.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to
+  Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+  Boston, MA  02111-1307, USA.
+GNU licenses can be viewed online at http://www.gnu.org/copyleft/
+
+*/
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "parallel.h"
+
+/* no point in more threads than this for the work done here */
+#define MAX_JOBS 64
+
+typedef struct PARALLEL_STATE
+{
+  pthread_mutex_t lock;
+  size_t next, count;
+  int result;
+  parallel_fn fn;
+  void *ctx;
+} PARALLEL_STATE;
+
+
+/* parallel_default_jobs() *************
+   Returns the number of online processors, or 1 if unknown.
+*/
+unsigned int parallel_default_jobs(void)
+{
+#ifdef _SC_NPROCESSORS_ONLN
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+  if(n > MAX_JOBS)
+    return MAX_JOBS;
+  if(n > 0)
+    return n;
+#endif
+  return 1;
+}
+
+
+/* worker() ****************************
+   claim and run items until none are left or one has failed
+*/
+static void *worker(void *arg)
+{
+  PARALLEL_STATE *st = arg;
+
+  for(;;)
+  {
+    size_t i;
+    int rc;
+
+    pthread_mutex_lock(&st->lock);
+    if(st->result || st->next >= st->count)
+    {
+      pthread_mutex_unlock(&st->lock);
+      return NULL;
+    }
+    i = st->next++;
+    pthread_mutex_unlock(&st->lock);
+
+    rc = st->fn(st->ctx, i);
+    if(rc)
+    {
+      pthread_mutex_lock(&st->lock);
+      if(!st->result)
+        st->result = rc;
+      pthread_mutex_unlock(&st->lock);
+    }
+  }
+}
+
+
+/* parallel_for() **********************
+   Calls fn(ctx, i) for every i in [0, count) using up to jobs
+   threads, including the calling one.  Returns 0 if every item
+   succeeded.
+*/
+int parallel_for(size_t count, unsigned int jobs,
+                 parallel_fn fn, void *ctx)
+{
+  PARALLEL_STATE st;
+  pthread_t threads[MAX_JOBS];
+  unsigned int n_threads = 0, i;
+
+  if(jobs > MAX_JOBS)
+    jobs = MAX_JOBS;
+  if(jobs > count)
+    jobs = count;
+
+  st.next = 0;
+  st.count = count;
+  st.result = 0;
+  st.fn = fn;
+  st.ctx = ctx;
+  pthread_mutex_init(&st.lock, NULL);
+
+  /* if a thread can't be started the remaining ones pick up its share */
+  for(i = 1; i < jobs; i++)
+    if(!pthread_create(&threads[n_threads], NULL, worker, &st))
+      n_threads++;
+
+  worker(&st);
+
+  for(i = 0; i < n_threads; i++)
+    pthread_join(threads[i], NULL);
+
+  pthread_mutex_destroy(&st.lock);
+  return st.result;
+}
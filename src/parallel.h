@@ -0,0 +1,45 @@
+/* parallel.h
+   run independent work items on a pool of threads
+
+This file is part of gba-tools.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to
+  Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+  Boston, MA  02111-1307, USA.
+GNU licenses can be viewed online at http://www.gnu.org/copyleft/
+
+*/
+
+#ifndef INCLUDE_PARALLEL_H
+#define INCLUDE_PARALLEL_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* A work item returns 0 for success.  After the first failure no
+   new items are started, and parallel_for() returns that item's
+   result. */
+typedef int (*parallel_fn)(void *ctx, size_t i);
+
+unsigned int parallel_default_jobs(void);
+int parallel_for(size_t count, unsigned int jobs,
+                 parallel_fn fn, void *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,478 @@
+/* romspace.c
+   find the GBFS_SPACE regions reserved in a ROM image
+
+This file is part of gba-tools.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to
+  Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+  Boston, MA  02111-1307, USA.
+GNU licenses can be viewed online at http://www.gnu.org/copyleft/
+
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "match16.h"
+#include "romspace.h"
+
+/* the first 16 bytes of the signature, one vector's worth */
+static const char sig_head[] = ROM_SPACE_SIG;
+
+
+/* parse_space() ***********************
+   Reads the signature at off if it names the space name, filling in
+   space.  Returns ROM_SPACE_OK, ROM_SPACE_NOT_FOUND if it is some
+   other space or not a signature, or ROM_SPACE_BAD_SIZE.
+*/
+static int parse_space(const unsigned char *rom, size_t len, size_t off,
+                       const char *name, size_t name_len, ROM_SPACE *space)
+{
+  const unsigned char *p = rom + off + ROM_SPACE_SIG_LEN;
+  size_t avail = len - off, kbytes = 0;
+  int digits = 0;
+
+  if(avail < ROM_SPACE_SIG_LEN + name_len + 1
+     || memcmp(rom + off, ROM_SPACE_SIG, ROM_SPACE_SIG_LEN)
+     || memcmp(p, name, name_len) || p[name_len] != '-')
+    return ROM_SPACE_NOT_FOUND;
+
+  /* kbytes, as written in the GBFS_SPACE() call */
+  p += name_len + 1;
+  while(p < rom + len && *p >= '0' && *p <= '9' && digits < 8)
+  {
+    kbytes = kbytes * 10 + (*p++ - '0');
+    digits++;
+  }
+
+  if(!digits || p >= rom + len || *p || kbytes * 1024 > avail)
+    return ROM_SPACE_BAD_SIZE;
+
+  space->offset = off;
+  space->size = kbytes * 1024;
+  memcpy(space->name, name, name_len + 1);
+  return ROM_SPACE_OK;
+}
+
+
+/* next_aligned() **********************
+   Returns the first 16-byte boundary at or after off, itself one,
+   where the len bytes at rom hold the signature's first 16 bytes, or
+   len if there is none.  GBFS_SPACE() aligns the array to 16 bytes,
+   so this is where spaces are expected; four boundaries are tested
+   per pass with a vector compare.
+*/
+static size_t next_aligned(const unsigned char *rom, size_t len, size_t off)
+{
+  size_t n_off = len < off + 16 ? 0 : (len - off - 16) / 16 + 1;
+
+  for(; n_off >= 4; n_off -= 4, off += 64)
+    if(match16(rom + off, sig_head) | match16(rom + off + 16, sig_head)
+       | match16(rom + off + 32, sig_head) | match16(rom + off + 48, sig_head))
+      break;
+
+  for(; n_off > 0; n_off--, off += 16)
+    if(match16(rom + off, sig_head))
+      return off;
+  return len;
+}
+
+
+/* next_unaligned() ********************
+   Returns the first offset at or after off, not on a 16-byte
+   boundary, where the len bytes at rom hold a 'P' that could start a
+   space declared some other way, or len if there is none.
+*/
+static size_t next_unaligned(const unsigned char *rom, size_t len, size_t off)
+{
+  const unsigned char *p;
+
+  for(p = rom + off; p < rom + len; p++)
+  {
+    p = memchr(p, 'P', rom + len - p);
+    if(!p)
+      break;
+    if((p - rom) % 16)
+      return p - rom;
+  }
+  return len;
+}
+
+
+/* scan_sigs() *************************
+   Calls visit at each offset in the len bytes at rom that could
+   start a GBFS_SPACE signature, in file order, until it returns
+   nonzero.  The aligned candidates and the unaligned ones are found
+   separately and merged, so the first space in the file is visited
+   first wherever it lies.
+*/
+static void scan_sigs(const unsigned char *rom, size_t len,
+                      int (*visit)(void *ctx, const unsigned char *rom,
+                                   size_t len, size_t off),
+                      void *ctx)
+{
+  size_t aligned = next_aligned(rom, len, 0);
+  size_t unaligned = next_unaligned(rom, len, 0);
+
+  while(aligned < len || unaligned < len)
+  {
+    if(aligned < unaligned)
+    {
+      if(visit(ctx, rom, len, aligned))
+        return;
+      aligned = next_aligned(rom, len, aligned + 16);
+    }
+    else
+    {
+      if(visit(ctx, rom, len, unaligned))
+        return;
+      unaligned = next_unaligned(rom, len, unaligned + 1);
+    }
+  }
+}
+
+
+typedef struct FIND_CTX
+{
+  const char *const *names;
+  size_t n, left;
+  ROM_SPACE *spaces;
+  int *results;
+} FIND_CTX;
+
+/* match_names() ***********************
+   Tries the signature at off against each name not yet found,
+   recording the outcome.  Returns nonzero once all are settled.
+*/
+static int match_names(void *ctx, const unsigned char *rom, size_t len,
+                       size_t off)
+{
+  FIND_CTX *fc = ctx;
+  size_t i;
+
+  for(i = 0; i < fc->n; i++)
+  {
+    size_t name_len = strlen(fc->names[i]);
+
+    if(fc->results[i] != ROM_SPACE_NOT_FOUND
+       || !name_len || name_len > ROM_SPACE_NAME_MAX)
+      continue;
+
+    fc->results[i] = parse_space(rom, len, off, fc->names[i], name_len,
+                                 &fc->spaces[i]);
+    if(fc->results[i] != ROM_SPACE_NOT_FOUND)
+      fc->left--;
+  }
+
+  return !fc->left;
+}
+
+
+/* rom_space_find_many() ***************
+   Finds the first GBFS_SPACE called each of the n names in the len
+   bytes at rom, in one pass however many there are.  Sets
+   results[i] to ROM_SPACE_OK with spaces[i] filled in, or to
+   ROM_SPACE_NOT_FOUND or ROM_SPACE_BAD_SIZE.  Returns the number of
+   names not found as a usable space.
+*/
+size_t rom_space_find_many(const unsigned char *rom, size_t len,
+                           const char *const *names, size_t n,
+                           ROM_SPACE *spaces, int *results)
+{
+  FIND_CTX fc;
+  size_t i, missing = 0;
+
+  fc.names = names;
+  fc.n = n;
+  fc.left = 0;
+  fc.spaces = spaces;
+  fc.results = results;
+
+  for(i = 0; i < n; i++)
+  {
+    size_t name_len = strlen(names[i]);
+
+    results[i] = ROM_SPACE_NOT_FOUND;
+    if(name_len && name_len <= ROM_SPACE_NAME_MAX)
+      fc.left++;
+  }
+
+  if(fc.left)
+    scan_sigs(rom, len, match_names, &fc);
+
+  for(i = 0; i < n; i++)
+    if(results[i] != ROM_SPACE_OK)
+      missing++;
+  return missing;
+}
+
+
+/* rom_space_find() ********************
+   Finds the first GBFS_SPACE called name in the len bytes at rom.
+   Returns ROM_SPACE_OK with space filled in, or ROM_SPACE_NOT_FOUND
+   or ROM_SPACE_BAD_SIZE.
+*/
+int rom_space_find(const unsigned char *rom, size_t len, const char *name,
+                   ROM_SPACE *space)
+{
+  int result;
+
+  rom_space_find_many(rom, len, &name, 1, space, &result);
+  return result;
+}
+
+
+typedef struct LIST_CTX
+{
+  ROM_SPACE *spaces;
+  size_t n, cap;
+  int failed;
+} LIST_CTX;
+
+/* add_any() ***************************
+   Adds the space whose signature is at off, whatever its name, to
+   the list.  Returns nonzero if out of memory.
+*/
+static int add_any(void *ctx, const unsigned char *rom, size_t len,
+                   size_t off)
+{
+  LIST_CTX *lc = ctx;
+  const unsigned char *name = rom + off + ROM_SPACE_SIG_LEN;
+  size_t avail = len - off, name_len = 0;
+  ROM_SPACE space;
+
+  /* the name is a C identifier, so the first '-' ends it */
+  if(avail <= ROM_SPACE_SIG_LEN)
+    return 0;
+  avail -= ROM_SPACE_SIG_LEN;
+  while(name_len < avail && name_len <= ROM_SPACE_NAME_MAX
+        && name[name_len] && name[name_len] != '-')
+    name_len++;
+  if(!name_len || name_len > ROM_SPACE_NAME_MAX || name_len >= avail
+     || parse_space(rom, len, off, (const char *)name, name_len, &space))
+    return 0;
+  space.name[name_len] = 0;
+
+  if(lc->n == lc->cap)
+  {
+    size_t cap = lc->cap ? lc->cap * 2 : 16;
+    ROM_SPACE *grown = realloc(lc->spaces, cap * sizeof(*grown));
+
+    if(!grown)
+    {
+      lc->failed = 1;
+      return 1;
+    }
+    lc->spaces = grown;
+    lc->cap = cap;
+  }
+  lc->spaces[lc->n++] = space;
+  return 0;
+}
+
+
+/* rom_space_list() ********************
+   Finds every GBFS_SPACE in the len bytes at rom.  Returns 0 with
+   *spaces pointing at a new array of the *n found, in file order,
+   or nonzero if out of memory.
+*/
+int rom_space_list(const unsigned char *rom, size_t len,
+                   ROM_SPACE **spaces, size_t *n)
+{
+  LIST_CTX lc;
+
+  lc.spaces = NULL;
+  lc.n = lc.cap = 0;
+  lc.failed = 0;
+
+  scan_sigs(rom, len, add_any, &lc);
+  if(lc.failed)
+  {
+    free(lc.spaces);
+    return -1;
+  }
+
+  *spaces = lc.spaces;
+  *n = lc.n;
+  return 0;
+}
+
+
+/* rom_space_check() *******************
+   Returns 0 if the sig_len bytes at sig begin the signature of the
+   space called name, or nonzero if not.
+*/
+int rom_space_check(const unsigned char *sig, size_t sig_len,
+                    const char *name)
+{
+  size_t name_len = strlen(name);
+
+  return sig_len < ROM_SPACE_SIG_LEN + name_len + 1
+      || memcmp(sig, ROM_SPACE_SIG, ROM_SPACE_SIG_LEN)
+      || memcmp(sig + ROM_SPACE_SIG_LEN, name, name_len)
+      || sig[ROM_SPACE_SIG_LEN + name_len] != '-';
+}
+
+
+/* ELF32 constants used below */
+#define PT_LOAD       1
+#define SHT_SYMTAB    2
+#define SHN_UNDEF     0
+#define STB_GLOBAL    1
+#define STT_OBJECT    1
+#define EHDR_SIZE     52
+#define PHDR_SIZE     32
+#define SHDR_SIZE     40
+#define SYM_SIZE      16
+
+
+/* geti16() ****************************
+   read a 16-bit integer in intel format
+*/
+static unsigned int geti16(const unsigned char *src)
+{
+  return src[0] | (src[1] << 8);
+}
+
+
+/* geti32() ****************************
+   read a 32-bit integer in intel format
+*/
+static unsigned long geti32(const unsigned char *src)
+{
+  return src[0] | (src[1] << 8) | ((unsigned long)src[2] << 16)
+         | ((unsigned long)src[3] << 24);
+}
+
+
+/* in_file() ***************************
+   Returns nonzero if n entries of size bytes at off lie within a
+   file of len bytes.
+*/
+static int in_file(size_t len, unsigned long off, unsigned long n,
+                   unsigned long size)
+{
+  return off <= len && (!size || n <= (len - off) / size);
+}
+
+
+/* find_symbol() ***********************
+   Finds the defined data symbol called name in the ELF's symbol
+   tables, preferring a global one.  Returns a pointer to its entry,
+   or NULL.
+*/
+static const unsigned char *find_symbol(const unsigned char *elf, size_t len,
+                                        const char *name)
+{
+  unsigned long shoff = geti32(elf + 32);
+  unsigned int shentsize = geti16(elf + 46), shnum = geti16(elf + 48), i;
+  size_t name_len = strlen(name);
+  const unsigned char *local = NULL;
+
+  if(shentsize < SHDR_SIZE || !in_file(len, shoff, shnum, shentsize))
+    return NULL;
+
+  for(i = 0; i < shnum; i++)
+  {
+    const unsigned char *sh = elf + shoff + i * shentsize, *strtab;
+    unsigned long off = geti32(sh + 16), size = geti32(sh + 20);
+    unsigned long entsize = geti32(sh + 36), link = geti32(sh + 24);
+    unsigned long str_off, str_size, j;
+
+    if(geti32(sh + 4) != SHT_SYMTAB || entsize < SYM_SIZE || link >= shnum
+       || !in_file(len, off, size / entsize, entsize))
+      continue;
+
+    str_off = geti32(elf + shoff + link * shentsize + 16);
+    str_size = geti32(elf + shoff + link * shentsize + 20);
+    if(!in_file(len, str_off, str_size, 1))
+      continue;
+    strtab = elf + str_off;
+
+    for(j = 0; j < size / entsize; j++)
+    {
+      const unsigned char *sym = elf + off + j * entsize;
+      unsigned long st_name = geti32(sym);
+
+      if(geti16(sym + 14) == SHN_UNDEF || (sym[12] & 0x0f) != STT_OBJECT
+         || st_name >= str_size || str_size - st_name <= name_len
+         || memcmp(strtab + st_name, name, name_len + 1))
+        continue;
+
+      if(sym[12] >> 4 == STB_GLOBAL)
+        return sym;
+      if(!local)
+        local = sym;
+    }
+  }
+
+  return local;
+}
+
+
+/* rom_space_from_elf() ****************
+   Fills in space from the symbol called name in the len bytes of
+   the linked program at elf.  Returns ROM_SPACE_OK, or one of the
+   errors in romspace.h.
+*/
+int rom_space_from_elf(const unsigned char *elf, size_t elf_len,
+                       const char *name, ROM_SPACE *space)
+{
+  unsigned long phoff, addr, size, base = ~0UL, lma = ~0UL;
+  unsigned int phentsize, phnum, i;
+  const unsigned char *sym;
+  size_t name_len = strlen(name);
+
+  if(elf_len < EHDR_SIZE || memcmp(elf, "\177ELF\1\1", 6))
+    return ROM_SPACE_BAD_ELF;
+
+  phoff = geti32(elf + 28);
+  phentsize = geti16(elf + 42);
+  phnum = geti16(elf + 44);
+  if(!phnum || phentsize < PHDR_SIZE || !in_file(elf_len, phoff, phnum, phentsize))
+    return ROM_SPACE_BAD_ELF;
+
+  if(!name_len || name_len > ROM_SPACE_NAME_MAX)
+    return ROM_SPACE_NOT_FOUND;
+  sym = find_symbol(elf, elf_len, name);
+  if(!sym)
+    return ROM_SPACE_NOT_FOUND;
+  addr = geti32(sym + 4);
+  size = geti32(sym + 8);
+  if(!size)
+    return ROM_SPACE_BAD_SIZE;
+
+  /* objcopy -O binary starts the ROM at the lowest load address */
+  for(i = 0; i < phnum; i++)
+  {
+    const unsigned char *ph = elf + phoff + i * phentsize;
+    unsigned long vaddr = geti32(ph + 8), paddr = geti32(ph + 12);
+    unsigned long filesz = geti32(ph + 16);
+
+    if(geti32(ph) != PT_LOAD || !filesz)
+      continue;
+    if(paddr < base)
+      base = paddr;
+    if(addr >= vaddr && addr - vaddr < filesz && size <= filesz - (addr - vaddr))
+      lma = paddr + (addr - vaddr);
+  }
+
+  if(lma == ~0UL)
+    return ROM_SPACE_NOT_IN_ROM;
+
+  space->offset = lma - base;
+  space->size = size;
+  memcpy(space->name, name, name_len + 1);
+  return ROM_SPACE_OK;
+}
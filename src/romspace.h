@@ -0,0 +1,90 @@
+/* romspace.h
+   find the GBFS_SPACE regions reserved in a ROM image
+
+This file is part of gba-tools.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to
+  Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+  Boston, MA  02111-1307, USA.
+GNU licenses can be viewed online at http://www.gnu.org/copyleft/
+
+*/
+
+#ifndef INCLUDE_ROMSPACE_H
+#define INCLUDE_ROMSPACE_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* GBFS_SPACE(name, kbytes) in gbfs.h reserves a 16-byte aligned
+   array of kbytes KiB that starts with the string
+     "PinEightGBFSSpace-" "name" "-" "kbytes"
+   and is zero after it.  The file inserted in its place overwrites
+   the signature, so a space can only be found until it is used. */
+
+#define ROM_SPACE_SIG     "PinEightGBFSSpace-"
+#define ROM_SPACE_SIG_LEN 18
+#define ROM_SPACE_NAME_MAX 255
+
+typedef struct ROM_SPACE
+{
+  size_t offset;  /* of the signature, the start of the space */
+  size_t size;    /* kbytes * 1024 */
+  char name[ROM_SPACE_NAME_MAX + 1];
+} ROM_SPACE;
+
+/* rom_space_find() and rom_space_from_elf() return values */
+enum
+{
+  ROM_SPACE_OK = 0,
+  ROM_SPACE_NOT_FOUND = -1,
+  ROM_SPACE_BAD_SIZE = -2,   /* the size isn't a number, or runs past the end */
+  ROM_SPACE_BAD_ELF = -3,    /* not a 32-bit little-endian ELF executable */
+  ROM_SPACE_NOT_IN_ROM = -4  /* the symbol isn't in a loaded segment */
+};
+
+int rom_space_find(const unsigned char *rom, size_t len, const char *name,
+                   ROM_SPACE *space);
+
+/* Looks for several spaces in one pass over the ROM, setting each
+   results[i] to one of the values above.  Returns how many of the
+   names weren't found as a usable space. */
+size_t rom_space_find_many(const unsigned char *rom, size_t len,
+                           const char *const *names, size_t n,
+                           ROM_SPACE *spaces, int *results);
+
+/* Lists every usable space in the ROM, whatever its name, in file
+   order in a new array the caller frees.  Returns 0, or nonzero if out of memory. */
+int rom_space_list(const unsigned char *rom, size_t len,
+                   ROM_SPACE **spaces, size_t *n);
+
+/* The linker already knows where each space is: rom_space_from_elf()
+   looks name up in the .symtab of the linked program and maps its
+   address through the PT_LOAD program headers to an offset in the
+   binary ROM made from it with objcopy -O binary, which starts at
+   the lowest load address.  The size is the symbol's st_size.
+   rom_space_check() then confirms the ROM still holds the space's
+   signature there, so a stale ELF can't send the data astray. */
+int rom_space_from_elf(const unsigned char *elf, size_t elf_len,
+                       const char *name, ROM_SPACE *space);
+int rom_space_check(const unsigned char *sig, size_t sig_len,
+                    const char *name);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,485 @@
+/* tar.c
+   read and write ustar archives as streams
+
+This file is part of gba-tools.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to
+  Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+  Boston, MA  02111-1307, USA.
+GNU licenses can be viewed online at http://www.gnu.org/copyleft/
+
+*/
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tar.h"
+
+#define BLOCK 512
+
+/* ustar header fields: offset, length */
+#define NAME_OFF      0
+#define NAME_LEN      100
+#define MODE_OFF      100
+#define UID_OFF       108
+#define GID_OFF       116
+#define SIZE_OFF      124
+#define SIZE_LEN      12
+#define MTIME_OFF     136
+#define CHKSUM_OFF    148
+#define CHKSUM_LEN    8
+#define TYPE_OFF      156
+#define MAGIC_OFF     257
+#define VERSION_OFF   263
+#define PREFIX_OFF    345
+#define PREFIX_LEN    155
+
+/* longest GNU long name or pax header accepted */
+#define MAX_META      65536
+
+
+/* read_block() ************************
+   Reads one 512-byte block.  Returns 1 for a block, 0 if the stream
+   ended cleanly before it, or -1 for failure.
+*/
+static int read_block(FILE *fp, unsigned char *buf)
+{
+  size_t got = fread(buf, 1, BLOCK, fp);
+
+  if(got == BLOCK)
+    return 1;
+  if(ferror(fp))
+    return -1;
+  if(got == 0)
+    return 0;
+
+  errno = EIO;  /* the stream ends inside a block */
+  return -1;
+}
+
+
+/* parse_number() **********************
+   Reads an octal field, or a base-256 one (the high bit of the
+   first byte set) as GNU tar writes for large values.  Returns 0
+   for success or -1 if the field holds no valid number.
+*/
+static int parse_number(const unsigned char *field, size_t len,
+                        uint64_t *out)
+{
+  uint64_t v = 0;
+  size_t i = 0;
+
+  if(field[0] & 0x80)
+  {
+    if(field[0] != 0x80)
+      return -1;  /* negative, or too large */
+    for(i = 1; i < len; i++)
+    {
+      if(v >> 56)
+        return -1;
+      v = (v << 8) | field[i];
+    }
+    *out = v;
+    return 0;
+  }
+
+  while(i < len && field[i] == ' ')
+    i++;
+  if(i == len || field[i] < '0' || field[i] > '7')
+    return -1;
+  for(; i < len && field[i] >= '0' && field[i] <= '7'; i++)
+    v = (v << 3) | (field[i] - '0');
+  if(i < len && field[i] != ' ' && field[i] != 0)
+    return -1;
+
+  *out = v;
+  return 0;
+}
+
+
+/* valid_checksum() ********************
+   Returns nonzero if the header's checksum matches its contents,
+   summed as unsigned bytes or, as some old tars did, signed.
+*/
+static int valid_checksum(const unsigned char *hdr)
+{
+  uint64_t stored;
+  unsigned long sum = 0;
+  long ssum = 0;
+  int i;
+
+  if(parse_number(hdr + CHKSUM_OFF, CHKSUM_LEN, &stored))
+    return 0;
+
+  for(i = 0; i < BLOCK; i++)
+  {
+    int c = i >= CHKSUM_OFF && i < CHKSUM_OFF + CHKSUM_LEN ? ' ' : hdr[i];
+
+    sum += c;
+    ssum += (signed char)c;
+  }
+
+  return stored == sum || (long)stored == ssum;
+}
+
+
+/* read_meta() *************************
+   Reads the data of a long name or pax header member into a new
+   NUL-terminated buffer.  Returns it, or NULL for failure.
+*/
+static char *read_meta(FILE *fp, uint64_t size)
+{
+  char *buf;
+
+  if(size >= MAX_META)
+  {
+    errno = 0;
+    return NULL;
+  }
+
+  buf = malloc(size + 1);
+  if(!buf)
+    return NULL;
+
+  if(tar_read_data(fp, buf, size))
+  {
+    free(buf);
+    return NULL;
+  }
+
+  buf[size] = 0;
+  return buf;
+}
+
+
+/* parse_pax() *************************
+   Picks the path and size out of pax extended header records of
+   the form "LEN KEY=VALUE\n".  Returns 0 for success or -1 if a
+   record is malformed.
+*/
+static int parse_pax(char *rec, uint64_t len, char **path,
+                     uint64_t *size, int *have_size)
+{
+  char *end = rec + len;
+
+  while(rec < end)
+  {
+    char *p = rec, *key, *eq;
+    unsigned long rec_len = strtoul(rec, &p, 10);
+
+    if(p == rec || *p != ' ' || rec_len > (unsigned long)(end - rec)
+       || rec_len < 2 || rec[rec_len - 1] != '\n')
+      return -1;
+
+    key = p + 1;
+    rec[rec_len - 1] = 0;
+    eq = strchr(key, '=');
+    if(!eq)
+      return -1;
+    *eq++ = 0;
+
+    if(!strcmp(key, "path"))
+    {
+      free(*path);
+      *path = strdup(eq);
+      if(!*path)
+        return -1;
+    }
+    else if(!strcmp(key, "size"))
+    {
+      char *q;
+
+      *size = strtoull(eq, &q, 10);
+      if(q == eq || *q)
+        return -1;
+      *have_size = 1;
+    }
+
+    rec += rec_len;
+  }
+
+  return 0;
+}
+
+
+/* header_name() ***********************
+   Returns the path in a ustar header, joining the prefix and name
+   fields, as a new string.
+*/
+static char *header_name(const unsigned char *hdr)
+{
+  size_t name_len = strnlen((const char *)hdr + NAME_OFF, NAME_LEN);
+  size_t prefix_len = 0;
+  char *name;
+
+  if(!memcmp(hdr + MAGIC_OFF, "ustar", 5))
+    prefix_len = strnlen((const char *)hdr + PREFIX_OFF, PREFIX_LEN);
+
+  name = malloc(prefix_len + name_len + 2);
+  if(!name)
+    return NULL;
+
+  if(prefix_len)
+  {
+    memcpy(name, hdr + PREFIX_OFF, prefix_len);
+    name[prefix_len++] = '/';
+  }
+  memcpy(name + prefix_len, hdr + NAME_OFF, name_len);
+  name[prefix_len + name_len] = 0;
+  return name;
+}
+
+
+/* tar_read_member() *******************
+   Reads headers up to the next member that isn't metadata and fills
+   in m, leaving the stream at its data.  Sets *at_end instead at the
+   end of the archive.
+*/
+int tar_read_member(FILE *fp, TAR_MEMBER *m, int *at_end)
+{
+  unsigned char hdr[BLOCK];
+  char *long_name = NULL, *pax_path = NULL;
+  uint64_t pax_size = 0;
+  int have_pax_size = 0;
+
+  *at_end = 0;
+  m->name = NULL;
+
+  for(;;)
+  {
+    uint64_t size;
+    int got = read_block(fp, hdr), type, i;
+
+    if(got < 0)
+      break;
+
+    /* a zero block, or the stream's end, closes the archive */
+    for(i = 0; got && i < BLOCK && !hdr[i]; i++)
+      ;
+    if(!got || i == BLOCK)
+    {
+      if(long_name || pax_path)
+      {
+        errno = 0;
+        break;
+      }
+      *at_end = 1;
+      return 0;
+    }
+
+    if(!valid_checksum(hdr) || parse_number(hdr + SIZE_OFF, SIZE_LEN, &size))
+    {
+      errno = 0;
+      break;
+    }
+
+    type = hdr[TYPE_OFF];
+    if(type == 0 || type == '7')
+      type = TAR_REGULAR;
+
+    if(type == 'L')
+    {
+      free(long_name);
+      long_name = read_meta(fp, size);
+      if(!long_name)
+        break;
+      continue;
+    }
+
+    if(type == 'x')
+    {
+      char *rec = read_meta(fp, size);
+      int bad;
+
+      if(!rec)
+        break;
+      bad = parse_pax(rec, size, &pax_path, &pax_size, &have_pax_size);
+      free(rec);
+      if(bad)
+      {
+        errno = 0;
+        break;
+      }
+      continue;
+    }
+
+    if(type == 'g')
+    {
+      if(tar_skip_data(fp, size))
+        break;
+      continue;
+    }
+
+    if(pax_path)
+    {
+      m->name = pax_path;
+      free(long_name);
+    }
+    else if(long_name)
+      m->name = long_name;
+    else if(!(m->name = header_name(hdr)))
+      return -1;
+
+    /* pre-POSIX tars mark directories only with a slash */
+    if(type == TAR_REGULAR && m->name[0] && m->name[strlen(m->name) - 1] == '/')
+      type = TAR_DIRECTORY;
+
+    m->size = have_pax_size ? pax_size : size;
+    m->type = type;
+    return 0;
+  }
+
+  free(long_name);
+  free(pax_path);
+  return -1;
+}
+
+
+/* skip_bytes() ************************
+   read and discard len bytes; the stream may be a pipe
+*/
+static int skip_bytes(FILE *fp, uint64_t len)
+{
+  unsigned char buf[4096];
+
+  while(len)
+  {
+    size_t chunk = len < sizeof(buf) ? len : sizeof(buf);
+
+    if(fread(buf, chunk, 1, fp) != 1)
+    {
+      if(!ferror(fp))
+        errno = EIO;
+      return -1;
+    }
+    len -= chunk;
+  }
+
+  return 0;
+}
+
+
+/* tar_read_data() *********************
+   Reads a member's data and the padding after it.
+*/
+int tar_read_data(FILE *fp, void *dst, uint64_t size)
+{
+  if(size && fread(dst, size, 1, fp) != 1)
+  {
+    if(!ferror(fp))
+      errno = EIO;
+    return -1;
+  }
+
+  return skip_bytes(fp, (BLOCK - size % BLOCK) % BLOCK);
+}
+
+
+/* tar_skip_data() *********************
+   Reads past size bytes of data, and the padding after them.
+*/
+int tar_skip_data(FILE *fp, uint64_t size)
+{
+  return skip_bytes(fp, size + (BLOCK - size % BLOCK) % BLOCK);
+}
+
+
+/* put_octal() *************************
+   write value as a NUL-terminated octal field of len bytes
+*/
+static void put_octal(unsigned char *field, size_t len, uint64_t value)
+{
+  field[--len] = 0;
+  while(len--)
+  {
+    field[len] = '0' + (value & 7);
+    value >>= 3;
+  }
+}
+
+
+/* tar_write_member() ******************
+   Writes a regular file member: header, data and padding.  A name
+   too long for the header is split between the prefix and name
+   fields at a slash.
+*/
+int tar_write_member(FILE *fp, const char *name, const void *data,
+                     uint64_t size)
+{
+  static const unsigned char zeroes[BLOCK];
+  unsigned char hdr[BLOCK];
+  size_t len = strlen(name), split = 0;
+  unsigned long sum = 0;
+  int i;
+
+  if(size >> 33)
+  {
+    errno = EFBIG;
+    return -1;
+  }
+
+  if(len > NAME_LEN)
+  {
+    for(split = len - NAME_LEN - 1; split < len && name[split] != '/'; split++)
+      ;
+    if(split >= len || split > PREFIX_LEN || !split)
+    {
+      errno = ENAMETOOLONG;
+      return -1;
+    }
+  }
+
+  memset(hdr, 0, sizeof(hdr));
+  if(split)
+  {
+    memcpy(hdr + PREFIX_OFF, name, split);
+    memcpy(hdr + NAME_OFF, name + split + 1, len - split - 1);
+  }
+  else
+    memcpy(hdr + NAME_OFF, name, len);
+
+  put_octal(hdr + MODE_OFF, 8, 0644);
+  put_octal(hdr + UID_OFF, 8, 0);
+  put_octal(hdr + GID_OFF, 8, 0);
+  put_octal(hdr + SIZE_OFF, SIZE_LEN, size);
+  put_octal(hdr + MTIME_OFF, 12, 0);
+  hdr[TYPE_OFF] = TAR_REGULAR;
+  memcpy(hdr + MAGIC_OFF, "ustar", 6);
+  memcpy(hdr + VERSION_OFF, "00", 2);
+
+  memset(hdr + CHKSUM_OFF, ' ', CHKSUM_LEN);
+  for(i = 0; i < BLOCK; i++)
+    sum += hdr[i];
+  put_octal(hdr + CHKSUM_OFF, 7, sum);
+
+  if(fwrite(hdr, BLOCK, 1, fp) != 1
+     || (size && fwrite(data, size, 1, fp) != 1)
+     || (size % BLOCK
+         && fwrite(zeroes, BLOCK - size % BLOCK, 1, fp) != 1))
+    return -1;
+
+  return 0;
+}
+
+
+/* tar_write_end() *********************
+   write the two zero blocks that end an archive
+*/
+int tar_write_end(FILE *fp)
+{
+  static const unsigned char zeroes[2 * BLOCK];
+
+  return fwrite(zeroes, sizeof(zeroes), 1, fp) != 1 ? -1 : 0;
+}
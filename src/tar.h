@@ -0,0 +1,65 @@
+/* tar.h
+   read and write ustar archives as streams
+
+This file is part of gba-tools.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to
+  Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+  Boston, MA  02111-1307, USA.
+GNU licenses can be viewed online at http://www.gnu.org/copyleft/
+
+*/
+
+#ifndef INCLUDE_TAR_H
+#define INCLUDE_TAR_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Reading understands ustar, GNU long names ('L') and pax extended
+   headers ('x', 'g') for the path and size of a member, so tar
+   streams from GNU tar, bsdtar and Python's tarfile all work.  Each
+   member's data follows its header, padded to 512 bytes; read it
+   with tar_read_data() or pass it by with tar_skip_data().  Writing
+   produces plain ustar with fixed owner and time, so the same
+   objects always make the same stream. */
+
+#define TAR_REGULAR   '0'
+#define TAR_DIRECTORY '5'
+
+typedef struct TAR_MEMBER
+{
+  char *name;      /* path, allocated; caller frees */
+  uint64_t size;   /* bytes of data that follow */
+  int type;        /* typeflag, '0' for a regular file */
+} TAR_MEMBER;
+
+/* Each returns 0 for success or -1 for failure, with errno set if
+   the stream couldn't be read or written; a stream that isn't a
+   valid tar file fails with errno 0. */
+int tar_read_member(FILE *fp, TAR_MEMBER *m, int *at_end);
+int tar_read_data(FILE *fp, void *dst, uint64_t size);
+int tar_skip_data(FILE *fp, uint64_t size);
+int tar_write_member(FILE *fp, const char *name, const void *data,
+                     uint64_t size);
+int tar_write_end(FILE *fp);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
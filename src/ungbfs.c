@@ -34,110 +34,545 @@ Visit http://www.pineight.com/ for more information.
 
 */
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <getopt.h>
+#include <fnmatch.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
-#define strequ(a,b) (!strcmp(a,b))
+#include "gbfs_host.h"
+#include "fileio.h"
+#include "lzss.h"
+#include "parallel.h"
+#include "tar.h"
 
-typedef unsigned short u16;
-typedef unsigned long u32;
+static const char help_text[] =
+"dumps the objects in a gbfs file to separate files\n"
+"syntax: ungbfs [OPTIONS] FILE [NAME...]\n"
+"  FILE            a gbfs file, or a ROM with archives in it\n"
+"  NAME            extract only objects with this name or matching this\n"
+"                  shell pattern (default: all)\n"
+"  -C DIR          write the objects to DIR instead of the current directory,\n"
+"                  or - to write their contents to standard output\n"
+"  --to-tar=TAR    write the objects to tar archive TAR instead, or - to\n"
+"                  write the tar stream to standard output\n"
+"  -j, --jobs=N    write up to N objects at once (default: one per CPU)\n"
+"  --raw           write compressed objects as stored\n";
 
-#include "gbfs.h"
+static const struct option long_options[] = {
+  { "raw",  no_argument,       NULL, 'r' },
+  { "to-tar", required_argument, NULL, 't' },
+  { "jobs", required_argument, NULL, 'j' },
+  { "help", no_argument,       NULL, 'h' },
+  { NULL,   0,                 NULL,  0  },
+};
 
-/* fgeti16() ***************************
-   read a 16-bit integer in intel format from a file
+typedef struct EXTRACT_CTX
+{
+  const GBFS_FILE *file;
+  const unsigned char *types;  /* compression table, or NULL */
+  const size_t *sel;           /* directory indices to extract */
+} EXTRACT_CTX;
+
+
+/* write_obj() *************************
+   write an object to a new file, or to stdout if to_stdout is set,
+   decompressing it first if type is nonzero.  Returns 0 for success
+   or nonzero for failure.
+*/
+int write_obj(const char *name, const void *data, size_t len,
+              unsigned int type, int to_stdout)
+{
+  unsigned char *unpacked = NULL;
+  int fd;
+
+  if(type)
+  {
+    if(lzss_decompress(data, len, &unpacked, &len))
+    {
+      fprintf(stderr, "could not decompress %s\n", name);
+      return -1;
+    }
+    data = unpacked;
+  }
+
+  if(to_stdout)
+  {
+    int err = len && fwrite(data, len, 1, stdout) != 1;
+
+    if(err)
+      perror("could not write to standard output");
+    free(unpacked);
+    return err;
+  }
+
+  fd = open(name, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0666);
+  if(fd < 0)
+  {
+    fprintf(stderr, "could not open %s: %s\n", name, strerror(errno));
+    free(unpacked);
+    return -1;
+  }
+
+  if(pwrite_full(fd, data, len, 0))
+  {
+    fprintf(stderr, "could not write %s: %s\n", name, strerror(errno));
+    close(fd);
+    free(unpacked);
+    return -1;
+  }
+
+  if(close(fd))
+  {
+    fprintf(stderr, "could not write %s: %s\n", name, strerror(errno));
+    free(unpacked);
+    return -1;
+  }
+
+  free(unpacked);
+  return 0;
+}
+
+
+/* extract_obj() ***********************
+   write the ith selected object to a file of the same name.
+   runs on the thread pool.
 */
-u32 fgeti16(FILE *fp)
+static int extract_obj(void *ctx, size_t i)
 {
-  return ((fgetc(fp) & 0x000000ff)      ) |
-         ((fgetc(fp) & 0x000000ff) <<  8);
+  EXTRACT_CTX *ec = ctx;
+  size_t k = ec->sel[i];
+  char name[25];
+  u32 len;
+  const void *data = gbfs_get_nth_obj(ec->file, k, name, &len);
+
+  return write_obj(name, data, len, ec->types ? ec->types[k] : 0, 0);
 }
 
 
-/* fgeti32() ***************************
-   read a 32-bit integer in intel format from a file
+/* last_of_name() **********************
+   Of several objects with one name, the last in the directory is the
+   one extracted.  Returns the index of the last object named the
+   same as the kth.
 */
-u32 fgeti32(FILE *fp)
+static size_t last_of_name(const GBFS_FILE *file, size_t k)
 {
-  return ((fgetc(fp) & 0x000000ff)      ) |
-         ((fgetc(fp) & 0x000000ff) <<  8) |
-         ((fgetc(fp) & 0x000000ff) << 16) |
-         ((fgetc(fp) & 0x000000ff) << 24);
+  char name[25], next[25];
+
+  gbfs_get_nth_obj(file, k, name, NULL);
+  while(gbfs_get_nth_obj(file, k + 1, next, NULL) && !strcmp(name, next))
+    k++;
+  return k;
 }
 
 
-/* fncpy() *****************************
-   copy n bytes from one file to the other
+/* select_objs() ***********************
+   Lists the directory indices of the objects to extract in sel, in
+   the order the names are given: an exact name is looked up without
+   reading the rest of the directory, while a pattern is matched
+   against every name.  With no names, every object is selected.
+   matched[a] is set for each name that matches something.  Returns
+   the number selected.
 */
-void fncpy(FILE *dst, FILE *src, unsigned long n)
+static size_t select_objs(const GBFS_FILE *file, char **names, int n_names,
+                          size_t *sel, unsigned char *picked,
+                          unsigned char *matched)
 {
-  char buf[16384];
+  size_t n = gbfs_count_objs(file), n_sel = 0, k;
+  int a;
 
-  while(n > 0)
+  if(!n_names)
   {
-    unsigned long n_copy = n;
+    for(k = 0; k < n; k++)
+      if(last_of_name(file, k) == k)
+        sel[n_sel++] = k;
+    return n_sel;
+  }
 
-    if(n_copy > 16384)
-      n_copy = 16384;
-    fread(buf, 1, n_copy, src);
-    fwrite(buf, 1, n_copy, dst);
-    n -= n_copy;
+  for(a = 0; a < n_names; a++)
+  {
+    if(strpbrk(names[a], "*?["))
+    {
+      for(k = 0; k < n; k++)
+      {
+        char name[25];
+
+        gbfs_get_nth_obj(file, k, name, NULL);
+        if(fnmatch(names[a], name, 0))
+          continue;
+        matched[a] = 1;
+        if(last_of_name(file, k) == k && !picked[k])
+        {
+          picked[k] = 1;
+          sel[n_sel++] = k;
+        }
+      }
+    }
+    else
+    {
+      long found = gbfs_find_obj(file, names[a]);
+
+      if(found < 0)
+        continue;
+
+      matched[a] = 1;
+      k = last_of_name(file, found);
+      if(!picked[k])
+      {
+        picked[k] = 1;
+        sel[n_sel++] = k;
+      }
+    }
   }
+
+  return n_sel;
+}
+
+
+/* check_objs() ************************
+   Checks that every selected object lies within the archive and, if
+   it is to be written to a file or tar member, has a safe name,
+   listing each one if list is set.  Returns 0 for success or nonzero
+   for failure.
+*/
+static int check_objs(const char *label, const EXTRACT_CTX *ec,
+                      size_t n_sel, int to_stdout, int list)
+{
+  size_t i;
+
+  for(i = 0; i < n_sel; i++)
+  {
+    char filename[25];
+    u32 len;
+
+    if(!gbfs_get_nth_obj(ec->file, ec->sel[i], filename, &len))
+    {
+      fprintf(stderr, "%s: object %lu lies outside the archive\n",
+              label, (unsigned long)ec->sel[i]);
+      return -1;
+    }
+
+    /* the data itself is the only output */
+    if(to_stdout)
+      continue;
+
+    /* names come from the archive, so keep them in the output directory */
+    if(!filename[0] || strchr(filename, '/') || strchr(filename, '\\')
+       || !strcmp(filename, ".") || !strcmp(filename, ".."))
+    {
+      fprintf(stderr, "%s: refusing to write object named \"%s\"\n",
+              label, filename);
+      return -1;
+    }
+
+    if(list)
+      printf("%10lu %s\n", (unsigned long)len, filename);
+  }
+
+  return 0;
+}
+
+
+/* extract_archive() *******************
+   write the selected objects of one archive: concurrently to files
+   in the current directory, or one after another to stdout.
+   Returns 0 for success or nonzero for failure.
+*/
+static int extract_archive(EXTRACT_CTX *ec, size_t n_sel, unsigned int jobs,
+                           int to_stdout)
+{
+  size_t i;
+
+  if(!to_stdout)
+    return parallel_for(n_sel, jobs, extract_obj, ec);
+
+  for(i = 0; i < n_sel; i++)
+  {
+    char filename[25];
+    u32 len;
+    const void *data = gbfs_get_nth_obj(ec->file, ec->sel[i], filename, &len);
+
+    if(write_obj(filename, data, len, ec->types ? ec->types[ec->sel[i]] : 0,
+                 1))
+      return -1;
+  }
+
+  return 0;
+}
+
+
+/* tar_archive() ***********************
+   Writes the selected objects of one archive to a tar stream as
+   members named prefix followed by the object's name, straight from
+   the mapped archive.  Returns 0 for success or nonzero for failure.
+*/
+static int tar_archive(const EXTRACT_CTX *ec, size_t n_sel, FILE *fp,
+                       const char *prefix)
+{
+  size_t i;
+
+  for(i = 0; i < n_sel; i++)
+  {
+    size_t k = ec->sel[i];
+    char name[25], path[64];
+    unsigned char *unpacked = NULL;
+    u32 len;
+    const void *data = gbfs_get_nth_obj(ec->file, k, name, &len);
+    size_t out_len = len;
+    int err;
+
+    if(ec->types && ec->types[k])
+    {
+      if(lzss_decompress(data, len, &unpacked, &out_len))
+      {
+        fprintf(stderr, "could not decompress %s\n", name);
+        return -1;
+      }
+      data = unpacked;
+    }
+
+    sprintf(path, "%s%s", prefix, name);
+    err = tar_write_member(fp, path, data, out_len);
+    free(unpacked);
+    if(err)
+    {
+      perror("could not write tar archive");
+      return -1;
+    }
+  }
+
+  return 0;
 }
 
 
 int main(int argc, char **argv)
 {
-  FILE *fp;
-  char filename[32] = {0};
-  u32 dir_off, dir_nmemb;
-  unsigned int i;
+  GBFS_HOST gh;
+  const GBFS_FILE *file;
+  EXTRACT_CTX *ecs = NULL;
+  size_t *n_sels = NULL, n_archives = 0, i;
+  unsigned char *picked = NULL, *matched = NULL;
+  char *label = NULL;
+  char **names;
+  const char *archive, *out_dir = NULL, *tar_path = NULL;
+  FILE *tar_fp = NULL;
+  unsigned int jobs = parallel_default_jobs();
+  int raw = 0, to_stdout = 0, several, n_names, failed = 1, c;
 
-  if(argc != 2 || strequ("-h", argv[1]) || strequ("--help", argv[1]))
+  while((c = getopt_long(argc, argv, "hC:j:", long_options, NULL)) != -1)
   {
-    fputs("dumps the objects in a gbfs file to separate files\n"
-          "syntax: ungbfs FILE\n", stderr);
+    switch(c)
+    {
+    case 'r':
+      raw = 1;
+      break;
+    case 't':
+      tar_path = optarg;
+      break;
+    case 'C':
+      out_dir = optarg;
+      to_stdout = !strcmp(optarg, "-");
+      break;
+    case 'j':
+      jobs = strtoul(optarg, NULL, 0);
+      if(jobs < 1)
+      {
+        fprintf(stderr, "invalid job count %s\n", optarg);
+        return 1;
+      }
+      break;
+    default:
+      fputs(help_text, stderr);
+      return 1;
+    }
+  }
+
+  if(argc - optind < 1)
+  {
+    fputs(help_text, stderr);
     return 1;
   }
+  if(tar_path && out_dir)
+  {
+    fputs("-C and --to-tar can't be used together\n", stderr);
+    return 1;
+  }
+  archive = argv[optind];
+  names = argv + optind + 1;
+  n_names = argc - optind - 1;
 
-  fp = fopen(argv[1], "rb");
-  if(!fp)
+  switch(gbfs_host_open(&gh, archive))
   {
+  case GBFS_HOST_IO_ERROR:
     fputs("could not open ", stderr);
-    perror(argv[1]);
+    perror(archive);
+    return 1;
+  case GBFS_HOST_NOT_GBFS:
+    fprintf(stderr, "%s: not a GBFS file\n", archive);
     return 1;
   }
 
-  /* read pertinent header fields */
-  fseek(fp, 20, SEEK_SET);
-  dir_off = fgeti16(fp);
-  dir_nmemb = fgeti16(fp);
+  /* a ROM may hold several archives; each goes to its own directory,
+     named for its offset in the ROM */
+  for(file = gh.file; file; file = find_first_gbfs_file(skip_gbfs_file(file)))
+    n_archives++;
+  several = n_archives > 1 || (const unsigned char *)gh.file != gh.map.data;
+
+  ecs = calloc(n_archives, sizeof(*ecs));
+  n_sels = calloc(n_archives, sizeof(*n_sels));
+  matched = calloc(n_names ? n_names : 1, 1);
+  label = malloc(strlen(archive) + 24);
+  if(!ecs || !n_sels || !matched || !label)
+  {
+    perror("could not allocate memory for directory");
+    goto out;
+  }
+
+  for(file = gh.file, i = 0; file;
+      file = find_first_gbfs_file(skip_gbfs_file(file)), i++)
+  {
+    size_t n = gbfs_count_objs(file);
+    u32 types_len;
+    size_t *sel = malloc((n ? n : 1) * sizeof(*sel));
+
+    picked = calloc(n ? n : 1, 1);
+    if(!sel || !picked)
+    {
+      perror("could not allocate memory for directory");
+      free(sel);
+      goto out;
+    }
+
+    ecs[i].file = file;
+    ecs[i].types = gbfs_get_ext(file, GBFS_EXT_COMPRESSION, &types_len);
+    if(raw || (ecs[i].types && types_len < n))
+      ecs[i].types = NULL;
+    ecs[i].sel = sel;
+    n_sels[i] = select_objs(file, names, n_names, sel, picked, matched);
+    free(picked);
+    picked = NULL;
+  }
+
+  for(c = 0; c < n_names; c++)
+    if(!matched[c])
+    {
+      fprintf(stderr, strpbrk(names[c], "*?[") ? "no object matches %s\n"
+                                               : "no object named %s\n",
+              names[c]);
+      goto out;
+    }
 
-  for(i = 0; i < dir_nmemb; i++)
+  /* check everything selected before writing anything */
+  for(i = 0; i < n_archives; i++)
   {
-    unsigned long len, off;
-    FILE *outfile;
+    strcpy(label, archive);
+    if(several)
+    {
+      sprintf(label + strlen(label), "@0x%lx",
+              (unsigned long)((const unsigned char *)ecs[i].file
+                              - gh.map.data));
+      if(!to_stdout && !tar_path && n_sels[i])
+        printf("%s:\n", label);
+    }
 
-    fseek(fp, dir_off + 32 * i, SEEK_SET);
-    fread(filename, 24, 1, fp);
-    len = fgeti32(fp);
-    off = fgeti32(fp);
-    printf("%10lu %s\n", (unsigned long)len, filename);
+    if(check_objs(label, &ecs[i], n_sels[i], to_stdout, !to_stdout && !tar_path))
+      goto out;
+  }
 
-    outfile = fopen(filename, "wb");
-    if(!outfile)
+  /* one tar stream holds everything, each archive in its own directory */
+  if(tar_path)
+  {
+    tar_fp = strcmp(tar_path, "-") ? fopen(tar_path, "wb") : stdout;
+    if(!tar_fp)
     {
       fputs("could not open ", stderr);
-      perror(filename);
-      fclose(fp);
-      return 1;
+      perror(tar_path);
+      goto out;
+    }
+
+    for(i = 0; i < n_archives; i++)
+    {
+      char prefix[24] = "";
+
+      if(several)
+        sprintf(prefix, "0x%lx/",
+                (unsigned long)((const unsigned char *)ecs[i].file
+                                - gh.map.data));
+      if(tar_archive(&ecs[i], n_sels[i], tar_fp, prefix))
+        goto out;
     }
-    fseek(fp, off, SEEK_SET);
-    fncpy(outfile, fp, len);
-    fclose(outfile);
+
+    if(tar_write_end(tar_fp) || fflush(tar_fp))
+    {
+      perror("could not write tar archive");
+      goto out;
+    }
+    failed = 0;
+    goto out;
   }
 
-  fclose(fp);
-  return 0;
+  if(!to_stdout && out_dir && chdir(out_dir))
+  {
+    fputs("could not change to ", stderr);
+    perror(out_dir);
+    goto out;
+  }
+
+  for(i = 0; i < n_archives; i++)
+  {
+    char subdir[24];
+
+    if(!n_sels[i])
+      continue;
+
+    if(several && !to_stdout)
+    {
+      sprintf(subdir, "0x%lx",
+              (unsigned long)((const unsigned char *)ecs[i].file
+                              - gh.map.data));
+      if((mkdir(subdir, 0777) && errno != EEXIST) || chdir(subdir))
+      {
+        fputs("could not change to ", stderr);
+        perror(subdir);
+        goto out;
+      }
+    }
+
+    if(extract_archive(&ecs[i], n_sels[i], jobs, to_stdout))
+      goto out;
+
+    if(several && !to_stdout && chdir(".."))
+    {
+      perror("could not change to ..");
+      goto out;
+    }
+  }
+
+  if(to_stdout && fflush(stdout))
+  {
+    perror("could not write to standard output");
+    goto out;
+  }
+  failed = 0;
+
+out:
+  if(tar_fp && tar_fp != stdout && fclose(tar_fp) && !failed)
+  {
+    fputs("could not write ", stderr);
+    perror(tar_path);
+    failed = 1;
+  }
+  if(ecs)
+    for(i = 0; i < n_archives; i++)
+      free((size_t *)ecs[i].sel);
+  free(ecs);
+  free(n_sels);
+  free(picked);
+  free(matched);
+  free(label);
+  gbfs_host_close(&gh);
+  return failed;
 }
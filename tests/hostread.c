@@ -0,0 +1,190 @@
+/* hostread.c
+   check the host-side GBFS reader against the files an archive was
+   built from
+
+This file is part of gba-tools.
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to
+  Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+  Boston, MA  02111-1307, USA.
+GNU licenses can be viewed online at http://www.gnu.org/copyleft/
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gbfs_host.h"
+#include "mapfile.h"
+
+static const char help_text[] =
+"usage: hostread [-e TAG]... ARCHIVE FILE...\n"
+"       hostread -r ARCHIVE\n"
+"Opens ARCHIVE with the host reader and checks that it holds exactly\n"
+"the FILEs, each under its base name, and an extension block for each\n"
+"TAG.  With -r, checks instead that ARCHIVE is rejected.\n";
+
+static int failures = 0;
+
+
+/* fail() ******************************
+   report a failed check
+*/
+static void fail(const char *archive, const char *what, const char *name)
+{
+  fprintf(stderr, "hostread: %s: %s%s%s\n", archive, what,
+                  name ? " " : "", name ? name : "");
+  failures++;
+}
+
+
+/* base_name() *************************
+   the part of path after its last slash
+*/
+static const char *base_name(const char *path)
+{
+  const char *slash = strrchr(path, '/');
+
+  return slash ? slash + 1 : path;
+}
+
+
+/* check_file() ************************
+   Checks that the archive holds the contents of path under its base
+   name, found both by name and by index.
+*/
+static void check_file(const char *archive, const GBFS_FILE *file,
+                       const char *path)
+{
+  const char *name = base_name(path);
+  const void *data, *nth;
+  MAPPED_FILE mf;
+  char nth_name[25];
+  u32 len, nth_len;
+  long i;
+
+  if(map_file(&mf, path))
+  {
+    perror(path);
+    failures++;
+    return;
+  }
+
+  data = gbfs_get_obj(file, name, &len);
+  if(!data)
+    fail(archive, "gbfs_get_obj() didn't find", name);
+  else if(len != mf.len || (len && memcmp(data, mf.data, len)))
+    fail(archive, "gbfs_get_obj() returned the wrong data for", name);
+
+  i = gbfs_find_obj(file, name);
+  if(i < 0)
+    fail(archive, "gbfs_find_obj() didn't find", name);
+  else
+  {
+    nth = gbfs_get_nth_obj(file, i, nth_name, &nth_len);
+    if(nth != data || nth_len != len || strcmp(nth_name, name))
+      fail(archive, "gbfs_get_nth_obj() disagrees with gbfs_find_obj() on",
+           name);
+  }
+
+  unmap_file(&mf);
+}
+
+
+/* check_dir() *************************
+   Checks that the directory holds n_files names in order.
+*/
+static void check_dir(const char *archive, const GBFS_FILE *file,
+                      size_t n_files)
+{
+  char name[25], prev[25] = "";
+  size_t n = gbfs_count_objs(file), i;
+  u32 len;
+
+  if(n != n_files)
+    fail(archive, "gbfs_count_objs() doesn't match the number of files", NULL);
+
+  for(i = 0; i < n; i++)
+  {
+    if(!gbfs_get_nth_obj(file, i, name, &len))
+      fail(archive, "gbfs_get_nth_obj() failed on entry", NULL);
+    else if(i > 0 && strcmp(prev, name) > 0)
+      fail(archive, "the directory is out of order at", name);
+    memcpy(prev, name, sizeof(prev));
+  }
+
+  if(gbfs_get_nth_obj(file, n, name, &len))
+    fail(archive, "gbfs_get_nth_obj() returned an entry past the end", NULL);
+  if(gbfs_get_obj(file, "no such object", &len)
+     || gbfs_find_obj(file, "no such object") >= 0)
+    fail(archive, "found a name that isn't in the archive", NULL);
+}
+
+
+int main(int argc, char **argv)
+{
+  const char *tags[8];
+  unsigned int n_tags = 0, i;
+  int reject = 0, arg = 1, err;
+  GBFS_HOST gh;
+
+  for(; arg < argc && argv[arg][0] == '-'; arg++)
+  {
+    if(!strcmp(argv[arg], "-r"))
+      reject = 1;
+    else if(!strcmp(argv[arg], "-e") && arg + 1 < argc && n_tags < 8)
+      tags[n_tags++] = argv[++arg];
+    else
+      break;
+  }
+
+  if(arg >= argc || (argv[arg][0] == '-') || (reject && argc - arg != 1))
+  {
+    fputs(help_text, stderr);
+    return EXIT_FAILURE;
+  }
+
+  err = gbfs_host_open(&gh, argv[arg]);
+  if(reject)
+  {
+    if(err == GBFS_HOST_OK)
+    {
+      gbfs_host_close(&gh);
+      fail(argv[arg], "was accepted", NULL);
+    }
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+  }
+
+  if(err != GBFS_HOST_OK)
+  {
+    fail(argv[arg], "was rejected", NULL);
+    return EXIT_FAILURE;
+  }
+
+  for(i = 0; i < n_tags; i++)
+  {
+    u32 len;
+
+    if(!gbfs_get_ext(gh.file, tags[i], &len))
+      fail(argv[arg], "has no extension block", tags[i]);
+  }
+
+  check_dir(argv[arg], gh.file, argc - arg - 1);
+  for(i = arg + 1; i < (unsigned int)argc; i++)
+    check_file(argv[arg], gh.file, argv[i]);
+
+  gbfs_host_close(&gh);
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,48 @@
+#!/bin/sh
+# Builds archives with gbfs and reads them back through the host
+# reader in gbfs_host.c: a plain archive, one with a hashed index,
+# one whose directory needs a DIR2 block, and damaged ones that must
+# be rejected.
+
+set -e
+
+bin=${top_builddir:-.}
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+cd "$work"
+
+# inputs of assorted sizes, including an empty one
+mkdir in
+: > in/empty
+printf 'a' > in/one
+awk 'BEGIN { for(i = 0; i < 3000; i++) print "line " i }' > in/lines.txt
+awk 'BEGIN { for(i = 0; i < 20000; i++) printf "%c", 33 + (i * 7919) % 90 }' > in/mixed.bin
+awk 'BEGIN { for(i = 0; i < 9000; i++) print i * i }' > in/squares
+set -- in/empty in/one in/lines.txt in/mixed.bin in/squares
+
+echo "plain archive"
+"$bin/gbfs" plain.gbfs "$@" > /dev/null
+"$bin/tests/hostread" plain.gbfs "$@"
+
+echo "hashed index"
+"$bin/gbfs" --index indexed.gbfs "$@" > /dev/null
+"$bin/tests/hostread" -e MPHI indexed.gbfs "$@"
+
+echo "DIR2 header"
+awk 'BEGIN { for(i = 0; i < 20000; i++) print "padding " i }' > in/large
+"$bin/gbfs" --dir-at-end large.gbfs "$@" in/large > /dev/null
+"$bin/tests/hostread" -e DIR2 large.gbfs "$@" in/large
+
+echo "truncated archive"
+head -c 1000 plain.gbfs > truncated.gbfs
+"$bin/tests/hostread" -r truncated.gbfs
+
+echo "DIR2 flag without a DIR2 block"
+cp plain.gbfs flagged.gbfs
+printf '\001' | dd of=flagged.gbfs bs=1 seek=28 conv=notrunc 2> /dev/null
+"$bin/tests/hostread" -r flagged.gbfs
+
+echo "directory past the end"
+cp plain.gbfs baddir.gbfs
+printf '\377\377' | dd of=baddir.gbfs bs=1 seek=22 conv=notrunc 2> /dev/null
+"$bin/tests/hostread" -r baddir.gbfs